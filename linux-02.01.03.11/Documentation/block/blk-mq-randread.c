@@ -0,0 +1,170 @@
+/*
+ * blk-mq-randread: random O_DIRECT reads from many threads at once, to
+ * measure how request submission scales with the number of cpus.
+ *
+ * Usage: blk-mq-randread [-t nr_threads] [-b block_size] [-s seconds] device
+ *
+ * Each of nr_threads threads (one per online cpu by default) reads
+ * block_size bytes at random aligned offsets of the device, one read at a
+ * time, for the given number of seconds.  A RAM disk is the best target,
+ * since it takes the device out of the picture, e.g.
+ *
+ *	modprobe brd rd_size=1048576
+ *	dd if=/dev/zero of=/dev/ram0 bs=1M count=1024 oflag=direct
+ *	blk-mq-randread /dev/ram0
+ *
+ * and then the same with "modprobe brd use_mq=1", which sends the reads
+ * through the multiqueue block layer instead of straight to the driver.
+ * Filling the disk first makes sure the reads don't hit unallocated pages.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/fs.h>
+
+static const char *device;
+static unsigned long long nr_blocks;
+static unsigned int block_size = 4096;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	unsigned long long reads;
+	int failed;
+};
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t nr_threads] [-b block_size] "
+			"[-s seconds] device\n", prog);
+	exit(1);
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long block;
+	void *buf;
+	int fd;
+
+	/* each thread has its own file, so that nothing is shared above */
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if (fd < 0 || posix_memalign(&buf, 4096, block_size)) {
+		w->failed = 1;
+		return NULL;
+	}
+
+	while (!stop) {
+		block = ((unsigned long long)rand_r(&w->seed) << 31 |
+			 rand_r(&w->seed)) % nr_blocks;
+		if (pread(fd, buf, block_size, block * block_size) !=
+		    block_size) {
+			w->failed = 1;
+			break;
+		}
+		w->reads++;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	long nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long long size, reads = 0;
+	struct worker *workers;
+	int seconds = 10;
+	int opt, fd, i, failed = 0;
+	double t0, t1;
+
+	while ((opt = getopt(argc, argv, "t:b:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = strtol(optarg, NULL, 0);
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nr_threads <= 0 || seconds <= 0 ||
+	    block_size < 512 || block_size & (block_size - 1))
+		usage(argv[0]);
+	device = argv[optind];
+
+	/* a regular file works too, to try the program out */
+	fd = open(device, O_RDONLY);
+	if (fd < 0) {
+		perror(device);
+		return 1;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &size))
+		size = lseek(fd, 0, SEEK_END);
+	close(fd);
+	nr_blocks = size / block_size;
+	if (!nr_blocks) {
+		fprintf(stderr, "%s: smaller than one block\n", device);
+		return 1;
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	t0 = now();
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].seed = i + 1;
+		if (pthread_create(&workers[i].thread, NULL, worker,
+				   &workers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		reads += workers[i].reads;
+		failed |= workers[i].failed;
+	}
+	t1 = now();
+
+	if (failed) {
+		fprintf(stderr, "a read failed\n");
+		return 1;
+	}
+
+	printf("%ld threads, %u byte reads from %s\n", nr_threads,
+	       block_size, device);
+	printf("%llu reads in %.3fs: %.0f reads/sec, %.1f MB/s\n",
+	       reads, t1 - t0, reads / (t1 - t0),
+	       reads * block_size / (t1 - t0) / (1 << 20));
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * memcg-fault-bench: parallel anonymous page faults inside a memory cgroup,
+ * to measure the cost of charging and uncharging pages.
+ *
+ * Usage: memcg-fault-bench [-p nr_procs] [-s size_mb] [-l loops] [-c cgroup]
+ *
+ * Each of nr_procs processes (one per online cpu by default) repeatedly
+ * maps size_mb of private anonymous memory, writes one byte per page and
+ * unmaps it again, so that every page is charged at fault time and
+ * uncharged at unmap.  Processes rather than threads are used so that
+ * the mm's mmap_sem and page table lock are not shared.  With -c, the
+ * processes first move themselves to the given cgroup directory, e.g.
+ *
+ *	mount -t cgroup -o memory none /cgroups
+ *	mkdir /cgroups/bench
+ *	memcg-fault-bench -c /cgroups/bench
+ *
+ * Compare the faults/sec with and without -c, and with different numbers
+ * of processes, to see how the charge path scales.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p nr_procs] [-s size_mb] [-l loops] "
+			"[-c cgroup]\n", prog);
+	exit(1);
+}
+
+static void join_cgroup(const char *cgroup)
+{
+	char path[4096];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/tasks", cgroup);
+	f = fopen(path, "w");
+	if (!f || fprintf(f, "%d\n", getpid()) < 0 || fclose(f)) {
+		perror(path);
+		exit(1);
+	}
+}
+
+static void worker(unsigned long size, int loops, long page_size)
+{
+	unsigned long off;
+	char *buf;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+		for (off = 0; off < size; off += page_size)
+			buf[off] = 1;
+		munmap(buf, size);
+	}
+	exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	long nr_procs = sysconf(_SC_NPROCESSORS_ONLN);
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned long size = 64UL << 20;
+	const char *cgroup = NULL;
+	int loops = 20;
+	int opt, i, status, failed = 0;
+	double t0, t1, faults;
+
+	while ((opt = getopt(argc, argv, "p:s:l:c:")) != -1) {
+		switch (opt) {
+		case 'p':
+			nr_procs = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'l':
+			loops = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			cgroup = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_procs <= 0 || !size || loops <= 0)
+		usage(argv[0]);
+
+	/* children inherit the cgroup */
+	if (cgroup)
+		join_cgroup(cgroup);
+
+	t0 = now();
+	for (i = 0; i < nr_procs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid)
+			worker(size, loops, page_size);
+	}
+	while (wait(&status) > 0)
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	t1 = now();
+
+	if (failed) {
+		fprintf(stderr, "a worker failed\n");
+		return 1;
+	}
+
+	faults = (double)nr_procs * loops * (size / page_size);
+	printf("%ld procs, %luMB x %d loops each%s%s\n", nr_procs,
+	       size >> 20, loops, cgroup ? ", in " : "", cgroup ? cgroup : "");
+	printf("%.0f faults in %.3fs: %.0f faults/sec\n",
+	       faults, t1 - t0, faults / (t1 - t0));
+	return 0;
+}
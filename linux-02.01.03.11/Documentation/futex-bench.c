@@ -0,0 +1,209 @@
+/*
+ * futex-bench.c
+ *
+ * Futex hash contention benchmark.  Starts N processes of M threads
+ * each, and has every thread operate on private futexes of its own
+ * process for a while, then reports the number of futex operations
+ * done per second in total and per process.
+ *
+ * Threads of different processes never touch the same futex, but
+ * their private futexes used to hash into the same global table as
+ * everything else, so adding processes made every one of them slower.
+ * With a hash table per process, the per process rate should only go
+ * down once the CPUs are all busy.
+ *
+ * Two workloads are available:
+ *   wait   each thread calls FUTEX_WAIT on a word of its own with a
+ *          value it does not have, which locks the hash bucket and
+ *          returns EWOULDBLOCK at once (the default)
+ *   mutex  the threads of a process contend on a futex based mutex,
+ *          sleeping in FUTEX_WAIT and woken by FUTEX_WAKE
+ *
+ * Compile with
+ *	gcc -O2 -Wall -pthread futex-bench.c -o futex-bench
+ *
+ * Usage: futex-bench [-p processes] [-t threads] [-s seconds] [-m]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#ifndef FUTEX_PRIVATE_FLAG
+#define FUTEX_PRIVATE_FLAG	128
+#endif
+#define FUTEX_WAIT_PRIV		(FUTEX_WAIT | FUTEX_PRIVATE_FLAG)
+#define FUTEX_WAKE_PRIV		(FUTEX_WAKE | FUTEX_PRIVATE_FLAG)
+
+/* keep the futex words of different threads on different cache lines */
+#define CACHELINE	64
+
+static int nr_procs = 4;
+static int nr_threads = 4;
+static int seconds = 5;
+static int mutex_mode;
+
+static volatile int stop;
+static int lock_word __attribute__((aligned(CACHELINE)));
+
+struct thread_data {
+	pthread_t thread;
+	int word;
+	unsigned long ops;
+} __attribute__((aligned(CACHELINE)));
+
+/* per process results, in memory shared with the parent */
+static unsigned long *results;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static int futex(int *uaddr, int op, int val)
+{
+	return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+/*
+ * The mutex of "Futexes Are Tricky", by Ulrich Drepper:
+ * 0 unlocked, 1 locked, 2 locked with waiters.
+ */
+static void mutex_lock(int *m)
+{
+	int c = __sync_val_compare_and_swap(m, 0, 1);
+
+	if (!c)
+		return;
+	if (c != 2)
+		c = __sync_lock_test_and_set(m, 2);
+	while (c) {
+		futex(m, FUTEX_WAIT_PRIV, 2);
+		c = __sync_lock_test_and_set(m, 2);
+	}
+}
+
+static void mutex_unlock(int *m)
+{
+	if (__sync_fetch_and_sub(m, 1) != 1) {
+		*m = 0;
+		futex(m, FUTEX_WAKE_PRIV, 1);
+	}
+}
+
+static void *bench_thread(void *arg)
+{
+	struct thread_data *td = arg;
+
+	while (!stop) {
+		if (mutex_mode) {
+			mutex_lock(&lock_word);
+			mutex_unlock(&lock_word);
+		} else if (futex(&td->word, FUTEX_WAIT_PRIV, 1) == 0 ||
+			   errno != EWOULDBLOCK) {
+			die("futex");
+		}
+		td->ops++;
+	}
+	return NULL;
+}
+
+static void bench_process(int id)
+{
+	struct thread_data *td;
+	unsigned long ops = 0;
+	int i;
+
+	td = calloc(nr_threads, sizeof(*td));
+	if (!td)
+		die("calloc");
+
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&td[i].thread, NULL, bench_thread, &td[i]))
+			die("pthread_create");
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(td[i].thread, NULL);
+		ops += td[i].ops;
+	}
+	results[id] = ops;
+	exit(0);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long total = 0, min = ~0UL, max = 0;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "p:t:s:m")) != -1) {
+		switch (opt) {
+		case 'p':
+			nr_procs = atoi(optarg);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			mutex_mode = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p processes] [-t threads] "
+				"[-s seconds] [-m]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nr_procs <= 0 || nr_threads <= 0 || seconds <= 0) {
+		fprintf(stderr, "%s: bad arguments\n", argv[0]);
+		return 1;
+	}
+
+	results = mmap(NULL, nr_procs * sizeof(*results),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	if (results == MAP_FAILED)
+		die("mmap");
+
+	for (i = 0; i < nr_procs; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			bench_process(i);
+	}
+
+	for (i = 0; i < nr_procs; i++)
+		if (wait(NULL) < 0)
+			die("wait");
+
+	for (i = 0; i < nr_procs; i++) {
+		total += results[i];
+		if (results[i] < min)
+			min = results[i];
+		if (results[i] > max)
+			max = results[i];
+	}
+
+	printf("%s: %d processes x %d threads, %d s\n",
+	       mutex_mode ? "mutex" : "wait", nr_procs, nr_threads, seconds);
+	printf("total:       %12lu ops/s\n", total / seconds);
+	printf("per process: %12lu ops/s average, min %lu, max %lu\n",
+	       total / seconds / nr_procs, min / seconds, max / seconds);
+
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * sched-pingpong.c
+ *
+ * Measure what it costs to move a task's working set between two CPUs,
+ * for every pair of online CPUs.  Two processes pinned to the CPUs of a
+ * pair pass a token back and forth through pipes, and each of them
+ * dirties a shared buffer before handing the token over, like a task
+ * migrated to the other CPU would.  CPUs sharing a cache (the same
+ * physical package / cluster in /sys/devices/system/cpu/cpuN/topology)
+ * should show a clearly lower round trip time than CPUs that don't;
+ * that difference is what the multi-core scheduler domains take into
+ * account when balancing.
+ *
+ * Compile with
+ *	gcc -O2 -Wall sched-pingpong.c -o sched-pingpong
+ *
+ * Usage: sched-pingpong [-s buffer_kb] [-n round_trips]
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+static size_t buf_size = 64 * 1024;
+static int round_trips = 10000;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		die("sched_setaffinity");
+}
+
+static void touch(volatile char *buf, char val)
+{
+	size_t i;
+
+	for (i = 0; i < buf_size; i += 32)
+		buf[i] = val;
+}
+
+static int package_id(int cpu)
+{
+	char path[128];
+	FILE *f;
+	int id = -1;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+		 cpu);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%d", &id) != 1)
+			id = -1;
+		fclose(f);
+	}
+	return id;
+}
+
+/* returns the average round trip between @a and @b in microseconds */
+static double pingpong(int a, int b, char *buf)
+{
+	int ping[2], pong[2];
+	struct timeval start, end;
+	char token = 0;
+	pid_t pid;
+	int i;
+
+	if (pipe(ping) || pipe(pong))
+		die("pipe");
+
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+
+	if (!pid) {
+		pin(b);
+		for (i = 0; i < round_trips; i++) {
+			if (read(ping[0], &token, 1) != 1)
+				die("read");
+			touch(buf, token);
+			if (write(pong[1], &token, 1) != 1)
+				die("write");
+		}
+		exit(0);
+	}
+
+	pin(a);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < round_trips; i++) {
+		touch(buf, token);
+		if (write(ping[1], &token, 1) != 1)
+			die("write");
+		if (read(pong[0], &token, 1) != 1)
+			die("read");
+		token++;
+	}
+	gettimeofday(&end, NULL);
+	waitpid(pid, NULL, 0);
+
+	close(ping[0]);
+	close(ping[1]);
+	close(pong[0]);
+	close(pong[1]);
+
+	return ((end.tv_sec - start.tv_sec) * 1e6 +
+		(end.tv_usec - start.tv_usec)) / round_trips;
+}
+
+int main(int argc, char **argv)
+{
+	double same = 0, cross = 0;
+	int nr_same = 0, nr_cross = 0;
+	int ncpus, a, b, opt;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			buf_size = strtoul(optarg, NULL, 0) * 1024;
+			break;
+		case 'n':
+			round_trips = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s buffer_kb] "
+				"[-n round_trips]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	buf = mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		die("mmap");
+	memset(buf, 0, buf_size);
+
+	printf("%zu KB working set, %d round trips per pair\n\n",
+	       buf_size / 1024, round_trips);
+	printf("cpu pkg  cpu pkg  round trip (us)\n");
+
+	for (a = 0; a < ncpus; a++) {
+		for (b = a + 1; b < ncpus; b++) {
+			int pa = package_id(a), pb = package_id(b);
+			double us = pingpong(a, b, buf);
+
+			printf("%3d %3d  %3d %3d  %10.2f\n", a, pa, b, pb, us);
+			if (pa == pb) {
+				same += us;
+				nr_same++;
+			} else {
+				cross += us;
+				nr_cross++;
+			}
+		}
+	}
+
+	printf("\n");
+	if (nr_same)
+		printf("same package:  %10.2f us average\n", same / nr_same);
+	if (nr_cross)
+		printf("cross package: %10.2f us average\n", cross / nr_cross);
+
+	return 0;
+}
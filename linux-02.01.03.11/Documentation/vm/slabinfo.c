@@ -39,6 +39,7 @@ struct slabinfo {
 	unsigned long cpuslab_flush, deactivate_full, deactivate_empty;
 	unsigned long deactivate_to_head, deactivate_to_tail;
 	unsigned long deactivate_remote_frees, order_fallback;
+	unsigned long free_remote_buffer, free_remote_flush;
 	int numa[MAX_NODES];
 	int numa_partial[MAX_NODES];
 } slabinfo[MAX_SLABS];
@@ -422,7 +423,8 @@ void slab_stats(struct slabinfo *s)
 		return;
 
 	total_alloc = s->alloc_fastpath + s->alloc_slowpath;
-	total_free = s->free_fastpath + s->free_slowpath;
+	total_free = s->free_fastpath + s->free_slowpath +
+			s->free_remote_buffer;
 
 	if (!total_alloc)
 		return;
@@ -465,6 +467,10 @@ void slab_stats(struct slabinfo *s)
 	if (s->alloc_refill)
 		printf("Refill %8lu\n", s->alloc_refill);
 
+	if (s->free_remote_flush)
+		printf("Remote free buffer %8lu hits %8lu flushes\n",
+			s->free_remote_buffer, s->free_remote_flush);
+
 	total = s->deactivate_full + s->deactivate_empty +
 			s->deactivate_to_head + s->deactivate_to_tail;
 
@@ -1190,6 +1196,8 @@ void read_slab_dir(void)
 			slab->deactivate_to_tail = get_obj("deactivate_to_tail");
 			slab->deactivate_remote_frees = get_obj("deactivate_remote_frees");
 			slab->order_fallback = get_obj("order_fallback");
+			slab->free_remote_buffer = get_obj("free_remote_buffer");
+			slab->free_remote_flush = get_obj("free_remote_flush");
 			chdir("..");
 			if (slab->name[0] == ':')
 				alias_targets++;
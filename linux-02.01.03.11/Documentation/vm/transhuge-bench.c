@@ -0,0 +1,141 @@
+/*
+ * transhuge-bench: random access over a large anonymous buffer, to show
+ * the effect of transparent huge pages on TLB-miss bound workloads.
+ *
+ * Usage: transhuge-bench [-s size_mb] [-n accesses] [-m huge|nohuge|default]
+ *
+ * The buffer is first populated (timing the page faults), then read at
+ * pseudo-random offsets, each address depending on the value just read so
+ * that the loads cannot overlap.  Run it once with -m huge and once with
+ * -m nohuge, with /sys/kernel/mm/transparent_hugepage/enabled set to
+ * "madvise", and compare.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE	14
+#endif
+#ifndef MADV_NOHUGEPAGE
+#define MADV_NOHUGEPAGE	15
+#endif
+
+#define HPAGE_SIZE	(2UL << 20)
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static unsigned long vmstat(const char *name)
+{
+	char line[128];
+	unsigned long val = 0;
+	size_t len = strlen(name);
+	FILE *f = fopen("/proc/vmstat", "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, name, len) && line[len] == ' ') {
+			val = strtoul(line + len + 1, NULL, 10);
+			break;
+		}
+	}
+	fclose(f);
+	return val;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s size_mb] [-n accesses] "
+			"[-m huge|nohuge|default]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long size = 1024UL << 20;
+	unsigned long accesses = 50000000UL;
+	unsigned long nwords, i, idx, sum = 0;
+	unsigned long thp_before, thp_after;
+	unsigned long long x = 88172645463325252ULL;
+	const char *mode = "default";
+	unsigned long *buf;
+	char *map;
+	double t0, t1, t2;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n:m:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'n':
+			accesses = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!size)
+		usage(argv[0]);
+
+	/* Over-allocate so that the buffer can start on a huge page boundary */
+	map = mmap(NULL, size + HPAGE_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	buf = (unsigned long *)(((unsigned long)map + HPAGE_SIZE - 1) &
+				~(HPAGE_SIZE - 1));
+
+	if (!strcmp(mode, "huge")) {
+		if (madvise(buf, size, MADV_HUGEPAGE))
+			perror("madvise(MADV_HUGEPAGE)");
+	} else if (!strcmp(mode, "nohuge")) {
+		if (madvise(buf, size, MADV_NOHUGEPAGE))
+			perror("madvise(MADV_NOHUGEPAGE)");
+	} else if (strcmp(mode, "default"))
+		usage(argv[0]);
+
+	nwords = size / sizeof(unsigned long);
+	thp_before = vmstat("thp_fault_alloc");
+	t0 = now();
+	/* Each word holds a random next index: a pointer chase */
+	for (i = 0; i < nwords; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[i] = x % nwords;
+	}
+	t1 = now();
+	thp_after = vmstat("thp_fault_alloc");
+
+	idx = 0;
+	for (i = 0; i < accesses; i++) {
+		idx = buf[idx];
+		sum += idx;
+	}
+	t2 = now();
+
+	printf("mode %-8s size %luMB  huge pages faulted %lu\n",
+	       mode, size >> 20, thp_after - thp_before);
+	printf("populate %.3fs  random access %.1fns/access  (checksum %lx)\n",
+	       t1 - t0, (t2 - t1) * 1e9 / accesses, sum);
+	return 0;
+}
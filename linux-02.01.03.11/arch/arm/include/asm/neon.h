@@ -0,0 +1,25 @@
+/*
+ *  arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+/*
+ * NEON code in the kernel must be bracketed by these, from process
+ * context: kernel_neon_begin() saves the NEON/VFP state of whoever owns
+ * the unit on this cpu and disables preemption until kernel_neon_end().
+ * Code built with -mfpu=neon must be kept in separate files, so that
+ * the compiler never emits NEON instructions outside of such a section.
+ */
+void kernel_neon_begin(void);
+void kernel_neon_end(void);
+
+#endif
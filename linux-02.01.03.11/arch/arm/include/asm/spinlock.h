@@ -5,6 +5,135 @@
 #error SMP not supported on pre-ARMv6 CPUs
 #endif
 
+static inline void dsb_sev(void)
+{
+#ifdef CONFIG_CPU_32v6K
+	__asm__ __volatile__(
+"	mcr	p15, 0, %0, c7, c10, 4\n" /* DSB */
+"	sev"
+	:
+	: "r" (0));
+#endif
+}
+
+#ifdef CONFIG_ARM_TICKET_SPINLOCKS
+/*
+ * ARMv6 ticket-based spin-locking.
+ *
+ * The lock word holds two 16-bit tickets: the low half is the ticket
+ * currently being served (owner), the high half the next ticket to be
+ * handed out.  A locker exclusively increments the high half to draw
+ * its ticket and then waits until the owner half reaches it, so
+ * waiters get the lock in the order they arrived.  Unlocking
+ * increments the owner half only (uadd16 keeps the carry out of the
+ * next half), and sends an event to wake up the waiters sitting in
+ * WFE.
+ *
+ * Unlocked value: owner == next
+ * Locked value: owner != next
+ */
+
+#define TICKET_SHIFT	16
+#define TICKET_MASK	((1 << TICKET_SHIFT) - 1)
+
+static inline int __raw_spin_is_locked(raw_spinlock_t *lock)
+{
+	unsigned int tmp = lock->lock;
+
+	return ((tmp >> TICKET_SHIFT) ^ tmp) & TICKET_MASK;
+}
+
+static inline int __raw_spin_is_contended(raw_spinlock_t *lock)
+{
+	unsigned int tmp = lock->lock;
+
+	return (((tmp >> TICKET_SHIFT) - tmp) & TICKET_MASK) > 1;
+}
+
+#define __raw_spin_unlock_wait(lock) \
+	do { while (__raw_spin_is_locked(lock)) cpu_relax(); } while (0)
+
+#define __raw_spin_lock_flags(lock, flags) __raw_spin_lock(lock)
+
+static inline void __raw_spin_lock(raw_spinlock_t *lock)
+{
+	unsigned long tmp, ticket;
+	unsigned int old;
+
+	__asm__ __volatile__(
+"1:	ldrex	%0, [%3]\n"
+"	add	%1, %0, %4\n"
+"	strex	%2, %1, [%3]\n"
+"	teq	%2, #0\n"
+"	bne	1b"
+	: "=&r" (old), "=&r" (ticket), "=&r" (tmp)
+	: "r" (&lock->lock), "I" (1 << TICKET_SHIFT)
+	: "cc");
+
+	ticket = old >> TICKET_SHIFT;
+	while (ticket != (old & TICKET_MASK)) {
+#ifdef CONFIG_CPU_32v6K
+		__asm__ __volatile__("wfe" : : : "memory");
+#else
+		cpu_relax();
+#endif
+		old = lock->lock;
+	}
+
+	smp_mb();
+}
+
+static inline int __raw_spin_trylock(raw_spinlock_t *lock)
+{
+	unsigned long tmp;
+	unsigned int old;
+
+	/*
+	 * Only fail if the lock is really taken, not because the
+	 * exclusive monitor was lost to another cpu drawing a ticket.
+	 */
+	__asm__ __volatile__(
+"1:	ldrex	%0, [%2]\n"
+"	subs	%1, %0, %0, ror #16\n"
+"	bne	2f\n"
+"	add	%0, %0, %3\n"
+"	strex	%1, %0, [%2]\n"
+"	teq	%1, #0\n"
+"	bne	1b\n"
+"2:"
+	: "=&r" (old), "=&r" (tmp)
+	: "r" (&lock->lock), "I" (1 << TICKET_SHIFT)
+	: "cc");
+
+	if (tmp == 0) {
+		smp_mb();
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+static inline void __raw_spin_unlock(raw_spinlock_t *lock)
+{
+	unsigned long tmp, tmp2;
+
+	smp_mb();
+
+	__asm__ __volatile__(
+"1:	ldrex	%0, [%2]\n"
+"	uadd16	%0, %0, %3\n"
+"	strex	%1, %0, [%2]\n"
+"	teq	%1, #0\n"
+"	bne	1b"
+	: "=&r" (tmp), "=&r" (tmp2)
+	: "r" (&lock->lock), "r" (1)
+	: "cc");
+
+	dsb_sev();
+}
+
+#else /* !CONFIG_ARM_TICKET_SPINLOCKS */
+
 /*
  * ARMv6 Spin-locking.
  *
@@ -68,16 +197,16 @@ static inline void __raw_spin_unlock(raw_spinlock_t *lock)
 	smp_mb();
 
 	__asm__ __volatile__(
-"	str	%1, [%0]\n"
-#ifdef CONFIG_CPU_32v6K
-"	mcr	p15, 0, %1, c7, c10, 4\n" /* DSB */
-"	sev"
-#endif
+"	str	%1, [%0]"
 	:
 	: "r" (&lock->lock), "r" (0)
 	: "cc");
+
+	dsb_sev();
 }
 
+#endif /* CONFIG_ARM_TICKET_SPINLOCKS */
+
 /*
  * RWLOCKS
  *
@@ -110,10 +239,19 @@ static inline int __raw_write_trylock(raw_rwlock_t *rw)
 {
 	unsigned long tmp;
 
+	/*
+	 * Retry a failed store-exclusive while the lock is still free:
+	 * losing the monitor to a reader on another cpu doesn't mean the
+	 * lock is taken.
+	 */
 	__asm__ __volatile__(
 "1:	ldrex	%0, [%1]\n"
 "	teq	%0, #0\n"
-"	strexeq	%0, %2, [%1]"
+"	bne	2f\n"
+"	strex	%0, %2, [%1]\n"
+"	teq	%0, #0\n"
+"	bne	1b\n"
+"2:"
 	: "=&r" (tmp)
 	: "r" (&rw->lock), "r" (0x80000000)
 	: "cc");
@@ -131,14 +269,12 @@ static inline void __raw_write_unlock(raw_rwlock_t *rw)
 	smp_mb();
 
 	__asm__ __volatile__(
-	"str	%1, [%0]\n"
-#ifdef CONFIG_CPU_32v6K
-"	mcr	p15, 0, %1, c7, c10, 4\n" /* DSB */
-"	sev\n"
-#endif
+"	str	%1, [%0]"
 	:
 	: "r" (&rw->lock), "r" (0)
 	: "cc");
+
+	dsb_sev();
 }
 
 /* write_can_lock - would write_trylock() succeed? */
@@ -202,16 +338,25 @@ static inline int __raw_read_trylock(raw_rwlock_t *rw)
 {
 	unsigned long tmp, tmp2 = 1;
 
+	/* as for write_trylock, only give up if a writer holds the lock */
 	__asm__ __volatile__(
 "1:	ldrex	%0, [%2]\n"
 "	adds	%0, %0, #1\n"
-"	strexpl	%1, %0, [%2]\n"
+"	bmi	2f\n"
+"	strex	%1, %0, [%2]\n"
+"	teq	%1, #0\n"
+"	bne	1b\n"
+"2:"
 	: "=&r" (tmp), "+r" (tmp2)
 	: "r" (&rw->lock)
 	: "cc");
 
-	smp_mb();
-	return tmp2 == 0;
+	if (tmp2 == 0) {
+		smp_mb();
+		return 1;
+	} else {
+		return 0;
+	}
 }
 
 /* read_can_lock - would read_trylock() succeed? */
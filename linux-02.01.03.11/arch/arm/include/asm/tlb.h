@@ -27,15 +27,38 @@
 
 #else /* !CONFIG_MMU */
 
+#include <linux/swap.h>
 #include <asm/pgalloc.h>
 
+/*
+ * On SMP, every CPU the mm has run on may hold entries for it in its
+ * TLB, and invalidating them costs an IPI to each of those CPUs.  So
+ * pages being unmapped are gathered, along with the range of addresses
+ * they were mapped at, and the TLBs are flushed once per vma or once
+ * per FREE_PTE_NR pages, before any of the pages is freed.  On UP, or
+ * with only one CPU online, the pages can be freed at once.
+ */
+#ifdef CONFIG_SMP
+#define FREE_PTE_NR		500
+#define tlb_fast_mode(tlb)	((tlb)->nr == ~0U)
+#else
+#define FREE_PTE_NR		1
+#define tlb_fast_mode(tlb)	1
+#endif
+
 /*
  * TLB handling.  This allows us to remove pages from the page
  * tables, and efficiently handle the TLB issues.
  */
 struct mmu_gather {
 	struct mm_struct	*mm;
-	unsigned int		fullmm;
+	unsigned int		nr;	/* set to ~0U means fast mode */
+	unsigned int		fullmm;	/* non-zero means full mm flush */
+	unsigned int		need_flush_mm;	/* page tables were freed */
+	struct vm_area_struct	*vma;
+	unsigned long		range_start;
+	unsigned long		range_end;
+	struct page		*pages[FREE_PTE_NR];
 };
 
 DECLARE_PER_CPU(struct mmu_gather, mmu_gathers);
@@ -46,16 +69,52 @@ tlb_gather_mmu(struct mm_struct *mm, unsigned int full_mm_flush)
 	struct mmu_gather *tlb = &get_cpu_var(mmu_gathers);
 
 	tlb->mm = mm;
+
+	/* Use fast mode if only one CPU is online */
+	tlb->nr = num_online_cpus() > 1 ? 0U : ~0U;
+
 	tlb->fullmm = full_mm_flush;
+	tlb->need_flush_mm = 0;
+	tlb->vma = NULL;
+	tlb->range_start = TASK_SIZE;
+	tlb->range_end = 0;
 
 	return tlb;
 }
 
+/*
+ * Invalidate what has been unmapped since the last flush: the whole mm
+ * when tearing it down or when page tables went away, else just the
+ * range of addresses recorded by tlb_remove_tlb_entry().  Either way
+ * this is one round of IPIs, to the CPUs in mm->cpu_vm_mask only.
+ */
+static inline void tlb_flush(struct mmu_gather *tlb)
+{
+	if (tlb->fullmm || tlb->need_flush_mm ||
+	    (tlb->range_end && !tlb->vma)) {
+		flush_tlb_mm(tlb->mm);
+		tlb->need_flush_mm = 0;
+	} else if (tlb->range_end)
+		flush_tlb_range(tlb->vma, tlb->range_start, tlb->range_end);
+
+	tlb->range_start = TASK_SIZE;
+	tlb->range_end = 0;
+}
+
+/* Flush the TLBs, then free the pages which were gathered */
+static inline void tlb_flush_mmu(struct mmu_gather *tlb)
+{
+	tlb_flush(tlb);
+	if (!tlb_fast_mode(tlb)) {
+		free_pages_and_swap_cache(tlb->pages, tlb->nr);
+		tlb->nr = 0;
+	}
+}
+
 static inline void
 tlb_finish_mmu(struct mmu_gather *tlb, unsigned long start, unsigned long end)
 {
-	if (tlb->fullmm)
-		flush_tlb_mm(tlb->mm);
+	tlb_flush_mmu(tlb);
 
 	/* keep the page table cache within bounds */
 	check_pgt_cache();
@@ -63,7 +122,22 @@ tlb_finish_mmu(struct mmu_gather *tlb, unsigned long start, unsigned long end)
 	put_cpu_var(mmu_gathers);
 }
 
-#define tlb_remove_tlb_entry(tlb,ptep,address)	do { } while (0)
+/*
+ * Record an unmapped pte: a full mm flush covers it anyway, otherwise
+ * the range to invalidate grows to include it.
+ */
+static inline void
+tlb_add_flush(struct mmu_gather *tlb, unsigned long addr)
+{
+	if (!tlb->fullmm) {
+		if (addr < tlb->range_start)
+			tlb->range_start = addr;
+		if (addr + PAGE_SIZE > tlb->range_end)
+			tlb->range_end = addr + PAGE_SIZE;
+	}
+}
+
+#define tlb_remove_tlb_entry(tlb,ptep,address)	tlb_add_flush(tlb,address)
 
 /*
  * In the case of tlb vma handling, we can optimise these away in the
@@ -73,19 +147,45 @@ tlb_finish_mmu(struct mmu_gather *tlb, unsigned long start, unsigned long end)
 static inline void
 tlb_start_vma(struct mmu_gather *tlb, struct vm_area_struct *vma)
 {
-	if (!tlb->fullmm)
+	if (!tlb->fullmm) {
 		flush_cache_range(vma, vma->vm_start, vma->vm_end);
+		tlb->vma = vma;
+	}
 }
 
 static inline void
 tlb_end_vma(struct mmu_gather *tlb, struct vm_area_struct *vma)
 {
-	if (!tlb->fullmm)
-		flush_tlb_range(vma, vma->vm_start, vma->vm_end);
+	if (!tlb->fullmm) {
+		tlb_flush_mmu(tlb);
+		tlb->vma = NULL;
+	}
+}
+
+static inline void tlb_remove_page(struct mmu_gather *tlb, struct page *page)
+{
+	if (tlb_fast_mode(tlb)) {
+		free_page_and_swap_cache(page);
+		return;
+	}
+	tlb->pages[tlb->nr++] = page;
+	if (tlb->nr >= FREE_PTE_NR)
+		tlb_flush_mmu(tlb);
+}
+
+/*
+ * Another CPU may still be walking a page table which is being freed:
+ * it goes through the gather like any other page, and the whole mm is
+ * flushed before it is freed, as its address is not known here.
+ */
+static inline void __pte_free_tlb(struct mmu_gather *tlb, pgtable_t pte)
+{
+	pgtable_page_dtor(pte);
+	tlb->need_flush_mm = 1;
+	tlb_remove_page(tlb, pte);
 }
 
-#define tlb_remove_page(tlb,page)	free_page_and_swap_cache(page)
-#define pte_free_tlb(tlb, ptep)		pte_free((tlb)->mm, ptep)
+#define pte_free_tlb(tlb, ptep)		__pte_free_tlb(tlb, ptep)
 #define pmd_free_tlb(tlb, pmdp)		pmd_free((tlb)->mm, pmdp)
 
 #define tlb_migrate_finish(mm)		do { } while (0)
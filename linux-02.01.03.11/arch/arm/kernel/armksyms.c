@@ -47,6 +47,11 @@ extern void __aeabi_uidiv(void);
 extern void __aeabi_uidivmod(void);
 extern void __aeabi_ulcmp(void);
 
+extern void xor_neon_2(void);
+extern void xor_neon_3(void);
+extern void xor_neon_4(void);
+extern void xor_neon_5(void);
+
 extern void fpundefinstr(void);
 extern void fp_enter(void);
 
@@ -187,3 +192,10 @@ EXPORT_SYMBOL(_find_next_bit_be);
 #ifdef CONFIG_FUNCTION_TRACER
 EXPORT_SYMBOL(mcount);
 #endif
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+EXPORT_SYMBOL(xor_neon_2);
+EXPORT_SYMBOL(xor_neon_3);
+EXPORT_SYMBOL(xor_neon_4);
+EXPORT_SYMBOL(xor_neon_5);
+#endif
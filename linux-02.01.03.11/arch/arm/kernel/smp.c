@@ -31,6 +31,7 @@
 #include <asm/pgalloc.h>
 #include <asm/processor.h>
 #include <asm/tlbflush.h>
+#include <asm/topology.h>
 #include <asm/ptrace.h>
 
 /*
@@ -300,6 +301,8 @@ void __cpuinit smp_store_cpu_info(unsigned int cpuid)
 	struct cpuinfo_arm *cpu_info = &per_cpu(cpu_data, cpuid);
 
 	cpu_info->loops_per_jiffy = loops_per_jiffy;
+
+	store_cpu_topology(cpuid);
 }
 
 void __init smp_cpus_done(unsigned int max_cpus)
@@ -322,6 +325,8 @@ void __init smp_prepare_boot_cpu(void)
 	unsigned int cpu = smp_processor_id();
 
 	per_cpu(cpu_data, cpu).idle = current;
+
+	init_cpu_topology();
 }
 
 static void send_ipi_message(cpumask_t callmap, enum ipi_msg_type msg)
@@ -647,3 +652,12 @@ void flush_tlb_kernel_range(unsigned long start, unsigned long end)
 
 	on_each_cpu(ipi_flush_tlb_kernel_range, &ta, 1);
 }
+
+/*
+ * Flush the whole TLB of each CPU in the mask, with one round of IPIs:
+ * used by reclaim for a batch of pages unmapped from any number of mms.
+ */
+void flush_tlb_cpumask(const struct cpumask *mask)
+{
+	on_each_cpu_mask(ipi_flush_tlb_all, NULL, 1, *mask);
+}
@@ -0,0 +1,129 @@
+/*
+ *  linux/arch/arm/kernel/topology.c
+ *
+ *  CPU topology of ARM SMP systems, as described by the multiprocessor
+ *  affinity register (MPIDR) of each CPU.  It is used to build the
+ *  multi-core sched_domains, and is exported to userspace through
+ *  /sys/devices/system/cpu/cpuN/topology.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/cpumask.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+
+#include <asm/cputype.h>
+#include <asm/topology.h>
+
+/*
+ * ARMv7 CPUs with the multiprocessing extensions have bit 31 of the
+ * MPIDR set, and bit 30 set too if they are alone in their cluster.
+ * ARM11 MPCore leaves both clear but uses the same layout for the
+ * affinity fields: the CPU number in the cluster in [7:0] and the
+ * cluster number in [15:8].  With the MT bit set, the lowest affinity
+ * level numbers hardware threads instead, and everything moves up one
+ * level.
+ */
+#define MPIDR_SMP_BITMASK	(0x3 << 30)
+#define MPIDR_MT_BITMASK	(0x1 << 24)
+
+#define MPIDR_LEVEL0_SHIFT	0
+#define MPIDR_LEVEL1_SHIFT	8
+#define MPIDR_LEVEL2_SHIFT	16
+#define MPIDR_LEVEL_MASK	0xff
+
+struct cputopo_arm cpu_topology[NR_CPUS];
+
+const struct cpumask *cpu_coregroup_mask(int cpu)
+{
+	return &cpu_topology[cpu].core_sibling;
+}
+
+static int __cpuinit mpidr_is_uniprocessor(unsigned int mpidr)
+{
+	return (mpidr & MPIDR_SMP_BITMASK) == MPIDR_SMP_BITMASK;
+}
+
+/*
+ * store_cpu_topology is called on each CPU as it comes up, either at
+ * boot when only that CPU runs, or under the cpu hotplug lock, so the
+ * updates of cpu_topology can't race.
+ */
+void __cpuinit store_cpu_topology(unsigned int cpuid)
+{
+	struct cputopo_arm *cpuid_topo = &cpu_topology[cpuid];
+	unsigned int mpidr;
+	unsigned int cpu;
+
+	/* a CPU coming back online keeps its place */
+	if (cpuid_topo->core_id != -1)
+		return;
+
+	mpidr = read_cpuid_mpidr();
+
+	if (mpidr_is_uniprocessor(mpidr)) {
+		cpuid_topo->thread_id = -1;
+		cpuid_topo->core_id = 0;
+		cpuid_topo->socket_id = -1;
+	} else if (mpidr & MPIDR_MT_BITMASK) {
+		cpuid_topo->thread_id = (mpidr >> MPIDR_LEVEL0_SHIFT)
+			& MPIDR_LEVEL_MASK;
+		cpuid_topo->core_id = (mpidr >> MPIDR_LEVEL1_SHIFT)
+			& MPIDR_LEVEL_MASK;
+		cpuid_topo->socket_id = (mpidr >> MPIDR_LEVEL2_SHIFT)
+			& MPIDR_LEVEL_MASK;
+	} else {
+		cpuid_topo->thread_id = -1;
+		cpuid_topo->core_id = (mpidr >> MPIDR_LEVEL0_SHIFT)
+			& MPIDR_LEVEL_MASK;
+		cpuid_topo->socket_id = (mpidr >> MPIDR_LEVEL1_SHIFT)
+			& MPIDR_LEVEL_MASK;
+	}
+
+	/* update the sibling masks of this and the already known CPUs */
+	for_each_possible_cpu(cpu) {
+		struct cputopo_arm *cpu_topo = &cpu_topology[cpu];
+
+		if (cpu != cpuid && cpu_topo->core_id == -1)
+			continue;
+		if (cpuid_topo->socket_id != cpu_topo->socket_id)
+			continue;
+
+		cpu_set(cpuid, cpu_topo->core_sibling);
+		cpu_set(cpu, cpuid_topo->core_sibling);
+
+		if (cpuid_topo->core_id != cpu_topo->core_id)
+			continue;
+
+		cpu_set(cpuid, cpu_topo->thread_sibling);
+		cpu_set(cpu, cpuid_topo->thread_sibling);
+	}
+	smp_wmb();
+
+	printk(KERN_INFO "CPU%u: thread %d, core %d, cluster %d, "
+	       "mpidr 0x%08x\n", cpuid, cpuid_topo->thread_id,
+	       cpuid_topo->core_id, cpuid_topo->socket_id, mpidr);
+}
+
+/*
+ * init_cpu_topology is called at boot when only one CPU is running,
+ * before any CPU stored its topology.
+ */
+void __init init_cpu_topology(void)
+{
+	unsigned int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct cputopo_arm *cpu_topo = &cpu_topology[cpu];
+
+		cpu_topo->thread_id = -1;
+		cpu_topo->core_id = -1;
+		cpu_topo->socket_id = -1;
+		cpus_clear(cpu_topo->core_sibling);
+		cpus_clear(cpu_topo->thread_sibling);
+	}
+	smp_wmb();
+}
@@ -14,7 +14,9 @@
 #include <linux/signal.h>
 #include <linux/sched.h>
 #include <linux/init.h>
+#include <linux/hardirq.h>
 
+#include <asm/neon.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
 
@@ -377,6 +379,57 @@ static void vfp_pm_init(void)
 static inline void vfp_pm_init(void) { }
 #endif /* CONFIG_PM */
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+/*
+ * Kernel-side NEON support functions
+ */
+void kernel_neon_begin(void)
+{
+	union vfp_state *vfp;
+	unsigned int cpu;
+	u32 fpexc;
+
+	/*
+	 * Kernel mode NEON is only allowed outside of interrupt context
+	 * with preemption disabled.  This will make sure that the kernel
+	 * mode NEON register contents never need to be preserved.
+	 */
+	BUG_ON(in_interrupt());
+	cpu = get_cpu();
+
+	fpexc = fmrx(FPEXC) | FPEXC_EN;
+	fmxr(FPEXC, fpexc);
+
+	/*
+	 * Save the state of the owner of the VFP registers if they hold
+	 * it, and make it reload them on its next use.  On SMP the
+	 * registers were saved at context switch and the owner may have
+	 * moved on to another cpu since, so only current's live state is
+	 * saved; on UP the owner need not be current.
+	 */
+	vfp = last_VFP_context[cpu];
+#ifdef CONFIG_SMP
+	if (vfp == &current_thread_info()->vfpstate && vfp->hard.cpu == cpu)
+		vfp_save_state(vfp, fpexc);
+#else
+	if (vfp)
+		vfp_save_state(vfp, fpexc);
+#endif
+	last_VFP_context[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* Disable the NEON/VFP unit. */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
 #include <linux/smp.h>
 
 /*
@@ -440,4 +493,8 @@ static int __init vfp_init(void)
 	return 0;
 }
 
-late_initcall(vfp_init);
+/*
+ * Early, so that HWCAP_NEON is known by the time the xor and RAID-6
+ * routines are benchmarked.
+ */
+core_initcall(vfp_init);
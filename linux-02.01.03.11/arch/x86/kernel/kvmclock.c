@@ -120,8 +120,10 @@ static int kvm_register_clock(char *txt)
 {
 	int cpu = smp_processor_id();
 	int low, high;
-	low = (int)__pa(&per_cpu(hv_clock, cpu)) | 1;
-	high = ((u64)__pa(&per_cpu(hv_clock, cpu)) >> 32);
+	u64 pa = per_cpu_ptr_to_phys(&per_cpu(hv_clock, cpu));
+
+	low = (int)pa | 1;
+	high = pa >> 32;
 	printk(KERN_INFO "kvm-clock: cpu %d, msr %x:%x, %s\n",
 	       cpu, high, low, txt);
 	return native_write_msr_safe(MSR_KVM_SYSTEM_TIME, low, high);
@@ -3,16 +3,18 @@
 #include <linux/init.h>
 #include <linux/bootmem.h>
 #include <linux/percpu.h>
+#include <linux/pfn.h>
 #include <linux/kexec.h>
 #include <linux/crash_dump.h>
 #include <linux/smp.h>
 #include <linux/topology.h>
+#include <linux/vmalloc.h>
 #include <asm/sections.h>
 #include <asm/processor.h>
 #include <asm/setup.h>
 #include <asm/mpspec.h>
 #include <asm/apicdef.h>
-#include <asm/highmem.h>
+#include <asm/pgalloc.h>
 
 #ifdef CONFIG_X86_LOCAL_APIC
 unsigned int num_processors;
@@ -152,55 +154,118 @@ static inline void setup_cpu_local_masks(void)
 
 #endif /* CONFIG_X86_32 */
 
+#ifdef X86_64_NUMA
+static void * __init pcpu_alloc_unit(int cpu, size_t unit_size)
+{
+	int node = early_cpu_to_node(cpu);
+
+	if (!node_online(node) || !NODE_DATA(node)) {
+		pr_info("cpu %d has no node %d or node-local memory\n",
+			cpu, node);
+		return __alloc_bootmem(unit_size, PAGE_SIZE,
+				       __pa(MAX_DMA_ADDRESS));
+	}
+	return __alloc_bootmem_node(NODE_DATA(node), unit_size, PAGE_SIZE,
+				    __pa(MAX_DMA_ADDRESS));
+}
+
+/* vmalloc space has no page tables yet, take them from bootmem */
+static void __init pcpu_map_page(unsigned long addr, void *ptr)
+{
+	pgd_t *pgd = pgd_offset_k(addr);
+
+	if (pgd_none(*pgd))
+		pgd_populate(&init_mm, pgd, alloc_bootmem_pages(PAGE_SIZE));
+	set_pte_vaddr_pud((pud_t *)pgd_page_vaddr(*pgd), addr,
+			  pfn_pte(__pa(ptr) >> PAGE_SHIFT, PAGE_KERNEL));
+}
+
+/*
+ * With more than one node, allocate every unit on the node of its cpu
+ * and map the units back to back in vmalloc space, so that they still
+ * form a single chunk.  Returns the base of the chunk, or NULL if the
+ * units may as well come from one allocation.
+ */
+static char * __init pcpu_remap_units(size_t unit_size)
+{
+	static struct vm_struct vm;
+	unsigned long addr;
+	size_t off;
+	int cpu;
+
+	if (num_online_nodes() <= 1)
+		return NULL;
+
+	vm.flags = VM_ALLOC;
+	vm.size = nr_cpu_ids * unit_size;
+	vm_area_register_early(&vm, PAGE_SIZE);
+
+	for_each_possible_cpu(cpu) {
+		char *ptr = pcpu_alloc_unit(cpu, unit_size);
+
+		addr = (unsigned long)vm.addr + cpu * unit_size;
+		for (off = 0; off < unit_size; off += PAGE_SIZE)
+			pcpu_map_page(addr + off, ptr + off);
+		pr_debug("per cpu data for cpu%d on node%d at %016lx\n",
+			 cpu, early_cpu_to_node(cpu), __pa(ptr));
+	}
+	return vm.addr;
+}
+#else
+static inline char *pcpu_remap_units(size_t unit_size)
+{
+	return NULL;
+}
+#endif
+
 /*
  * Great future plan:
  * Declare PDA itself and support (irqstack,tss,pgd) as per cpu data.
  * Always point %gs to its beginning
+ *
+ * The per cpu areas form the first chunk of the dynamic percpu
+ * allocator (mm/percpu.c): one unit per cpu, all of the same size and
+ * contiguous, so that the offset between two cpus' copies is the same
+ * for static and dynamic per cpu data.  Each unit holds the static
+ * section, the module reserve and PERCPU_DYNAMIC_RESERVE bytes for
+ * early dynamic allocations.  On NUMA the units are node local and
+ * remapped to be contiguous, see pcpu_remap_units().
  */
 void __init setup_per_cpu_areas(void)
 {
-	ssize_t size, old_size;
-	char *ptr;
+	size_t static_size, reserved_size, unit_size;
+	char *base, *ptr;
 	int cpu;
-	unsigned long align = 1;
 
 	/* Setup cpu_pda map */
 	setup_cpu_pda_map();
 
 	/* Copy section for each CPU (we discard the original) */
-	old_size = PERCPU_ENOUGH_ROOM;
-	align = max_t(unsigned long, PAGE_SIZE, align);
-	size = roundup(old_size, align);
+	static_size = __per_cpu_end - __per_cpu_start;
+	reserved_size = PERCPU_ENOUGH_ROOM - static_size;
+	unit_size = PFN_ALIGN(PERCPU_ENOUGH_ROOM + PERCPU_DYNAMIC_RESERVE);
 
 	pr_info("NR_CPUS:%d nr_cpumask_bits:%d nr_cpu_ids:%d nr_node_ids:%d\n",
 		NR_CPUS, nr_cpumask_bits, nr_cpu_ids, nr_node_ids);
 
-	pr_info("PERCPU: Allocating %zd bytes of per cpu data\n", size);
+	pr_info("PERCPU: Allocating %zd bytes of per cpu data\n",
+		nr_cpu_ids * unit_size);
+
+	base = pcpu_remap_units(unit_size);
+	if (!base) {
+		base = __alloc_bootmem(nr_cpu_ids * unit_size, PAGE_SIZE,
+				       __pa(MAX_DMA_ADDRESS));
+		pr_debug("per cpu data at %016lx\n", __pa(base));
+	}
 
 	for_each_possible_cpu(cpu) {
-#ifndef CONFIG_NEED_MULTIPLE_NODES
-		ptr = __alloc_bootmem(size, align,
-				 __pa(MAX_DMA_ADDRESS));
-#else
-		int node = early_cpu_to_node(cpu);
-		if (!node_online(node) || !NODE_DATA(node)) {
-			ptr = __alloc_bootmem(size, align,
-					 __pa(MAX_DMA_ADDRESS));
-			pr_info("cpu %d has no node %d or node-local memory\n",
-				cpu, node);
-			pr_debug("per cpu data for cpu%d at %016lx\n",
-				 cpu, __pa(ptr));
-		} else {
-			ptr = __alloc_bootmem_node(NODE_DATA(node), size, align,
-							__pa(MAX_DMA_ADDRESS));
-			pr_debug("per cpu data for cpu%d on node%d at %016lx\n",
-				cpu, node, __pa(ptr));
-		}
-#endif
+		ptr = base + cpu * unit_size;
 		per_cpu_offset(cpu) = ptr - __per_cpu_start;
-		memcpy(ptr, __per_cpu_start, __per_cpu_end - __per_cpu_start);
+		memcpy(ptr, __per_cpu_start, static_size);
 	}
 
+	pcpu_setup_first_chunk(base, static_size, reserved_size, unit_size);
+
 	/* Setup percpu data maps */
 	setup_per_cpu_maps();
 
@@ -148,7 +148,11 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 		pmd_t pmd = *pmdp;
 
 		next = pmd_addr_end(addr, end);
-		if (pmd_none(pmd))
+		/*
+		 * A transparent huge pmd must be split before its subpages
+		 * get their own references: leave that to the slow path.
+		 */
+		if (pmd_none(pmd) || pmd_trans_huge(pmd))
 			return 0;
 		if (unlikely(pmd_large(pmd))) {
 			if (!gup_huge_pmd(pmd, addr, next, write, pages, nr))
@@ -408,6 +408,8 @@ void blk_sync_queue(struct request_queue *q)
 	del_timer_sync(&q->unplug_timer);
 	del_timer_sync(&q->timeout);
 	cancel_work_sync(&q->unplug_work);
+	if (q->mq_ops)
+		blk_mq_sync_queue(q);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -889,6 +891,9 @@ struct request *blk_get_request(struct request_queue *q, int rw, gfp_t gfp_mask)
 
 	BUG_ON(rw != READ && rw != WRITE);
 
+	if (q->mq_ops)
+		return blk_mq_alloc_request(q, rw, gfp_mask);
+
 	spin_lock_irq(q->queue_lock);
 	if (gfp_mask & __GFP_WAIT) {
 		rq = get_request_wait(q, rw, NULL);
@@ -1064,6 +1069,11 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 	if (unlikely(--req->ref_count))
 		return;
 
+	if (q->mq_ops) {
+		blk_mq_free_request(req);
+		return;
+	}
+
 	elv_completed_request(q, req);
 
 	/*
@@ -1135,16 +1145,115 @@ void init_request_from_bio(struct request *req, struct bio *bio)
 	blk_rq_bio_prep(req->q, req, bio);
 }
 
+static bool bio_attempt_back_merge(struct request_queue *q,
+				   struct request *req, struct bio *bio)
+{
+	if (!ll_back_merge_fn(q, req, bio))
+		return false;
+
+	trace_block_bio_backmerge(q, bio);
+
+	req->biotail->bi_next = bio;
+	req->biotail = bio;
+	req->nr_sectors = req->hard_nr_sectors += bio_sectors(bio);
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	if (!blk_rq_cpu_valid(req))
+		req->cpu = bio->bi_comp_cpu;
+	drive_stat_acct(req, 0);
+	return true;
+}
+
+static bool bio_attempt_front_merge(struct request_queue *q,
+				    struct request *req, struct bio *bio)
+{
+	if (!ll_front_merge_fn(q, req, bio))
+		return false;
+
+	trace_block_bio_frontmerge(q, bio);
+
+	bio->bi_next = req->bio;
+	req->bio = bio;
+
+	/*
+	 * may not be valid. if the low level driver said
+	 * it didn't need a bounce buffer then it better
+	 * not touch req->buffer either...
+	 */
+	req->buffer = bio_data(bio);
+	req->current_nr_sectors = bio_cur_sectors(bio);
+	req->hard_cur_sectors = req->current_nr_sectors;
+	req->sector = req->hard_sector = bio->bi_sector;
+	req->nr_sectors = req->hard_nr_sectors += bio_sectors(bio);
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	if (!blk_rq_cpu_valid(req))
+		req->cpu = bio->bi_comp_cpu;
+	drive_stat_acct(req, 0);
+	return true;
+}
+
+/*
+ * Try to merge @bio into one of the requests held in @plug.  Those are
+ * private to the task, so this needs no queue lock.
+ */
+static bool attempt_plug_merge(struct blk_plug *plug, struct request_queue *q,
+			       struct bio *bio)
+{
+	struct request *rq;
+
+	list_for_each_entry_reverse(rq, &plug->list, queuelist) {
+		if (rq->q != q || !elv_rq_merge_ok(rq, bio))
+			continue;
+
+		if (rq->sector + rq->nr_sectors == bio->bi_sector) {
+			if (bio_attempt_back_merge(q, rq, bio))
+				return true;
+		} else if (bio->bi_sector + bio_sectors(bio) == rq->sector) {
+			if (bio_attempt_front_merge(q, rq, bio))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Add @rq to @plug, keeping the requests of each queue together and in
+ * sector order, so that the flush takes each queue lock once and hands
+ * the elevator sorted requests.  I/O mostly comes in ascending order, so
+ * walking back from the tail usually stops at once.
+ */
+static void plug_list_add(struct blk_plug *plug, struct request *rq)
+{
+	struct list_head *where = plug->list.prev;
+	struct request *pos;
+	bool found = false;
+
+	list_for_each_entry_reverse(pos, &plug->list, queuelist) {
+		if (pos->q != rq->q) {
+			if (found)
+				break;
+			continue;
+		}
+		if (pos->sector <= rq->sector) {
+			where = &pos->queuelist;
+			found = true;
+			break;
+		}
+		where = pos->queuelist.prev;
+		found = true;
+	}
+
+	list_add(&rq->queuelist, where);
+}
+
 static int __make_request(struct request_queue *q, struct bio *bio)
 {
 	struct request *req;
-	int el_ret, nr_sectors;
-	const unsigned short prio = bio_prio(bio);
+	struct blk_plug *plug;
+	int el_ret;
 	const int sync = bio_sync(bio);
 	int rw_flags;
 
-	nr_sectors = bio_sectors(bio);
-
 	/*
 	 * low level driver can indicate that it wants pages above a
 	 * certain limit bounced to low memory (ie for highmem, or even
@@ -1152,6 +1261,19 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	 */
 	blk_queue_bounce(q, &bio);
 
+	/*
+	 * A barrier must not overtake what the task holds plugged, and goes
+	 * to the queue directly.  Other bios are first tried against the
+	 * plugged requests, which needs no queue lock.
+	 */
+	plug = current->plug;
+	if (unlikely(bio_barrier(bio))) {
+		if (plug)
+			blk_flush_plug_list(plug, false);
+		plug = NULL;
+	} else if (plug && attempt_plug_merge(plug, q, bio))
+		return 0;
+
 	spin_lock_irq(q->queue_lock);
 
 	if (unlikely(bio_barrier(bio)) || elv_queue_empty(q))
@@ -1162,18 +1284,8 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	case ELEVATOR_BACK_MERGE:
 		BUG_ON(!rq_mergeable(req));
 
-		if (!ll_back_merge_fn(q, req, bio))
+		if (!bio_attempt_back_merge(q, req, bio))
 			break;
-
-		trace_block_bio_backmerge(q, bio);
-
-		req->biotail->bi_next = bio;
-		req->biotail = bio;
-		req->nr_sectors = req->hard_nr_sectors += nr_sectors;
-		req->ioprio = ioprio_best(req->ioprio, prio);
-		if (!blk_rq_cpu_valid(req))
-			req->cpu = bio->bi_comp_cpu;
-		drive_stat_acct(req, 0);
 		if (!attempt_back_merge(q, req))
 			elv_merged_request(q, req, el_ret);
 		goto out;
@@ -1181,28 +1293,8 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	case ELEVATOR_FRONT_MERGE:
 		BUG_ON(!rq_mergeable(req));
 
-		if (!ll_front_merge_fn(q, req, bio))
+		if (!bio_attempt_front_merge(q, req, bio))
 			break;
-
-		trace_block_bio_frontmerge(q, bio);
-
-		bio->bi_next = req->bio;
-		req->bio = bio;
-
-		/*
-		 * may not be valid. if the low level driver said
-		 * it didn't need a bounce buffer then it better
-		 * not touch req->buffer either...
-		 */
-		req->buffer = bio_data(bio);
-		req->current_nr_sectors = bio_cur_sectors(bio);
-		req->hard_cur_sectors = req->current_nr_sectors;
-		req->sector = req->hard_sector = bio->bi_sector;
-		req->nr_sectors = req->hard_nr_sectors += nr_sectors;
-		req->ioprio = ioprio_best(req->ioprio, prio);
-		if (!blk_rq_cpu_valid(req))
-			req->cpu = bio->bi_comp_cpu;
-		drive_stat_acct(req, 0);
 		if (!attempt_front_merge(q, req))
 			elv_merged_request(q, req, el_ret);
 		goto out;
@@ -1236,6 +1328,15 @@ get_rq:
 	 */
 	init_request_from_bio(req, bio);
 
+	if (plug) {
+		/* the queue sees it when the plug is flushed */
+		if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+		    bio_flagged(bio, BIO_CPU_AFFINE))
+			req->cpu = blk_cpu_to_group(raw_smp_processor_id());
+		plug_list_add(plug, req);
+		return 0;
+	}
+
 	spin_lock_irq(q->queue_lock);
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
 	    bio_flagged(bio, BIO_CPU_AFFINE))
@@ -2124,9 +2225,100 @@ int kblockd_schedule_work(struct request_queue *q, struct work_struct *work)
 }
 EXPORT_SYMBOL(kblockd_schedule_work);
 
+/**
+ * blk_start_plug - hold back the I/O the current task submits
+ * @plug:	the plug, usually on the caller's stack
+ *
+ * Description:
+ *    Until the matching blk_finish_plug(), requests the task builds are
+ *    kept on @plug instead of being queued, and later bios are merged into
+ *    them without taking the queue lock.  They are all queued at once when
+ *    the plug is finished, or before the task sleeps.  Plugs nest: only the
+ *    outermost one collects requests.
+ */
+void blk_start_plug(struct blk_plug *plug)
+{
+	struct task_struct *tsk = current;
+
+	INIT_LIST_HEAD(&plug->list);
+	if (!tsk->plug)
+		tsk->plug = plug;
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/*
+ * Run a queue the plug flush added to, and drop its lock.  From
+ * schedule(), the driver is kept out of it and kblockd unplugs instead.
+ * The task may be about to sleep on the I/O it just queued, so kblockd
+ * is kicked whatever the queue's state: the queue is plugged first, as
+ * the flush doesn't plug nonrot queues and the unplug work only runs
+ * plugged ones.
+ */
+static void queue_unplugged(struct request_queue *q, bool from_schedule)
+	__releases(q->queue_lock)
+{
+	if (!from_schedule) {
+		__generic_unplug_device(q);
+	} else {
+		blk_plug_device(q);
+		kblockd_schedule_work(q, &q->unplug_work);
+	}
+	spin_unlock(q->queue_lock);
+}
+
+/*
+ * Queue the requests held in @plug.  They are grouped by queue, so each
+ * queue lock is taken once.
+ */
+void blk_flush_plug_list(struct blk_plug *plug, bool from_schedule)
+{
+	struct request_queue *q = NULL;
+	struct request *rq;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	if (list_empty(&plug->list))
+		return;
+
+	list_splice_init(&plug->list, &list);
+
+	local_irq_save(flags);
+	while (!list_empty(&list)) {
+		rq = list_entry_rq(list.next);
+		list_del_init(&rq->queuelist);
+
+		if (rq->q != q) {
+			if (q)
+				queue_unplugged(q, from_schedule);
+			q = rq->q;
+			spin_lock(q->queue_lock);
+		}
+
+		if (!blk_queue_nonrot(q) && elv_queue_empty(q))
+			blk_plug_device(q);
+		add_request(q, rq);
+	}
+	queue_unplugged(q, from_schedule);
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(blk_flush_plug_list);
+
+/**
+ * blk_finish_plug - queue the I/O held back since blk_start_plug()
+ * @plug:	the plug passed to blk_start_plug()
+ */
+void blk_finish_plug(struct blk_plug *plug)
+{
+	blk_flush_plug_list(plug, false);
+
+	if (plug == current->plug)
+		current->plug = NULL;
+}
+EXPORT_SYMBOL(blk_finish_plug);
+
 int __init blk_dev_init(void)
 {
-	kblockd_workqueue = create_workqueue("kblockd");
+	kblockd_workqueue = create_reclaim_workqueue("kblockd");
 	if (!kblockd_workqueue)
 		panic("Failed to create kblockd\n");
 
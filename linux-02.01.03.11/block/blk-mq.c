@@ -0,0 +1,659 @@
+/*
+ * Multiqueue block IO queueing
+ *
+ * The request_fn model funnels every bio through __make_request(),
+ * which merges, inserts into the elevator and dispatches under the
+ * single q->queue_lock.  Drivers for fast devices, which have no use
+ * for an I/O scheduler and may be able to take requests on several
+ * hardware queues at once, can register with blk_mq_init_queue()
+ * instead:
+ *
+ *  - every cpu has a software staging queue (struct blk_mq_ctx), where
+ *    requests submitted on that cpu are inserted, and merged if the
+ *    driver asks for it, under a lock other cpus take only to dispatch;
+ *
+ *  - the staging queues are mapped onto the driver's hardware dispatch
+ *    contexts (struct blk_mq_hw_ctx), cpu N onto context N % nr_hw_queues.
+ *    Running a hardware context moves the requests of its staging
+ *    queues to the driver's ->queue_rq(), serialized per context only;
+ *
+ *  - requests are preallocated per hardware context, each followed by
+ *    cmd_size bytes for the driver (blk_mq_rq_to_pdu()), and handed out
+ *    with a tag bitmap instead of the request_list mempool.
+ *
+ * There is no elevator and no plugging: the submitting cpu runs the
+ * hardware context right after staging its request, so a staging queue
+ * only fills up while another cpu is dispatching.  Only back merges with
+ * the last staged request are tried, there is no request timeout
+ * handling, and the disk statistics leave out the in-flight count,
+ * which is protected by the queue lock.
+ *
+ * Passthrough requests from blk_get_request() and blk_execute_rq() work
+ * on multiqueue queues too; requests must be completed in one go, with
+ * blk_mq_end_io().
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/writeback.h>
+#include <linux/bitops.h>
+#include <trace/block.h>
+
+#include "blk.h"
+
+/*
+ * Requests staged on the context's cpus, or bounced by the driver: a
+ * restart racing with the last dispatch leaves the latter to the owner.
+ */
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return !list_empty_careful(&hctx->dispatch) ||
+		find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx;
+}
+
+static int blk_mq_get_tag(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int tag;
+
+	do {
+		tag = find_first_zero_bit(hctx->tag_map, hctx->queue_depth);
+		if (tag >= hctx->queue_depth)
+			return -1;
+	} while (test_and_set_bit_lock(tag, hctx->tag_map));
+
+	return tag;
+}
+
+/*
+ * Allocate a request from the hardware context of the current cpu,
+ * waiting for one to be freed if @gfp_mask allows it.  The request is
+ * tied to the staging queue of the cpu it was allocated on.
+ */
+static struct request *__blk_mq_alloc_request(struct request_queue *q,
+					      int rw_flags, gfp_t gfp_mask)
+{
+	struct blk_mq_ctx *ctx;
+	struct blk_mq_hw_ctx *hctx;
+	struct request *rq;
+	DEFINE_WAIT(wait);
+	int tag;
+
+	for (;;) {
+		ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+		hctx = ctx->hctx;
+		tag = blk_mq_get_tag(hctx);
+		put_cpu();
+		if (tag >= 0)
+			break;
+
+		if (!(gfp_mask & __GFP_WAIT))
+			return NULL;
+
+		prepare_to_wait(&hctx->wait, &wait, TASK_UNINTERRUPTIBLE);
+		/* one may have been freed before we got on the waitqueue */
+		tag = blk_mq_get_tag(hctx);
+		if (tag < 0)
+			io_schedule();
+		finish_wait(&hctx->wait, &wait);
+		if (tag >= 0)
+			break;
+	}
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	return rq;
+}
+
+/* for blk_get_request() */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp_mask)
+{
+	return __blk_mq_alloc_request(q, rw, gfp_mask);
+}
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_ctx->hctx;
+
+	clear_bit_unlock(rq->tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&hctx->wait))
+		wake_up(&hctx->wait);
+}
+
+static void blk_mq_bio_endio(struct request *rq, struct bio *bio, int error)
+{
+	unsigned int nbytes = bio->bi_size;
+
+	if (error)
+		clear_bit(BIO_UPTODATE, &bio->bi_flags);
+	else if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		error = -EIO;
+
+	if (unlikely(rq->cmd_flags & REQ_QUIET))
+		set_bit(BIO_QUIET, &bio->bi_flags);
+
+	bio->bi_size = 0;
+	bio->bi_sector += (nbytes >> 9);
+
+	if (bio_integrity(bio))
+		bio_integrity_advance(bio, nbytes);
+
+	bio_endio(bio, error);
+}
+
+static void blk_mq_account_done(struct request *rq, unsigned int bytes)
+{
+	if (blk_fs_request(rq) && rq->rq_disk) {
+		unsigned long duration = jiffies - rq->start_time;
+		const int rw = rq_data_dir(rq);
+		struct hd_struct *part;
+		int cpu;
+
+		cpu = part_stat_lock();
+		part = disk_map_sector_rcu(rq->rq_disk, rq->sector);
+
+		part_stat_add(cpu, part, sectors[rw], bytes >> 9);
+		part_stat_inc(cpu, part, ios[rw]);
+		part_stat_add(cpu, part, ticks[rw], duration);
+
+		part_stat_unlock();
+	}
+}
+
+/**
+ * blk_mq_end_io - complete a request of a multiqueue queue
+ * @rq:		the request, as passed to ->queue_rq()
+ * @error:	0 for success, < 0 for error
+ *
+ * Description:
+ *    Ends all the bios of @rq and frees it, or hands it to its end_io
+ *    callback.  Partial completion is not supported.  Can be called
+ *    from any context, and needs no lock.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	struct bio *bio = rq->bio;
+	unsigned int bytes = 0;
+
+	trace_block_rq_complete(rq->q, rq);
+
+	if (error && blk_fs_request(rq) && !(rq->cmd_flags & REQ_QUIET)) {
+		printk(KERN_ERR "end_request: I/O error, dev %s, sector %llu\n",
+				rq->rq_disk ? rq->rq_disk->disk_name : "?",
+				(unsigned long long)rq->sector);
+	}
+
+	while (bio) {
+		struct bio *next = bio->bi_next;
+
+		bio->bi_next = NULL;
+		bytes += bio->bi_size;
+		blk_mq_bio_endio(rq, bio, error);
+		bio = next;
+	}
+
+	if (unlikely(laptop_mode) && blk_fs_request(rq))
+		laptop_io_completion();
+
+	blk_mq_account_done(rq, bytes);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+/*
+ * Run a hardware context: hand the requests bounced by the driver last
+ * time, then those of all the staging queues mapped here, to the driver.
+ *
+ * Only one task dispatches on a context at a time, the one owning its
+ * RUNNING bit.  A task finding the context busy leaves its request to the
+ * owner, which checks the staging queues again after releasing the bit,
+ * so nothing is left behind and nobody ever waits for the bit.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit;
+
+again:
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+	if (test_and_set_bit_lock(BLK_MQ_S_RUNNING, &hctx->state))
+		return;
+
+	list_splice_init(&hctx->dispatch, &rq_list);
+
+	for_each_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		struct blk_mq_ctx *ctx = hctx->ctxs[bit];
+		unsigned long flags;
+
+		clear_bit(bit, hctx->ctx_map);
+		spin_lock_irqsave(&ctx->lock, flags);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock_irqrestore(&ctx->lock, flags);
+	}
+
+	while (!list_empty(&rq_list)) {
+		int ret;
+
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		trace_block_rq_issue(q, rq);
+		ret = q->mq_ops->queue_rq(hctx, rq, list_empty(&rq_list));
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			trace_block_rq_requeue(q, rq);
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+		if (ret != BLK_MQ_RQ_QUEUE_ERROR)
+			printk(KERN_ERR "blk-mq: bad return on queue: %d\n",
+			       ret);
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	/* the driver is busy: keep the rest, in order, for the next run */
+	list_splice(&rq_list, &hctx->dispatch);
+	clear_bit_unlock(BLK_MQ_S_RUNNING, &hctx->state);
+
+	/*
+	 * Pairs with the barrier in blk_mq_insert_request_ctx(), and with
+	 * blk_mq_start_stopped_hw_queues(): a restart which found the
+	 * context running left it to us, so retry the bounced requests
+	 * too, unless the driver has stopped the context again.
+	 */
+	smp_mb();
+	if (blk_mq_hctx_has_pending(hctx)) {
+		INIT_LIST_HEAD(&rq_list);
+		goto again;
+	}
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the staged requests of a hardware context
+ * @hctx:	the hardware context
+ * @async:	leave the work to kblockd instead of doing it here
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (async)
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		blk_mq_run_hw_queue(q->queue_hw_ctx[i], async);
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching on a hardware context
+ * @hctx:	the hardware context
+ *
+ * Description:
+ *    For ->queue_rq() to call before returning BLK_MQ_RQ_QUEUE_BUSY.
+ *    Dispatch resumes with blk_mq_start_stopped_hw_queues().
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart the stopped hardware contexts
+ * @q:		the queue
+ *
+ * Description:
+ *    Typically called from the completion interrupt; the hardware
+ *    contexts restarted are run from kblockd.
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		struct blk_mq_hw_ctx *hctx = q->queue_hw_ctx[i];
+
+		if (test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_insert_request_ctx(struct blk_mq_ctx *ctx,
+				      struct request *rq, bool at_head)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->lock, flags);
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock_irqrestore(&ctx->lock, flags);
+
+	set_bit(ctx->index_hw, ctx->hctx->ctx_map);
+	/* pairs with the barrier in __blk_mq_run_hw_queue() */
+	smp_mb();
+}
+
+/* for blk_execute_rq_nowait() */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+
+	blk_mq_insert_request_ctx(ctx, rq, at_head);
+	if (run_queue)
+		blk_mq_run_hw_queue(ctx->hctx, false);
+}
+
+/*
+ * The checks of elv_rq_merge_ok(), which can't be used without an
+ * elevator.
+ */
+static bool blk_mq_bio_mergeable(struct request *rq, struct bio *bio)
+{
+	if (!rq_mergeable(rq))
+		return false;
+	if (bio_discard(bio) != bio_discard(rq->bio))
+		return false;
+	if (bio_data_dir(bio) != rq_data_dir(rq))
+		return false;
+	if (rq->rq_disk != bio->bi_bdev->bd_disk || rq->special)
+		return false;
+	if (bio_integrity(bio) != blk_integrity_rq(rq))
+		return false;
+
+	return rq->sector + rq->nr_sectors == bio->bi_sector;
+}
+
+/*
+ * Try to append @bio to the last request staged on this cpu.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q, struct bio *bio)
+{
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	unsigned long flags;
+	bool merged = false;
+
+	ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+	spin_lock_irqsave(&ctx->lock, flags);
+	if (!list_empty(&ctx->rq_list)) {
+		rq = list_entry(ctx->rq_list.prev, struct request, queuelist);
+		if (blk_mq_bio_mergeable(rq, bio) &&
+		    ll_back_merge_fn(q, rq, bio)) {
+			trace_block_bio_backmerge(q, bio);
+
+			rq->biotail->bi_next = bio;
+			rq->biotail = bio;
+			rq->nr_sectors = rq->hard_nr_sectors += bio_sectors(bio);
+			rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+			merged = true;
+		}
+	}
+	spin_unlock_irqrestore(&ctx->lock, flags);
+	put_cpu();
+
+	/* rq may be gone already: account with the bio, it's in the disk */
+	if (merged) {
+		struct hd_struct *part;
+		int cpu;
+
+		cpu = part_stat_lock();
+		part = disk_map_sector_rcu(bio->bi_bdev->bd_disk,
+					   bio->bi_sector);
+		part_stat_inc(cpu, part, merges[bio_data_dir(bio)]);
+		part_stat_unlock();
+	}
+
+	return merged;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const int rw = bio_data_dir(bio);
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int rw_flags;
+
+	blk_queue_bounce(q, &bio);
+
+	/* ordering is left to the device: it has to support it */
+	if (unlikely(bio_barrier(bio)) &&
+	    q->next_ordered == QUEUE_ORDERED_NONE) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return 0;
+	}
+
+	if ((q->mq_flags & BLK_MQ_F_SHOULD_MERGE) && !bio_barrier(bio) &&
+	    blk_mq_attempt_merge(q, bio))
+		return 0;
+
+	rw_flags = rw;
+	if (bio_sync(bio))
+		rw_flags |= REQ_RW_SYNC;
+
+	trace_block_getrq(q, bio, rw);
+	rq = __blk_mq_alloc_request(q, rw_flags, GFP_NOIO);
+	init_request_from_bio(rq, bio);
+
+	ctx = rq->mq_ctx;
+	blk_mq_insert_request_ctx(ctx, rq, false);
+	blk_mq_run_hw_queue(ctx->hctx, false);
+	return 0;
+}
+
+static void blk_mq_unplug(struct request_queue *q)
+{
+	blk_mq_run_queues(q, false);
+}
+
+/* for blk_sync_queue() */
+void blk_mq_sync_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	if (!q->queue_hw_ctx)
+		return;
+
+	for (i = 0; i < q->nr_hw_queues; i++)
+		if (q->queue_hw_ctx[i])
+			cancel_work_sync(&q->queue_hw_ctx[i]->run_work);
+}
+
+static void blk_mq_free_hw_ctx(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->rqs)
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+	kfree(hctx->rqs);
+	kfree(hctx->tag_map);
+	kfree(hctx->ctx_map);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+/* for blk_release_queue(), also frees what a failed init left */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	unsigned int i;
+
+	if (q->queue_hw_ctx) {
+		for (i = 0; i < q->nr_hw_queues; i++)
+			if (q->queue_hw_ctx[i])
+				blk_mq_free_hw_ctx(q->queue_hw_ctx[i]);
+		kfree(q->queue_hw_ctx);
+	}
+	free_percpu(q->queue_ctx);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hw_ctx(struct request_queue *q,
+						 struct blk_mq_reg *reg,
+						 unsigned int index)
+{
+	size_t rq_size = sizeof(struct request) + reg->cmd_size;
+	struct blk_mq_hw_ctx *hctx;
+	int node = reg->numa_node;
+	unsigned int i;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, node);
+	if (!hctx)
+		return NULL;
+
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	init_waitqueue_head(&hctx->wait);
+	hctx->queue = q;
+	hctx->queue_num = index;
+	hctx->queue_depth = reg->queue_depth;
+	hctx->numa_node = node;
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *), GFP_KERNEL,
+				  node);
+	hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+				     sizeof(unsigned long), GFP_KERNEL, node);
+	hctx->tag_map = kzalloc_node(BITS_TO_LONGS(reg->queue_depth) *
+				     sizeof(unsigned long), GFP_KERNEL, node);
+	hctx->rqs = kzalloc_node(reg->queue_depth * sizeof(void *),
+				 GFP_KERNEL, node);
+	if (!hctx->ctxs || !hctx->ctx_map || !hctx->tag_map || !hctx->rqs)
+		goto fail;
+
+	/*
+	 * One allocation per request: drivers may DMA to their part of it,
+	 * so it has to come from the direct mapping.
+	 */
+	for (i = 0; i < reg->queue_depth; i++) {
+		hctx->rqs[i] = kzalloc_node(rq_size, GFP_KERNEL, node);
+		if (!hctx->rqs[i])
+			goto fail;
+	}
+
+	return hctx;
+
+fail:
+	blk_mq_free_hw_ctx(hctx);
+	return NULL;
+}
+
+/**
+ * blk_mq_init_queue - allocate a multiqueue request queue
+ * @reg:	the driver's queue description
+ * @driver_data: passed to ->init_hctx(), and the default hctx->driver_data
+ *
+ * Description:
+ *    Sets up @reg->nr_hw_queues hardware contexts (at most one per cpu)
+ *    of @reg->queue_depth requests each, and a staging queue per cpu.
+ *    The queue has the usual default limits, which the driver can then
+ *    change with the blk_queue_*() helpers.  Released with
+ *    blk_cleanup_queue(), like any other queue.
+ *
+ *    Returns the queue, or NULL on failure.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	unsigned int i, nr_hw_queues;
+	int cpu;
+
+	if (!reg->ops || !reg->ops->queue_rq || !reg->nr_hw_queues ||
+	    !reg->queue_depth || reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	nr_hw_queues = min_t(unsigned int, reg->nr_hw_queues, nr_cpu_ids);
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->mq_ops = reg->ops;
+	q->mq_flags = reg->flags;
+	q->nr_hw_queues = nr_hw_queues;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx)
+		goto fail;
+
+	for (i = 0; i < nr_hw_queues; i++) {
+		struct blk_mq_hw_ctx *hctx;
+
+		hctx = blk_mq_alloc_hw_ctx(q, reg, i);
+		if (!hctx)
+			goto fail;
+		hctx->driver_data = driver_data;
+		q->queue_hw_ctx[i] = hctx;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+		struct blk_mq_hw_ctx *hctx = q->queue_hw_ctx[cpu % nr_hw_queues];
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+		ctx->hctx = hctx;
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->unplug_fn = blk_mq_unplug;
+	/* only taken by blk_put_request() */
+	q->queue_lock = &q->__queue_lock;
+	q->nr_requests = nr_hw_queues * reg->queue_depth;
+
+	if (reg->ops->init_hctx) {
+		for (i = 0; i < nr_hw_queues; i++)
+			if (reg->ops->init_hctx(q->queue_hw_ctx[i],
+						driver_data, i))
+				goto fail;
+	}
+
+	return q;
+
+fail:
+	/* blk_release_queue() frees what has been set up */
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
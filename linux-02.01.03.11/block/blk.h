@@ -22,6 +22,13 @@ void blk_delete_timer(struct request *);
 void blk_add_timer(struct request *);
 void __generic_unplug_device(struct request_queue *);
 
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp_mask);
+void blk_mq_free_request(struct request *rq);
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue);
+void blk_mq_sync_queue(struct request_queue *q);
+void blk_mq_free_queue(struct request_queue *q);
+
 /*
  * Internal atomic flags for request handling
  */
@@ -0,0 +1,797 @@
+/*
+ * Compressed RAM block device for swap.
+ *
+ * Every page written to a ramzswap device is compressed with LZO and kept
+ * in memory, in an allocator that packs the compressed objects together
+ * (see struct rzs_zspage).  Pages are decompressed again on read, and
+ * their memory is given back as soon as swap frees the slot, through the
+ * swap_slot_free_notify block device operation.  On machines without a
+ * fast swap device this roughly doubles the memory available to anonymous
+ * pages, at far lower latency than swapping to flash.
+ *
+ * Parts derived from drivers/block/brd.c, copyright of its owners.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/highmem.h>
+#include <linux/gfp.h>
+#include <linux/lzo.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/swap.h>
+#include <linux/vmalloc.h>
+#include <linux/device.h>
+#include <linux/genhd.h>
+
+#include <asm/div64.h>
+
+#define SECTOR_SHIFT		9
+#define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
+
+/*
+ * Compressed objects are rounded up to a multiple of RZS_ALIGN bytes and
+ * kept in one size class per multiple.  A page that does not compress to
+ * RZS_MAX_OBJ_SIZE or less is stored as it is, in a page of its own.
+ */
+#define RZS_ALIGN_SHIFT		5
+#define RZS_ALIGN		(1 << RZS_ALIGN_SHIFT)
+#define RZS_MAX_OBJ_SIZE	(PAGE_SIZE / 4 * 3)
+#define RZS_NR_CLASSES		(RZS_MAX_OBJ_SIZE >> RZS_ALIGN_SHIFT)
+
+/* A zspage spans up to this many pages, chosen to waste the least */
+#define RZS_MAX_ZSPAGE_PAGES	4
+
+/* Free objects are chained through their first word; this ends the chain */
+#define RZS_OBJ_END		(~0U)
+
+/*
+ * A zspage is a set of pages holding objects of one size class back to
+ * back; an object may straddle two of its pages.  The free objects of a
+ * zspage are chained through their first word, which never straddles as
+ * objects are RZS_ALIGN aligned.
+ */
+struct rzs_zspage {
+	struct list_head	list;		/* in class->partial if not full */
+	unsigned int		inuse;		/* objects allocated */
+	unsigned int		freelist;	/* first free object */
+	struct page		*pages[RZS_MAX_ZSPAGE_PAGES];
+};
+
+struct rzs_size_class {
+	unsigned int		size;		/* object size */
+	unsigned int		nr_pages;	/* pages per zspage */
+	unsigned int		objs_per_zspage;
+	struct list_head	partial;	/* zspages with free objects */
+};
+
+/* Flags for struct rzs_table */
+#define RZS_ZERO		0x01	/* page was all zeroes: nothing stored */
+#define RZS_UNCOMPRESSED	0x02	/* stored as is in ->page */
+
+/* What is stored for each page sized sector of the device */
+struct rzs_table {
+	union {
+		struct rzs_zspage *zspage;
+		struct page *page;
+	};
+	unsigned short		obj;		/* index in the zspage */
+	unsigned short		size;		/* compressed size, if in a zspage */
+	unsigned char		flags;
+};
+
+struct rzs_stats {
+	u64	num_reads;
+	u64	num_writes;
+	u64	failed_reads;
+	u64	failed_writes;
+	u64	invalid_io;		/* not page aligned, or out of range */
+	u64	notify_free;		/* slots freed by swap */
+	u64	pages_zero;		/* all zero pages held */
+	u64	pages_stored;		/* compressed pages held */
+	u64	pages_expand;		/* incompressible pages held */
+	u64	compr_size;		/* bytes of compressed data held */
+	u64	pages_used;		/* pages allocated for all of it */
+};
+
+struct ramzswap {
+	int			number;
+	struct request_queue	*queue;
+	struct gendisk		*disk;
+	struct list_head	list;
+
+	/*
+	 * lock serializes writers, which share the compression buffers.
+	 * table_lock protects the table, the allocator and the stats: it is
+	 * taken under swap_lock when swap frees a slot.
+	 */
+	struct mutex		lock;
+	spinlock_t		table_lock;
+	void			*compress_workmem;
+	void			*compress_buffer;
+	void			*obj_buffer;	/* object being decompressed */
+
+	struct rzs_table	*table;
+	unsigned long		nr_pages;
+	struct rzs_size_class	classes[RZS_NR_CLASSES];
+	struct rzs_stats	stats;
+};
+
+static int rzs_major;
+static LIST_HEAD(rzs_devices);
+
+/*
+ * Allocator.
+ */
+static struct rzs_size_class *size_to_class(struct ramzswap *rzs,
+					    unsigned int size)
+{
+	return &rzs->classes[(ALIGN(size, RZS_ALIGN) >> RZS_ALIGN_SHIFT) - 1];
+}
+
+static void init_size_class(struct rzs_size_class *class, unsigned int size)
+{
+	unsigned int nr, best = 1, best_waste = PAGE_SIZE;
+
+	for (nr = 1; nr <= RZS_MAX_ZSPAGE_PAGES; nr++) {
+		unsigned int waste = ((nr << PAGE_SHIFT) % size) / nr;
+
+		if (waste < best_waste) {
+			best_waste = waste;
+			best = nr;
+		}
+	}
+
+	class->size = size;
+	class->nr_pages = best;
+	class->objs_per_zspage = (best << PAGE_SHIFT) / size;
+	INIT_LIST_HEAD(&class->partial);
+}
+
+static unsigned int *obj_first_word(struct rzs_zspage *zspage,
+				    struct rzs_size_class *class,
+				    unsigned int obj, enum km_type km)
+{
+	unsigned long off = (unsigned long)obj * class->size;
+	void *addr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT], km);
+
+	return addr + (off & ~PAGE_MASK);
+}
+
+static void put_first_word(unsigned int *word, enum km_type km)
+{
+	kunmap_atomic((void *)((unsigned long)word & PAGE_MASK), km);
+}
+
+/*
+ * Set up a new zspage with all of its objects free.  Called without
+ * table_lock, as it may sleep.
+ */
+static struct rzs_zspage *alloc_zspage(struct rzs_size_class *class)
+{
+	struct rzs_zspage *zspage;
+	unsigned int i, *word;
+
+	zspage = kzalloc(sizeof(*zspage), GFP_NOIO);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->nr_pages; i++) {
+		zspage->pages[i] = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		word = obj_first_word(zspage, class, i, KM_USER0);
+		*word = i + 1 < class->objs_per_zspage ? i + 1 : RZS_OBJ_END;
+		put_first_word(word, KM_USER0);
+	}
+	zspage->freelist = 0;
+	INIT_LIST_HEAD(&zspage->list);
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static void free_zspage(struct rzs_size_class *class,
+			struct rzs_zspage *zspage)
+{
+	unsigned int i;
+
+	for (i = 0; i < class->nr_pages; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+}
+
+/*
+ * Take a free object of class from zspage.  Called with table_lock held.
+ */
+static unsigned int zspage_get_obj(struct rzs_size_class *class,
+				   struct rzs_zspage *zspage)
+{
+	unsigned int obj = zspage->freelist, *word;
+
+	word = obj_first_word(zspage, class, obj, KM_USER0);
+	zspage->freelist = *word;
+	put_first_word(word, KM_USER0);
+
+	if (++zspage->inuse == class->objs_per_zspage)
+		list_del_init(&zspage->list);
+	return obj;
+}
+
+/*
+ * Allocate an object of size bytes; table_lock must not be held, as a
+ * new zspage may have to be allocated.
+ */
+static int rzs_obj_malloc(struct ramzswap *rzs, unsigned int size,
+			  struct rzs_zspage **zspagep, unsigned short *objp)
+{
+	struct rzs_size_class *class = size_to_class(rzs, size);
+	struct rzs_zspage *zspage;
+
+	spin_lock(&rzs->table_lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&rzs->table_lock);
+
+		zspage = alloc_zspage(class);
+		if (!zspage)
+			return -ENOMEM;
+
+		spin_lock(&rzs->table_lock);
+		list_add(&zspage->list, &class->partial);
+		rzs->stats.pages_used += class->nr_pages;
+	}
+	zspage = list_first_entry(&class->partial, struct rzs_zspage, list);
+	*objp = zspage_get_obj(class, zspage);
+	*zspagep = zspage;
+	spin_unlock(&rzs->table_lock);
+
+	return 0;
+}
+
+/*
+ * Give an object back to its zspage.  Called with table_lock held.
+ */
+static void rzs_obj_free(struct ramzswap *rzs, unsigned int size,
+			 struct rzs_zspage *zspage, unsigned int obj)
+{
+	struct rzs_size_class *class = size_to_class(rzs, size);
+	unsigned int *word;
+
+	word = obj_first_word(zspage, class, obj, KM_USER0);
+	*word = zspage->freelist;
+	put_first_word(word, KM_USER0);
+	zspage->freelist = obj;
+
+	if (zspage->inuse-- == class->objs_per_zspage)
+		list_add(&zspage->list, &class->partial);
+
+	if (!zspage->inuse) {
+		list_del(&zspage->list);
+		free_zspage(class, zspage);
+		rzs->stats.pages_used -= class->nr_pages;
+	}
+}
+
+/*
+ * Copy between a linear buffer and an object, which may straddle two
+ * pages of its zspage.
+ */
+static void rzs_copy_obj(struct rzs_size_class *class,
+			 struct rzs_zspage *zspage, unsigned int obj,
+			 void *buf, unsigned int len, int to_obj)
+{
+	unsigned long off = (unsigned long)obj * class->size;
+
+	while (len) {
+		struct page *page = zspage->pages[off >> PAGE_SHIFT];
+		unsigned int offset = off & ~PAGE_MASK;
+		unsigned int n = min_t(unsigned int, len, PAGE_SIZE - offset);
+		void *addr = kmap_atomic(page, KM_USER0);
+
+		if (to_obj)
+			memcpy(addr + offset, buf, n);
+		else
+			memcpy(buf, addr + offset, n);
+		kunmap_atomic(addr, KM_USER0);
+
+		buf += n;
+		off += n;
+		len -= n;
+	}
+}
+
+/*
+ * Table of stored pages.
+ */
+
+/* Drop whatever is stored for index.  Called with table_lock held. */
+static void rzs_free_entry(struct ramzswap *rzs, unsigned long index)
+{
+	struct rzs_table *entry = &rzs->table[index];
+
+	if (entry->flags & RZS_ZERO) {
+		rzs->stats.pages_zero--;
+	} else if (entry->flags & RZS_UNCOMPRESSED) {
+		__free_page(entry->page);
+		rzs->stats.pages_expand--;
+		rzs->stats.compr_size -= PAGE_SIZE;
+		rzs->stats.pages_used--;
+	} else if (entry->zspage) {
+		rzs_obj_free(rzs, entry->size, entry->zspage, entry->obj);
+		rzs->stats.pages_stored--;
+		rzs->stats.compr_size -= entry->size;
+	}
+
+	memset(entry, 0, sizeof(*entry));
+}
+
+static int page_zero_filled(void *ptr)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+	return 1;
+}
+
+static int rzs_read(struct ramzswap *rzs, struct page *page,
+		    unsigned long index)
+{
+	struct rzs_table *entry = &rzs->table[index];
+	size_t clen = PAGE_SIZE;
+	void *dst, *src;
+	int ret = LZO_E_OK;
+
+	spin_lock(&rzs->table_lock);
+	rzs->stats.num_reads++;
+
+	dst = kmap_atomic(page, KM_USER1);
+	if (entry->flags & RZS_UNCOMPRESSED) {
+		src = kmap_atomic(entry->page, KM_USER0);
+		memcpy(dst, src, PAGE_SIZE);
+		kunmap_atomic(src, KM_USER0);
+	} else if (!entry->zspage) {
+		/* all zeroes, or never written */
+		memset(dst, 0, PAGE_SIZE);
+	} else {
+		struct rzs_size_class *class = size_to_class(rzs, entry->size);
+
+		rzs_copy_obj(class, entry->zspage, entry->obj,
+			     rzs->obj_buffer, entry->size, 0);
+		ret = lzo1x_decompress_safe(rzs->obj_buffer, entry->size,
+					    dst, &clen);
+	}
+	kunmap_atomic(dst, KM_USER1);
+	flush_dcache_page(page);
+
+	if (unlikely(ret != LZO_E_OK || clen != PAGE_SIZE)) {
+		rzs->stats.failed_reads++;
+		spin_unlock(&rzs->table_lock);
+		printk(KERN_ERR "ramzswap%d: decompression failed for page "
+		       "%lu: %d\n", rzs->number, index, ret);
+		return -EIO;
+	}
+	spin_unlock(&rzs->table_lock);
+
+	return 0;
+}
+
+static int rzs_write(struct ramzswap *rzs, struct page *page,
+		     unsigned long index)
+{
+	struct rzs_table new;
+	size_t clen;
+	void *src;
+	int ret;
+
+	memset(&new, 0, sizeof(new));
+	mutex_lock(&rzs->lock);
+
+	src = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(src)) {
+		kunmap_atomic(src, KM_USER0);
+		new.flags = RZS_ZERO;
+		goto store;
+	}
+	ret = lzo1x_1_compress(src, PAGE_SIZE, rzs->compress_buffer, &clen,
+			       rzs->compress_workmem);
+	kunmap_atomic(src, KM_USER0);
+	if (unlikely(ret != LZO_E_OK)) {
+		printk(KERN_ERR "ramzswap%d: compression failed for page "
+		       "%lu: %d\n", rzs->number, index, ret);
+		goto fail;
+	}
+
+	if (clen > RZS_MAX_OBJ_SIZE) {
+		void *dst;
+
+		new.page = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (!new.page)
+			goto fail;
+		src = kmap_atomic(page, KM_USER0);
+		dst = kmap_atomic(new.page, KM_USER1);
+		memcpy(dst, src, PAGE_SIZE);
+		kunmap_atomic(dst, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+		new.flags = RZS_UNCOMPRESSED;
+	} else {
+		if (rzs_obj_malloc(rzs, clen, &new.zspage, &new.obj))
+			goto fail;
+		/* the object is ours alone until it is in the table */
+		rzs_copy_obj(size_to_class(rzs, clen), new.zspage, new.obj,
+			     rzs->compress_buffer, clen, 1);
+		new.size = clen;
+	}
+
+store:
+	spin_lock(&rzs->table_lock);
+	rzs_free_entry(rzs, index);
+	rzs->table[index] = new;
+	rzs->stats.num_writes++;
+	if (new.flags & RZS_ZERO) {
+		rzs->stats.pages_zero++;
+	} else if (new.flags & RZS_UNCOMPRESSED) {
+		rzs->stats.pages_expand++;
+		rzs->stats.compr_size += PAGE_SIZE;
+		rzs->stats.pages_used++;
+	} else {
+		rzs->stats.pages_stored++;
+		rzs->stats.compr_size += new.size;
+	}
+	spin_unlock(&rzs->table_lock);
+
+	mutex_unlock(&rzs->lock);
+	return 0;
+
+fail:
+	spin_lock(&rzs->table_lock);
+	rzs->stats.failed_writes++;
+	spin_unlock(&rzs->table_lock);
+	mutex_unlock(&rzs->lock);
+	return -ENOMEM;
+}
+
+static int rzs_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct ramzswap *rzs = q->queuedata;
+	struct bio_vec *bvec;
+	unsigned long index;
+	int i, rw, err = -EIO;
+
+	if ((bio->bi_sector & (PAGE_SECTORS - 1)) ||
+	    (bio->bi_size & ~PAGE_MASK) ||
+	    bio->bi_sector + (bio->bi_size >> SECTOR_SHIFT) >
+						get_capacity(rzs->disk))
+		goto invalid;
+
+	rw = bio_rw(bio);
+	if (rw == READA)
+		rw = READ;
+
+	index = bio->bi_sector >> PAGE_SECTORS_SHIFT;
+	bio_for_each_segment(bvec, bio, i) {
+		if (bvec->bv_len != PAGE_SIZE || bvec->bv_offset)
+			goto invalid;
+
+		if (rw == READ)
+			err = rzs_read(rzs, bvec->bv_page, index);
+		else
+			err = rzs_write(rzs, bvec->bv_page, index);
+		if (err)
+			break;
+		index++;
+	}
+
+	bio_endio(bio, err);
+	return 0;
+
+invalid:
+	spin_lock(&rzs->table_lock);
+	rzs->stats.invalid_io++;
+	spin_unlock(&rzs->table_lock);
+	bio_io_error(bio);
+	return 0;
+}
+
+static void rzs_slot_free_notify(struct block_device *bdev,
+				 unsigned long index)
+{
+	struct ramzswap *rzs = bdev->bd_disk->private_data;
+
+	spin_lock(&rzs->table_lock);
+	rzs_free_entry(rzs, index);
+	rzs->stats.notify_free++;
+	spin_unlock(&rzs->table_lock);
+}
+
+static struct block_device_operations rzs_fops = {
+	.owner =			THIS_MODULE,
+	.swap_slot_free_notify =	rzs_slot_free_notify,
+};
+
+/*
+ * Statistics, in /sys/block/ramzswapN/.
+ */
+static struct ramzswap *dev_to_rzs(struct device *dev)
+{
+	return dev_to_disk(dev)->private_data;
+}
+
+#define RZS_STAT_ATTR(_name)						\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct ramzswap *rzs = dev_to_rzs(dev);				\
+	u64 val;							\
+									\
+	spin_lock(&rzs->table_lock);					\
+	val = rzs->stats._name;						\
+	spin_unlock(&rzs->table_lock);					\
+	return sprintf(buf, "%llu\n", (unsigned long long)val);		\
+}									\
+static DEVICE_ATTR(_name, S_IRUGO, _name##_show, NULL)
+
+RZS_STAT_ATTR(num_reads);
+RZS_STAT_ATTR(num_writes);
+RZS_STAT_ATTR(failed_reads);
+RZS_STAT_ATTR(failed_writes);
+RZS_STAT_ATTR(invalid_io);
+RZS_STAT_ATTR(notify_free);
+RZS_STAT_ATTR(pages_zero);
+RZS_STAT_ATTR(pages_stored);
+RZS_STAT_ATTR(pages_expand);
+
+static ssize_t orig_data_size_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct ramzswap *rzs = dev_to_rzs(dev);
+	u64 val;
+
+	spin_lock(&rzs->table_lock);
+	val = (rzs->stats.pages_stored + rzs->stats.pages_expand) << PAGE_SHIFT;
+	spin_unlock(&rzs->table_lock);
+	return sprintf(buf, "%llu\n", (unsigned long long)val);
+}
+static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
+
+static ssize_t compr_data_size_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct ramzswap *rzs = dev_to_rzs(dev);
+	u64 val;
+
+	spin_lock(&rzs->table_lock);
+	val = rzs->stats.compr_size;
+	spin_unlock(&rzs->table_lock);
+	return sprintf(buf, "%llu\n", (unsigned long long)val);
+}
+static DEVICE_ATTR(compr_data_size, S_IRUGO, compr_data_size_show, NULL);
+
+static ssize_t mem_used_total_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct ramzswap *rzs = dev_to_rzs(dev);
+	u64 val;
+
+	spin_lock(&rzs->table_lock);
+	val = rzs->stats.pages_used << PAGE_SHIFT;
+	spin_unlock(&rzs->table_lock);
+	return sprintf(buf, "%llu\n", (unsigned long long)val);
+}
+static DEVICE_ATTR(mem_used_total, S_IRUGO, mem_used_total_show, NULL);
+
+/* Compressed size in percent of the original, zero pages left out */
+static ssize_t compr_ratio_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct ramzswap *rzs = dev_to_rzs(dev);
+	u64 orig, compr;
+
+	spin_lock(&rzs->table_lock);
+	orig = (rzs->stats.pages_stored + rzs->stats.pages_expand) <<
+								PAGE_SHIFT;
+	compr = rzs->stats.compr_size;
+	spin_unlock(&rzs->table_lock);
+
+	if (!orig)
+		return sprintf(buf, "0\n");
+	compr *= 100;
+	do_div(compr, orig);
+	return sprintf(buf, "%llu\n", (unsigned long long)compr);
+}
+static DEVICE_ATTR(compr_ratio, S_IRUGO, compr_ratio_show, NULL);
+
+static struct attribute *rzs_attrs[] = {
+	&dev_attr_num_reads.attr,
+	&dev_attr_num_writes.attr,
+	&dev_attr_failed_reads.attr,
+	&dev_attr_failed_writes.attr,
+	&dev_attr_invalid_io.attr,
+	&dev_attr_notify_free.attr,
+	&dev_attr_pages_zero.attr,
+	&dev_attr_pages_stored.attr,
+	&dev_attr_pages_expand.attr,
+	&dev_attr_orig_data_size.attr,
+	&dev_attr_compr_data_size.attr,
+	&dev_attr_mem_used_total.attr,
+	&dev_attr_compr_ratio.attr,
+	NULL,
+};
+
+static struct attribute_group rzs_attr_group = {
+	.attrs = rzs_attrs,
+};
+
+/*
+ * And now the modules code and kernel interface.
+ */
+static unsigned int num_devices = 1;
+static unsigned long disksize_kb;
+module_param(num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of ramzswap devices");
+module_param(disksize_kb, ulong, 0);
+MODULE_PARM_DESC(disksize_kb,
+		 "Size of each device in kbytes (default: 25% of RAM)");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM block device for swap");
+
+static void rzs_free_dev(struct ramzswap *rzs);
+
+static struct ramzswap *rzs_alloc(int i, unsigned long nr_pages)
+{
+	struct ramzswap *rzs;
+	struct gendisk *disk;
+	unsigned int c;
+
+	rzs = kzalloc(sizeof(*rzs), GFP_KERNEL);
+	if (!rzs)
+		goto out;
+	rzs->number = i;
+	rzs->nr_pages = nr_pages;
+	mutex_init(&rzs->lock);
+	spin_lock_init(&rzs->table_lock);
+	for (c = 0; c < RZS_NR_CLASSES; c++)
+		init_size_class(&rzs->classes[c], (c + 1) << RZS_ALIGN_SHIFT);
+
+	rzs->compress_workmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	/* a page might compress to more than a page: allow for it */
+	rzs->compress_buffer = (void *)__get_free_pages(GFP_KERNEL, 1);
+	rzs->obj_buffer = kmalloc(RZS_MAX_OBJ_SIZE, GFP_KERNEL);
+	rzs->table = vmalloc(nr_pages * sizeof(*rzs->table));
+	if (!rzs->compress_workmem || !rzs->compress_buffer ||
+	    !rzs->obj_buffer || !rzs->table)
+		goto out_free_dev;
+	memset(rzs->table, 0, nr_pages * sizeof(*rzs->table));
+
+	rzs->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!rzs->queue)
+		goto out_free_dev;
+	rzs->queue->queuedata = rzs;
+	blk_queue_make_request(rzs->queue, rzs_make_request);
+	blk_queue_hardsect_size(rzs->queue, PAGE_SIZE);
+	blk_queue_bounce_limit(rzs->queue, BLK_BOUNCE_ANY);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, rzs->queue);
+
+	disk = rzs->disk = alloc_disk(1);
+	if (!disk)
+		goto out_free_dev;
+	disk->major		= rzs_major;
+	disk->first_minor	= i;
+	disk->fops		= &rzs_fops;
+	disk->private_data	= rzs;
+	disk->queue		= rzs->queue;
+	disk->flags |= GENHD_FL_SUPPRESS_PARTITION_INFO;
+	sprintf(disk->disk_name, "ramzswap%d", i);
+	set_capacity(disk, nr_pages << PAGE_SECTORS_SHIFT);
+
+	return rzs;
+
+out_free_dev:
+	rzs_free_dev(rzs);
+out:
+	return NULL;
+}
+
+static void rzs_free_dev(struct ramzswap *rzs)
+{
+	unsigned long index;
+
+	if (rzs->disk)
+		put_disk(rzs->disk);
+	if (rzs->queue)
+		blk_cleanup_queue(rzs->queue);
+	if (rzs->table) {
+		for (index = 0; index < rzs->nr_pages; index++)
+			rzs_free_entry(rzs, index);
+		vfree(rzs->table);
+	}
+	kfree(rzs->obj_buffer);
+	if (rzs->compress_buffer)
+		free_pages((unsigned long)rzs->compress_buffer, 1);
+	kfree(rzs->compress_workmem);
+	kfree(rzs);
+}
+
+static int __init rzs_init(void)
+{
+	struct ramzswap *rzs, *next;
+	unsigned long nr_pages;
+	unsigned int i;
+
+	if (!num_devices || num_devices > 1U << MINORBITS)
+		return -EINVAL;
+
+	if (disksize_kb)
+		nr_pages = disksize_kb >> (PAGE_SHIFT - 10);
+	else
+		nr_pages = totalram_pages / 4;
+	if (!nr_pages)
+		return -EINVAL;
+
+	rzs_major = register_blkdev(0, "ramzswap");
+	if (rzs_major <= 0)
+		return -EIO;
+
+	for (i = 0; i < num_devices; i++) {
+		rzs = rzs_alloc(i, nr_pages);
+		if (!rzs)
+			goto out_free;
+		list_add_tail(&rzs->list, &rzs_devices);
+	}
+
+	/* point of no return */
+
+	list_for_each_entry(rzs, &rzs_devices, list) {
+		add_disk(rzs->disk);
+		if (sysfs_create_group(&disk_to_dev(rzs->disk)->kobj,
+				       &rzs_attr_group))
+			printk(KERN_WARNING "ramzswap%d: cannot create sysfs "
+			       "statistics\n", rzs->number);
+	}
+
+	printk(KERN_INFO "ramzswap: %u device(s) of %lu kB\n", num_devices,
+	       nr_pages << (PAGE_SHIFT - 10));
+	return 0;
+
+out_free:
+	list_for_each_entry_safe(rzs, next, &rzs_devices, list) {
+		list_del(&rzs->list);
+		rzs_free_dev(rzs);
+	}
+	unregister_blkdev(rzs_major, "ramzswap");
+
+	return -ENOMEM;
+}
+
+static void __exit rzs_exit(void)
+{
+	struct ramzswap *rzs, *next;
+
+	list_for_each_entry_safe(rzs, next, &rzs_devices, list) {
+		list_del(&rzs->list);
+		sysfs_remove_group(&disk_to_dev(rzs->disk)->kobj,
+				   &rzs_attr_group);
+		del_gendisk(rzs->disk);
+		rzs_free_dev(rzs);
+	}
+
+	unregister_blkdev(rzs_major, "ramzswap");
+}
+
+module_init(rzs_init);
+module_exit(rzs_exit);
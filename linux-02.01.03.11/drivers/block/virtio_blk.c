@@ -1,6 +1,7 @@
 //#define DEBUG
 #include <linux/spinlock.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -8,6 +9,9 @@
 
 #define PART_BITS 4
 
+/* Requests in flight; more than the virtqueue takes just get requeued. */
+#define VIRTBLK_QUEUE_DEPTH 64
+
 static int major, index;
 
 struct virtio_blk
@@ -23,8 +27,6 @@ struct virtio_blk
 	/* Request tracking. */
 	struct list_head reqs;
 
-	mempool_t *pool;
-
 	/* What host tells us, plus 2 for header & tailer. */
 	unsigned int sg_elems;
 
@@ -32,6 +34,7 @@ struct virtio_blk
 	struct scatterlist sg[/*sg_elems*/];
 };
 
+/* Lives right after its request, see blk_mq_rq_to_pdu(). */
 struct virtblk_req
 {
 	struct list_head list;
@@ -62,25 +65,20 @@ static void blk_done(struct virtqueue *vq)
 			break;
 		}
 
-		__blk_end_request(vbr->req, error, blk_rq_bytes(vbr->req));
 		list_del(&vbr->list);
-		mempool_free(vbr, vblk->pool);
+		blk_mq_end_io(vbr->req, error);
 	}
-	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
 	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	/* In case queue is stopped waiting for more buffers. */
+	blk_mq_start_stopped_hw_queues(vblk->disk->queue);
 }
 
 static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		   struct request *req)
 {
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
 	unsigned long num, out, in;
-	struct virtblk_req *vbr;
-
-	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
-	if (!vbr)
-		/* When another request finishes we'll try again. */
-		return false;
 
 	vbr->req = req;
 	if (blk_fs_request(vbr->req)) {
@@ -113,39 +111,49 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 		in = 1 + num;
 	}
 
-	if (vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr)) {
-		mempool_free(vbr, vblk->pool);
+	if (vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr))
 		return false;
-	}
 
 	list_add_tail(&vbr->list, &vblk->reqs);
 	return true;
 }
 
-static void do_virtblk_request(struct request_queue *q)
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req,
+			    bool last)
 {
-	struct virtio_blk *vblk = NULL;
-	struct request *req;
-	unsigned int issued = 0;
-
-	while ((req = elv_next_request(q)) != NULL) {
-		vblk = req->rq_disk->private_data;
-		BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+	struct virtio_blk *vblk = hctx->driver_data;
+	unsigned long flags;
+	bool queued;
 
-		/* If this request fails, stop queue and wait for something to
-		   finish to restart it. */
-		if (!do_req(q, vblk, req)) {
-			blk_stop_queue(q);
-			break;
-		}
-		blkdev_dequeue_request(req);
-		issued++;
-	}
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
 
-	if (issued)
+	/* vblk->lock serializes us against blk_done() on the virtqueue */
+	spin_lock_irqsave(&vblk->lock, flags);
+	queued = do_req(hctx->queue, vblk, req);
+	if (!queued) {
+		/* Stop the queue, something finishing will restart it. */
+		blk_mq_stop_hw_queue(hctx);
 		vblk->vq->vq_ops->kick(vblk->vq);
+	} else if (last)
+		vblk->vq->vq_ops->kick(vblk->vq);
+	spin_unlock_irqrestore(&vblk->lock, flags);
+
+	return queued ? BLK_MQ_RQ_QUEUE_OK : BLK_MQ_RQ_QUEUE_BUSY;
 }
 
+static struct blk_mq_ops virtblk_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+};
+
+static struct blk_mq_reg virtblk_mq_reg = {
+	.ops		= &virtblk_mq_ops,
+	.nr_hw_queues	= 1,
+	.queue_depth	= VIRTBLK_QUEUE_DEPTH,
+	.cmd_size	= sizeof(struct virtblk_req),
+	.numa_node	= -1,
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
+
 static int virtblk_ioctl(struct block_device *bdev, fmode_t mode,
 			 unsigned cmd, unsigned long data)
 {
@@ -230,20 +238,14 @@ static int virtblk_probe(struct virtio_device *vdev)
 		goto out_free_vblk;
 	}
 
-	vblk->pool = mempool_create_kmalloc_pool(1,sizeof(struct virtblk_req));
-	if (!vblk->pool) {
-		err = -ENOMEM;
-		goto out_free_vq;
-	}
-
 	/* FIXME: How many partitions?  How long is a piece of string? */
 	vblk->disk = alloc_disk(1 << PART_BITS);
 	if (!vblk->disk) {
 		err = -ENOMEM;
-		goto out_mempool;
+		goto out_free_vq;
 	}
 
-	vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
+	vblk->disk->queue = blk_mq_init_queue(&virtblk_mq_reg, vblk);
 	if (!vblk->disk->queue) {
 		err = -ENOMEM;
 		goto out_put_disk;
@@ -320,8 +322,6 @@ static int virtblk_probe(struct virtio_device *vdev)
 
 out_put_disk:
 	put_disk(vblk->disk);
-out_mempool:
-	mempool_destroy(vblk->pool);
 out_free_vq:
 	vdev->config->del_vq(vblk->vq);
 out_free_vblk:
@@ -343,7 +343,6 @@ static void virtblk_remove(struct virtio_device *vdev)
 	del_gendisk(vblk->disk);
 	blk_cleanup_queue(vblk->disk->queue);
 	put_disk(vblk->disk);
-	mempool_destroy(vblk->pool);
 	vdev->config->del_vq(vblk->vq);
 	kfree(vblk);
 }
@@ -158,6 +158,29 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
+static struct workqueue_struct *raid5_wq;
+
+/*
+ * With stripe workers enabled, a stripe ready to be handled goes to the
+ * list of the cpu it is affine to, the one which set it up, and that
+ * cpu's worker handles it instead of raid5d.  Stripes of an offline cpu
+ * are left to raid5d.  device_lock is held.
+ */
+static bool raid5_wakeup_stripe_worker(raid5_conf_t *conf,
+				       struct stripe_head *sh)
+{
+	struct r5worker_group *group;
+	int cpu = sh->cpu;
+
+	if (!conf->worker_groups || !cpu_online(cpu))
+		return false;
+
+	group = per_cpu_ptr(conf->worker_groups, cpu);
+	list_add_tail(&sh->lru, &group->handle_list);
+	queue_work_on(cpu, raid5_wq, &group->work);
+	return true;
+}
+
 static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -173,6 +196,8 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 				blk_plug_device(conf->mddev->queue);
 			} else {
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
+				if (raid5_wakeup_stripe_worker(conf, sh))
+					return;
 				list_add_tail(&sh->lru, &conf->handle_list);
 			}
 			md_wakeup_thread(conf->mddev->thread);
@@ -290,6 +315,7 @@ static void init_stripe(struct stripe_head *sh, sector_t sector, int pd_idx, int
 	sh->sector = sector;
 	sh->pd_idx = pd_idx;
 	sh->state = 0;
+	sh->cpu = smp_processor_id();
 
 	sh->disks = disks;
 
@@ -3329,19 +3355,23 @@ static int chunk_aligned_read(struct request_queue *q, struct bio * raid_bio)
  * stripe with in flight i/o.  The bypass_count will be reset when the
  * head of the hold_list has changed, i.e. the head was promoted to the
  * handle_list.
+ *
+ * @handle_list is conf->handle_list for raid5d, or the list of a stripe
+ * worker; the hold_list is shared.
  */
-static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
+static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf,
+						 struct list_head *handle_list)
 {
 	struct stripe_head *sh;
 
 	pr_debug("%s: handle: %s hold: %s full_writes: %d bypass_count: %d\n",
 		  __func__,
-		  list_empty(&conf->handle_list) ? "empty" : "busy",
+		  list_empty(handle_list) ? "empty" : "busy",
 		  list_empty(&conf->hold_list) ? "empty" : "busy",
 		  atomic_read(&conf->pending_full_writes), conf->bypass_count);
 
-	if (!list_empty(&conf->handle_list)) {
-		sh = list_entry(conf->handle_list.next, typeof(*sh), lru);
+	if (!list_empty(handle_list)) {
+		sh = list_entry(handle_list->next, typeof(*sh), lru);
 
 		if (list_empty(&conf->hold_list))
 			conf->bypass_count = 0;
@@ -3823,6 +3853,28 @@ static int  retry_aligned_read(raid5_conf_t *conf, struct bio *raid_bio)
 
 
 
+/*
+ * Take over what is queued for the workers of offline cpus.  Normally the
+ * workqueue runs their work elsewhere when a cpu goes down, this only
+ * catches stripes queued while it did.  device_lock is held.
+ */
+static void raid5_take_offline_stripes(raid5_conf_t *conf)
+{
+	int cpu;
+
+	if (!conf->worker_groups)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct r5worker_group *group;
+
+		if (cpu_online(cpu))
+			continue;
+		group = per_cpu_ptr(conf->worker_groups, cpu);
+		list_splice_tail_init(&group->handle_list, &conf->handle_list);
+	}
+}
+
 /*
  * This is our raid5 kernel thread.
  *
@@ -3842,6 +3894,7 @@ static void raid5d(mddev_t *mddev)
 
 	handled = 0;
 	spin_lock_irq(&conf->device_lock);
+	raid5_take_offline_stripes(conf);
 	while (1) {
 		struct bio *bio;
 
@@ -3864,7 +3917,7 @@ static void raid5d(mddev_t *mddev)
 			handled++;
 		}
 
-		sh = __get_priority_stripe(conf);
+		sh = __get_priority_stripe(conf, &conf->handle_list);
 
 		if (!sh)
 			break;
@@ -3886,6 +3939,103 @@ static void raid5d(mddev_t *mddev)
 	pr_debug("--- raid5d inactive\n");
 }
 
+/*
+ * A stripe worker: like raid5d, minus the array management, for the
+ * stripes queued on one cpu.
+ */
+static void raid5_do_work(struct work_struct *work)
+{
+	struct r5worker_group *group =
+		container_of(work, struct r5worker_group, work);
+	raid5_conf_t *conf = group->conf;
+	struct stripe_head *sh;
+	int handled = 0;
+
+	pr_debug("+++ raid5 worker active\n");
+
+	spin_lock_irq(&conf->device_lock);
+	while ((sh = __get_priority_stripe(conf, &group->handle_list))) {
+		spin_unlock_irq(&conf->device_lock);
+
+		handled++;
+		handle_stripe(sh, group->spare_page);
+		release_stripe(sh);
+
+		spin_lock_irq(&conf->device_lock);
+	}
+	spin_unlock_irq(&conf->device_lock);
+	pr_debug("%d stripes handled\n", handled);
+
+	async_tx_issue_pending_all();
+	unplug_slaves(conf->mddev);
+
+	pr_debug("--- raid5 worker inactive\n");
+}
+
+static void free_stripe_workers(struct r5worker_group *groups)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		safe_put_page(per_cpu_ptr(groups, cpu)->spare_page);
+	free_percpu(groups);
+}
+
+static int start_stripe_workers(raid5_conf_t *conf)
+{
+	struct r5worker_group *groups;
+	int cpu;
+
+	if (conf->worker_groups)
+		return 0;
+
+	groups = alloc_percpu(struct r5worker_group);
+	if (!groups)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct r5worker_group *group = per_cpu_ptr(groups, cpu);
+
+		INIT_LIST_HEAD(&group->handle_list);
+		INIT_WORK(&group->work, raid5_do_work);
+		group->conf = conf;
+		if (conf->level == 6) {
+			group->spare_page = alloc_page(GFP_KERNEL);
+			if (!group->spare_page) {
+				free_stripe_workers(groups);
+				return -ENOMEM;
+			}
+		}
+	}
+
+	spin_lock_irq(&conf->device_lock);
+	conf->worker_groups = groups;
+	spin_unlock_irq(&conf->device_lock);
+	return 0;
+}
+
+/* Hand the stripes queued for the workers back to raid5d. */
+static void stop_stripe_workers(raid5_conf_t *conf)
+{
+	struct r5worker_group *groups = conf->worker_groups;
+	int cpu;
+
+	if (!groups)
+		return;
+
+	spin_lock_irq(&conf->device_lock);
+	conf->worker_groups = NULL;
+	for_each_possible_cpu(cpu)
+		list_splice_tail_init(&per_cpu_ptr(groups, cpu)->handle_list,
+				      &conf->handle_list);
+	spin_unlock_irq(&conf->device_lock);
+	md_wakeup_thread(conf->mddev->thread);
+
+	for_each_possible_cpu(cpu)
+		cancel_work_sync(&per_cpu_ptr(groups, cpu)->work);
+	free_stripe_workers(groups);
+}
+
 static ssize_t
 raid5_show_stripe_cache_size(mddev_t *mddev, char *page)
 {
@@ -3981,10 +4131,50 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_stripe_workers(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	if (conf)
+		return sprintf(page, "%d\n", conf->worker_groups != NULL);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_stripe_workers(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	unsigned long new;
+	int err = 0;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > 1)
+		return -EINVAL;
+
+	if (new)
+		err = start_stripe_workers(conf);
+	else
+		stop_stripe_workers(conf);
+	return err ?: len;
+}
+
+static struct md_sysfs_entry
+raid5_stripe_workers = __ATTR(stripe_workers, S_IRUGO | S_IWUSR,
+			      raid5_show_stripe_workers,
+			      raid5_store_stripe_workers);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_stripe_workers.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -4276,6 +4466,7 @@ static int stop(mddev_t *mddev)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 
+	stop_stripe_workers(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	shrink_stripes(conf);
@@ -4744,6 +4935,9 @@ static int __init raid5_init(void)
 	e = raid6_select_algo();
 	if ( e )
 		return e;
+	raid5_wq = create_reclaim_workqueue("raid5wq");
+	if (!raid5_wq)
+		return -ENOMEM;
 	register_md_personality(&raid6_personality);
 	register_md_personality(&raid5_personality);
 	register_md_personality(&raid4_personality);
@@ -4755,6 +4949,7 @@ static void raid5_exit(void)
 	unregister_md_personality(&raid6_personality);
 	unregister_md_personality(&raid5_personality);
 	unregister_md_personality(&raid4_personality);
+	destroy_workqueue(raid5_wq);
 }
 
 module_init(raid5_init);
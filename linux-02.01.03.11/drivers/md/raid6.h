@@ -67,6 +67,9 @@ extern const char raid6_empty_zero_page[PAGE_SIZE];
 #define cpu_has_feature(x) 1
 #define enable_kernel_altivec()
 #define disable_kernel_altivec()
+#define cpu_has_neon() 1
+#define kernel_neon_begin()
+#define kernel_neon_end()
 
 #endif /* __KERNEL__ */
 
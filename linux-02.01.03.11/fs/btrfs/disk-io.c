@@ -1235,6 +1235,8 @@ static void btrfs_unplug_io_fn(struct backing_dev_info *bdi, struct page *page)
 	free_extent_map(em);
 }
 
+static atomic_t btrfs_bdi_num = ATOMIC_INIT(0);
+
 static int setup_bdi(struct btrfs_fs_info *info, struct backing_dev_info *bdi)
 {
 	bdi_init(bdi);
@@ -1245,7 +1247,9 @@ static int setup_bdi(struct btrfs_fs_info *info, struct backing_dev_info *bdi)
 	bdi->unplug_io_data	= info;
 	bdi->congested_fn	= btrfs_congested_fn;
 	bdi->congested_data	= info;
-	return 0;
+	/* registered bdis get a flusher thread to write back their inodes */
+	return bdi_register(bdi, NULL, "btrfs-%d",
+			    atomic_inc_return(&btrfs_bdi_num));
 }
 
 static int bio_ready_for_csum(struct bio *bio)
@@ -2284,7 +2288,7 @@ void btrfs_btree_balance_dirty(struct btrfs_root *root, unsigned long nr)
 	unsigned long thresh = 32 * 1024 * 1024;
 	tree = &BTRFS_I(root->fs_info->btree_inode)->io_tree;
 
-	if (current_is_pdflush() || current->flags & PF_MEMALLOC)
+	if (current_is_flusher() || current->flags & PF_MEMALLOC)
 		return;
 
 	num_dirty = count_range_bits(tree, &start, (u64)-1,
@@ -41,22 +41,22 @@
 
 /*
  * LOCKING:
- * There are three level of locking required by epoll :
+ * There are two level of locking required by epoll :
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
  *
- * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
- * user space) we could end up sleeping due a copy_to_user(), so
- * we need a lock that will allow us to sleep. This lock is a
- * mutex (ep->mtx). It is acquired during the event transfer loop,
- * during epoll_ctl(EPOLL_CTL_DEL) and during eventpoll_release_file().
+ * The acquire order is the one listed above, from 1 to 2.
+ * The poll callback might be triggered from a wake_up() that in turn
+ * might be called from IRQ context, so it can't take either of them.
+ * It does not take any lock of its own either: it pushes the item on
+ * the ep->pendlist single linked list with cmpxchg(), and whoever holds
+ * "ep->mtx" moves the pushed items to the ready list, ep->rdllist,
+ * which is only ever touched with "ep->mtx" held. During the event
+ * transfer loop (from kernel to user space) we could end up sleeping
+ * due a copy_to_user(), so we need a lock that will allow us to sleep.
+ * This lock is a mutex (ep->mtx). It is acquired during the event
+ * transfer loop, during epoll_ctl() and during eventpoll_release_file().
  * Then we also need a global mutex to serialize eventpoll_release_file()
  * and ep_free().
  * This mutex is acquired by ep_free() during the epoll file
@@ -64,8 +64,8 @@
  * if a file has been pushed inside an epoll set and it is then
  * close()d without a previous call toepoll_ctl(EPOLL_CTL_DEL).
  * It is possible to drop the "ep->mtx" and to use the global
- * mutex "epmutex" (together with "ep->lock") to have it working,
- * but having "ep->mtx" will make the interface more scalable.
+ * mutex "epmutex" to have it working, but having "ep->mtx" will
+ * make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->mtx" will guarantee
  * a better scalability.
@@ -90,11 +90,18 @@
 #endif /* #if DEBUG_EPI != 0 */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
 
 /* Maximum number of poll wake up nests we are allowing */
 #define EP_MAX_POLLWAKE_NESTS 4
 
+/*
+ * Lockdep subclass of the ep->wq lock when taken from the poll callback,
+ * that is inside the lock of another wait queue head, possibly the
+ * ->poll_wait of a nested epoll (see ep_poll_safewake()).
+ */
+#define EP_WQ_NESTING (EP_MAX_POLLWAKE_NESTS + 2)
+
 /* Maximum msec timeout value storeable in a long int */
 #define EP_MAX_MSTIMEO min(1000ULL * MAX_SCHEDULE_TIMEOUT / HZ, (LONG_MAX - 999ULL) / HZ)
 
@@ -143,8 +150,8 @@ struct epitem {
 	struct list_head rdllink;
 
 	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * Links the item on "struct eventpoll"->pendlist, EP_UNACTIVE_PTR
+	 * while it is not on it.
 	 */
 	struct epitem *next;
 
@@ -173,14 +180,11 @@ struct epitem {
  * interface.
  */
 struct eventpoll {
-	/* Protect the this structure access */
-	spinlock_t lock;
-
 	/*
 	 * This mutex is used to ensure that files are not removed
 	 * while epoll is using them. This is held during the event
 	 * collection loop, the file cleanup path, the epoll file exit
-	 * code and the ctl operations.
+	 * code and the ctl operations. It also protects the ready list.
 	 */
 	struct mutex mtx;
 
@@ -197,11 +201,12 @@ struct eventpoll {
 	struct rb_root rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transfering ready events to userspace w/out
-	 * holding ->lock.
+	 * This is a single linked list that chains all the "struct epitem"
+	 * that the poll callback found ready, and that have not been moved
+	 * to the ready list yet.  The callback pushes items on it without
+	 * locking, see ep_poll_callback() and ep_flush_pending().
 	 */
-	struct epitem *ovflist;
+	struct epitem *pendlist;
 
 	/* The user that created the eventpoll descriptor */
 	struct user_struct *user;
@@ -321,6 +326,48 @@ static inline int ep_op_has_event(int op)
 	return op != EPOLL_CTL_DEL;
 }
 
+/*
+ * Tells if there might be events to report: either items in the ready
+ * list, or items the poll callback queued that did not get there yet.
+ * This is only a hint when called without "mtx".
+ */
+static inline int ep_events_available(struct eventpoll *ep)
+{
+	return !list_empty(&ep->rdllist) || ACCESS_ONCE(ep->pendlist);
+}
+
+/*
+ * Move the items queued by the poll callback to the end of the ready
+ * list, in the order they were queued. Must be called with "mtx" held.
+ */
+static void ep_flush_pending(struct eventpoll *ep)
+{
+	struct epitem *epi, *nepi, *rev = NULL;
+
+	/* Detach the whole chain, the callback keeps pushing on a new one */
+	epi = xchg(&ep->pendlist, NULL);
+
+	/* It is last in, first out, reverse it */
+	for (; epi; epi = nepi) {
+		nepi = epi->next;
+		epi->next = rev;
+		rev = epi;
+	}
+
+	for (epi = rev; epi; epi = nepi) {
+		nepi = epi->next;
+		/*
+		 * The item can be queued again as soon as ->next is
+		 * EP_UNACTIVE_PTR, so it must not be looked at after that.
+		 * It is still linked in the ready list if it has not been
+		 * reported yet.
+		 */
+		if (!ep_is_linked(&epi->rdllink))
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+		epi->next = EP_UNACTIVE_PTR;
+	}
+}
+
 /* Initialize the poll safe wake up structure */
 static void ep_poll_safewake_init(struct poll_safewake *psw)
 {
@@ -382,9 +429,24 @@ static void ep_poll_safewake(struct poll_safewake *psw, wait_queue_head_t *wq)
 	spin_unlock_irqrestore(&psw->lock, flags);
 }
 
+/*
+ * Wake up ( if active ) both the eventpoll wait list and the ->poll()
+ * wait list, after items have been added to the ready list. Must be
+ * called with "mtx" held.
+ */
+static void ep_wake_up(struct eventpoll *ep)
+{
+	/* Pairs with the set_current_state() in ep_poll() */
+	smp_mb();
+	if (waitqueue_active(&ep->wq))
+		wake_up(&ep->wq);
+	if (waitqueue_active(&ep->poll_wait))
+		ep_poll_safewake(&psw, &ep->poll_wait);
+}
+
 /*
  * This function unregister poll callbacks from the associated file descriptor.
- * Since this must be called without holding "ep->lock" the atomic exchange trick
+ * Since this is called without holding any spinlock the atomic exchange trick
  * will protect us from multiple unregister.
  */
 static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
@@ -413,16 +475,12 @@ static void ep_unregister_pollwait(struct eventpoll *ep, struct epitem *epi)
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
-	unsigned long flags;
 	struct file *file = epi->ffd.file;
 
 	/*
-	 * Removes poll wait queue hooks. We _have_ to do this without holding
-	 * the "ep->lock" otherwise a deadlock might occur. This because of the
-	 * sequence of the lock acquisition. Here we do "ep->lock" then the wait
-	 * queue head lock when unregistering the wait queue. The wakeup callback
-	 * will run by holding the wait queue head lock and will call our callback
-	 * that will try to get "ep->lock".
+	 * Removes poll wait queue hooks. The wakeup callback runs by holding
+	 * the wait queue head lock, so once this returns no callback can be
+	 * running on the item anymore.
 	 */
 	ep_unregister_pollwait(ep, epi);
 
@@ -434,10 +492,15 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	/*
+	 * No poll callback can hit the item anymore, but it might have
+	 * queued it on ep->pendlist before, and it can't be unlinked from
+	 * there alone.
+	 */
+	if (epi->next != EP_UNACTIVE_PTR)
+		ep_flush_pending(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/* At this point it is safe to free the eventpoll item */
 	kmem_cache_free(epi_cache, epi);
@@ -482,7 +545,7 @@ static void ep_free(struct eventpoll *ep)
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
 	 * holding "epmutex" we can be sure that no file cleanup code will hit
-	 * us during this operation. So we can avoid the lock on "ep->lock".
+	 * us during this operation. So we can avoid the lock on "ep->mtx".
 	 */
 	while ((rbp = rb_first(&ep->rbr)) != NULL) {
 		epi = rb_entry(rbp, struct epitem, rbn);
@@ -509,20 +572,13 @@ static int ep_eventpoll_release(struct inode *inode, struct file *file)
 
 static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
 {
-	unsigned int pollflags = 0;
-	unsigned long flags;
 	struct eventpoll *ep = file->private_data;
 
 	/* Insert inside our poll wait queue */
 	poll_wait(file, &ep->poll_wait, wait);
 
 	/* Check our condition */
-	spin_lock_irqsave(&ep->lock, flags);
-	if (!list_empty(&ep->rdllist))
-		pollflags = POLLIN | POLLRDNORM;
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	return pollflags;
+	return ep_events_available(ep) ? POLLIN | POLLRDNORM : 0;
 }
 
 /* File callbacks that implement the eventpoll file behaviour */
@@ -590,13 +646,12 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
-	spin_lock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep->pendlist = NULL;
 	ep->user = user;
 
 	*pep = ep;
@@ -645,20 +700,22 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 /*
  * This is the callback that is passed to the wait queue wakeup
  * machanism. It is called by the stored file descriptors when they
- * have events to report.
+ * have events to report. It runs without taking any epoll lock.
+ *
+ * For EPOLLEXCLUSIVE items the return value tells the wakeup code
+ * whether a waiter was woken, so that it can move on to the next
+ * exclusive epoll if there was none.
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
-	unsigned long flags;
+	int ewake = 0;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
+	struct epitem *head;
 
 	DNPRINTK(3, (KERN_INFO "[%p] eventpoll: poll_callback(%p) epi=%p ep=%p\n",
 		     current, epi->ffd.file, epi, ep));
 
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
 	 * descriptor to be disabled. This condition is likely the effect of the
@@ -666,46 +723,40 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		goto out;
 
 	/*
-	 * If we are trasfering events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happens during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * Claim the item by moving its ->next away from EP_UNACTIVE_PTR,
+	 * then push it on ep->pendlist. If the claim fails, the item is
+	 * already queued and will be looked at anyway. Nothing but this
+	 * push ever adds to ep->pendlist, and it is only ever emptied as a
+	 * whole, so there is no ABA problem here.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-		}
-		goto out_unlock;
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) == EP_UNACTIVE_PTR) {
+		do {
+			head = ACCESS_ONCE(ep->pendlist);
+			epi->next = head;
+		} while (cmpxchg(&ep->pendlist, head, epi) != head);
 	}
 
-	/* If this file is already in the ready list we exit soon */
-	if (ep_is_linked(&epi->rdllink))
-		goto is_linked;
-
-	list_add_tail(&epi->rdllink, &ep->rdllist);
-
-is_linked:
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * wait list. Pairs with the set_current_state() in ep_poll().
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
-	if (waitqueue_active(&ep->poll_wait))
-		pwake++;
-
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
-	if (pwake)
+	smp_mb();
+	if (waitqueue_active(&ep->wq)) {
+		wake_up_nested(&ep->wq, EP_WQ_NESTING);
+		ewake = 1;
+	}
+	if (waitqueue_active(&ep->poll_wait)) {
 		ep_poll_safewake(&psw, &ep->poll_wait);
+		ewake = 1;
+	}
 
-	return 1;
+out:
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		return 1;
+	return ewake;
 }
 
 /*
@@ -722,7 +773,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -756,8 +810,7 @@ static void ep_rbtree_insert(struct eventpoll *ep, struct epitem *epi)
 static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd)
 {
-	int error, revents, pwake = 0;
-	unsigned long flags;
+	int error, revents;
 	struct epitem *epi;
 	struct ep_pqueue epq;
 
@@ -810,28 +863,16 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	 */
 	ep_rbtree_insert(ep, epi);
 
-	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/* If the file is already "ready" we drop it inside the ready list */
 	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
 		list_add_tail(&epi->rdllink, &ep->rdllist);
 
 		/* Notify waiting tasks that events are available */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
-		if (waitqueue_active(&ep->poll_wait))
-			pwake++;
+		ep_wake_up(ep);
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	atomic_inc(&ep->user->epoll_watches);
 
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&psw, &ep->poll_wait);
-
 	DNPRINTK(3, (KERN_INFO "[%p] eventpoll: ep_insert(%p, %p, %d)\n",
 		     current, ep, tfile, fd));
 
@@ -842,14 +883,14 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and queued the item on ep->pendlist. The ready
+	 * list is only touched with "mtx" held, and ep_insert() is called with
+	 * "mtx" held.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	if (epi->next != EP_UNACTIVE_PTR)
+		ep_flush_pending(ep);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
 
 	kmem_cache_free(epi_cache, epi);
 
@@ -862,9 +903,7 @@ error_unregister:
  */
 static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_event *event)
 {
-	int pwake = 0;
 	unsigned int revents;
-	unsigned long flags;
 
 	/*
 	 * Set the new event interest mask before calling f_op->poll(), otherwise
@@ -880,9 +919,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 */
 	revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL);
 
-	spin_lock_irqsave(&ep->lock, flags);
-
-	/* Copy the data member from inside the lock */
+	/* The data member is only read with "mtx" held */
 	epi->event.data = event->data;
 
 	/*
@@ -894,17 +931,9 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 			list_add_tail(&epi->rdllink, &ep->rdllist);
 
 			/* Notify waiting tasks that events are available */
-			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
-			if (waitqueue_active(&ep->poll_wait))
-				pwake++;
+			ep_wake_up(ep);
 		}
 	}
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&psw, &ep->poll_wait);
 
 	return 0;
 }
@@ -912,10 +941,9 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 static int ep_send_events(struct eventpoll *ep, struct epoll_event __user *events,
 			  int maxevents)
 {
-	int eventcnt, error = -EFAULT, pwake = 0;
+	int eventcnt, error = -EFAULT;
 	unsigned int revents;
-	unsigned long flags;
-	struct epitem *epi, *nepi;
+	struct epitem *epi;
 	struct list_head txlist;
 
 	INIT_LIST_HEAD(&txlist);
@@ -927,21 +955,15 @@ static int ep_send_events(struct eventpoll *ep, struct epoll_event __user *event
 	mutex_lock(&ep->mtx);
 
 	/*
-	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we are doing it in the loop below, in a lockless way.
+	 * Collect what the poll callback queued so far, then steal the
+	 * ready list. Events happening while we loop below are queued on
+	 * ep->pendlist, and picked up by the next call.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
-	list_splice(&ep->rdllist, &txlist);
-	INIT_LIST_HEAD(&ep->rdllist);
-	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_flush_pending(ep);
+	list_splice_init(&ep->rdllist, &txlist);
 
 	/*
 	 * We can loop without lock because this is a task private list.
-	 * We just splice'd out the ep->rdllist in ep_collect_ready_items().
 	 * Items cannot vanish during the loop because we are holding "mtx".
 	 */
 	for (eventcnt = 0; !list_empty(&txlist) && eventcnt < maxevents;) {
@@ -974,9 +996,8 @@ static int ep_send_events(struct eventpoll *ep, struct epoll_event __user *event
 			eventcnt++;
 		}
 		/*
-		 * At this point, noone can insert into ep->rdllist besides
-		 * us. The epoll_ctl() callers are locked out by us holding
-		 * "mtx" and the poll callback will queue them in ep->ovflist.
+		 * Level triggered items go back to the ready list, which
+		 * only we can touch, as we hold "mtx".
 		 */
 		if (!(epi->event.events & EPOLLET) &&
 		    (revents & epi->event.events))
@@ -986,29 +1007,6 @@ static int ep_send_events(struct eventpoll *ep, struct epoll_event __user *event
 
 errxit:
 
-	spin_lock_irqsave(&ep->lock, flags);
-	/*
-	 * During the time we spent in the loop above, some other events
-	 * might have been queued by the poll callback. We re-insert them
-	 * inside the main ready-list here.
-	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * If the above loop quit with errors, the epoll item might still
-		 * be linked to "txlist", and the list_splice() done below will
-		 * take care of those cases.
-		 */
-		if (!ep_is_linked(&epi->rdllink))
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-	}
-	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
-	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
-
 	/*
 	 * In case of error in the event-send loop, or in case the number of
 	 * ready events exceeds the userspace limit, we need to splice the
@@ -1016,24 +1014,15 @@ errxit:
 	 */
 	list_splice(&txlist, &ep->rdllist);
 
-	if (!list_empty(&ep->rdllist)) {
-		/*
-		 * Wake up (if active) both the eventpoll wait list and the ->poll()
-		 * wait list (delayed after we release the lock).
-		 */
-		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
-		if (waitqueue_active(&ep->poll_wait))
-			pwake++;
-	}
-	spin_unlock_irqrestore(&ep->lock, flags);
+	/*
+	 * Wake up (if active) both the eventpoll wait list and the ->poll()
+	 * wait list, if there is something left for them.
+	 */
+	if (ep_events_available(ep))
+		ep_wake_up(ep);
 
 	mutex_unlock(&ep->mtx);
 
-	/* We have to call this outside the lock */
-	if (pwake)
-		ep_poll_safewake(&psw, &ep->poll_wait);
-
 	return eventcnt == 0 ? error: eventcnt;
 }
 
@@ -1054,18 +1043,19 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		MAX_SCHEDULE_TIMEOUT : (timeout * HZ + 999) / 1000;
 
 retry:
-	spin_lock_irqsave(&ep->lock, flags);
-
 	res = 0;
-	if (list_empty(&ep->rdllist)) {
+	if (!ep_events_available(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
 		 * ep_poll_callback() when events will become available.
+		 * Only one of the waiters is woken for each event.
 		 */
 		init_waitqueue_entry(&wait, current);
 		wait.flags |= WQ_FLAG_EXCLUSIVE;
+		spin_lock_irqsave(&ep->wq.lock, flags);
 		__add_wait_queue(&ep->wq, &wait);
+		spin_unlock_irqrestore(&ep->wq.lock, flags);
 
 		for (;;) {
 			/*
@@ -1074,26 +1064,22 @@ retry:
 			 * to TASK_INTERRUPTIBLE before doing the checks.
 			 */
 			set_current_state(TASK_INTERRUPTIBLE);
-			if (!list_empty(&ep->rdllist) || !jtimeout)
+			if (ep_events_available(ep) || !jtimeout)
 				break;
 			if (signal_pending(current)) {
 				res = -EINTR;
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
 			jtimeout = schedule_timeout(jtimeout);
-			spin_lock_irqsave(&ep->lock, flags);
 		}
-		__remove_wait_queue(&ep->wq, &wait);
+		remove_wait_queue(&ep->wq, &wait);
 
 		set_current_state(TASK_RUNNING);
 	}
 
 	/* Is it worth to try to dig for events ? */
-	eavail = !list_empty(&ep->rdllist);
-
-	spin_unlock_irqrestore(&ep->lock, flags);
+	eavail = ep_events_available(ep);
 
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
@@ -1223,6 +1209,14 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	error = -EINVAL;
 	switch (op) {
 	case EPOLL_CTL_ADD:
+		/*
+		 * Exclusive wakeups can't be nested, and a one shot item
+		 * would swallow the wakeup meant for another waiter.
+		 */
+		if ((epds.events & EPOLLEXCLUSIVE) &&
+		    ((epds.events & EPOLLONESHOT) || is_file_epoll(tfile)))
+			break;
+
 		if (!epi) {
 			epds.events |= POLLERR | POLLHUP;
 
@@ -1238,6 +1232,9 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
+			/* The wait queues were set up by EPOLL_CTL_ADD */
+			if ((epds.events | epi->event.events) & EPOLLEXCLUSIVE)
+				break;
 			epds.events |= POLLERR | POLLHUP;
 			error = ep_modify(ep, epi, &epds);
 		} else
@@ -19,6 +19,8 @@
 #include <linux/sched.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include <linux/writeback.h>
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
@@ -26,42 +28,31 @@
 #include "internal.h"
 
 
-/**
- * writeback_acquire - attempt to get exclusive writeback access to a device
- * @bdi: the device's backing_dev_info structure
- *
- * It is a waste of resources to have more than one pdflush thread blocked on
- * a single request queue.  Exclusion at the request_queue level is obtained
- * via a flag in the request_queue's backing_dev_info.state.
- *
- * Non-request_queue-backed address_spaces will share default_backing_dev_info,
- * unless they implement their own.  Which is somewhat inefficient, as this
- * may prevent concurrent writeback against multiple devices.
+/*
+ * The maximum number of pages to writeout in a single pass of a flusher
+ * thread.  We do this so we don't hold I_SYNC against an inode for enormous
+ * amounts of time, which would block a userspace task which has been forced
+ * to throttle against that inode.  Also, the code reevaluates the dirty each
+ * time it has written this many pages.
  */
-static int writeback_acquire(struct backing_dev_info *bdi)
-{
-	return !test_and_set_bit(BDI_pdflush, &bdi->state);
-}
+#define MAX_WRITEBACK_PAGES	1024
+
+/*
+ * How long a flusher thread hangs around with nothing to write.  Once its
+ * device sees dirty data again, bdi-default simply forks it again.
+ */
+#define BDI_MAX_IDLE		(5 * 60 * HZ)
 
 /**
  * writeback_in_progress - determine whether there is writeback in progress
  * @bdi: the device's backing_dev_info structure.
  *
- * Determine whether there is writeback in progress against a backing device.
+ * Determine whether the flusher thread of a backing device is busy writing
+ * it back.
  */
 int writeback_in_progress(struct backing_dev_info *bdi)
 {
-	return test_bit(BDI_pdflush, &bdi->state);
-}
-
-/**
- * writeback_release - relinquish exclusive writeback access against a device.
- * @bdi: the device's backing_dev_info structure
- */
-static void writeback_release(struct backing_dev_info *bdi)
-{
-	BUG_ON(!writeback_in_progress(bdi));
-	clear_bit(BDI_pdflush, &bdi->state);
+	return test_bit(BDI_writeback_running, &bdi->state);
 }
 
 /**
@@ -418,9 +409,6 @@ __writeback_single_inode(struct inode *inode, struct writeback_control *wbc)
  * If older_than_this is non-NULL, then only write out inodes which
  * had their first dirtying at a time earlier than *older_than_this.
  *
- * If we're a pdlfush thread, then implement pdflush collision avoidance
- * against the entire list.
- *
  * If `bdi' is non-zero then we're being asked to writeback a specific queue.
  * This function assumes that the blockdev superblock's inodes are backed by
  * a variety of queues, so all inodes are searched.  For other superblocks,
@@ -489,16 +477,10 @@ void generic_sync_sb_inodes(struct super_block *sb,
 		if (time_after(inode->dirtied_when, start))
 			break;
 
-		/* Is another pdflush already flushing this queue? */
-		if (current_is_pdflush() && !writeback_acquire(bdi))
-			break;
-
 		BUG_ON(inode->i_state & I_FREEING);
 		__iget(inode);
 		pages_skipped = wbc->pages_skipped;
 		__writeback_single_inode(inode, wbc);
-		if (current_is_pdflush())
-			writeback_release(bdi);
 		if (wbc->pages_skipped != pages_skipped) {
 			/*
 			 * writeback is not making progress due to locked
@@ -570,6 +552,67 @@ static void sync_sb_inodes(struct super_block *sb,
 	generic_sync_sb_inodes(sb, wbc);
 }
 
+/*
+ * Are the dirty inodes of @sb written back to @bdi?  All inodes of a
+ * filesystem share one queue, so the first dirty one tells.  The blockdev
+ * superblock has inodes of every queue and is always searched.
+ */
+static int sb_on_bdi(struct super_block *sb, struct backing_dev_info *bdi)
+{
+	struct list_head *head = NULL;
+	int ret = 1;
+
+	if (!bdi || sb_is_blkdev_sb(sb))
+		return 1;
+
+	spin_lock(&inode_lock);
+	if (!list_empty(&sb->s_io))
+		head = &sb->s_io;
+	else if (!list_empty(&sb->s_more_io))
+		head = &sb->s_more_io;
+	else if (!list_empty(&sb->s_dirty))
+		head = &sb->s_dirty;
+	if (head) {
+		struct inode *inode = list_entry(head->prev,
+						struct inode, i_list);
+
+		ret = inode->i_mapping->backing_dev_info == bdi;
+	}
+	spin_unlock(&inode_lock);
+	return ret;
+}
+
+/**
+ * bdi_has_dirty_io - does a device have anything for its flusher thread?
+ * @bdi: the device's backing_dev_info structure.
+ *
+ * Dirty pages are counted in BDI_RECLAIMABLE, but inodes dirtied without
+ * dirty pages (touch, chmod, ...) are only on their superblock's lists,
+ * and they need the periodic writeback just the same.  Blockdev inodes
+ * are only dirtied along with their pages, so the blockdev superblock
+ * is not looked at.  Process context only.
+ */
+int bdi_has_dirty_io(struct backing_dev_info *bdi)
+{
+	struct super_block *sb;
+	int ret = 0;
+
+	if (bdi_stat(bdi, BDI_RECLAIMABLE))
+		return 1;
+
+	spin_lock(&sb_lock);
+	list_for_each_entry(sb, &super_blocks, s_list) {
+		if (sb_is_blkdev_sb(sb) || !sb_has_dirty_inodes(sb))
+			continue;
+		if (sb_on_bdi(sb, bdi)) {
+			ret = 1;
+			break;
+		}
+	}
+	spin_unlock(&sb_lock);
+	return ret;
+}
+
 /*
  * Start writeback of dirty pagecache data against all unlocked inodes.
  *
@@ -583,11 +626,10 @@ static void sync_sb_inodes(struct super_block *sb,
  * If `older_than_this' is non-zero then only flush inodes which have a
  * flushtime older than *older_than_this.
  *
- * If `bdi' is non-zero then we will scan the first inode against each
- * superblock until we find the matching ones.  One group will be the dirty
- * inodes against a filesystem.  Then when we hit the dummy blockdev superblock,
- * sync_sb_inodes will seekout the blockdev which matches `bdi'.  Maybe not
- * super-efficient but we're about to do a ton of I/O...
+ * If `bdi' is non-zero then we will look at one dirty inode of each
+ * superblock to skip those written back to other queues, which would only
+ * stall us.  Then when we hit the dummy blockdev superblock, sync_sb_inodes
+ * will seekout the blockdev which matches `bdi'.
  */
 void
 writeback_inodes(struct writeback_control *wbc)
@@ -607,7 +649,8 @@ restart:
 			 * waiting around, most of the time the FS is going to
 			 * be unmounted by the time it is released.
 			 */
-			if (down_read_trylock(&sb->s_umount)) {
+			if (sb_on_bdi(sb, wbc->bdi) &&
+			    down_read_trylock(&sb->s_umount)) {
 				if (sb->s_root)
 					sync_sb_inodes(sb, wbc);
 				up_read(&sb->s_umount);
@@ -622,6 +665,248 @@ restart:
 	spin_unlock(&sb_lock);
 }
 
+static int over_bground_thresh(void)
+{
+	unsigned long background_thresh, dirty_thresh;
+
+	get_dirty_limits(&background_thresh, &dirty_thresh, NULL, NULL);
+
+	return global_page_state(NR_FILE_DIRTY) +
+		global_page_state(NR_UNSTABLE_NFS) >= background_thresh;
+}
+
+/*
+ * Write back at least `nr_pages' pages of the dirty inodes against the queue
+ * of `wb'.  If `background' is set, keep writing until the dirty memory of the
+ * system is below the background threshold.  If `older_than_this' is non-NULL,
+ * only flush inodes dirtied before that: this is the periodic writeback.
+ *
+ * Unlike pdflush, we do not skip a congested queue.  Nobody else writes to it
+ * from here, so blocking on it only holds up this device's writeback, and it
+ * keeps the stream of requests to the device sequential.
+ */
+static long wb_writeback(struct bdi_writeback *wb, long nr_pages,
+			 int background, unsigned long *older_than_this)
+{
+	struct writeback_control wbc = {
+		.bdi		= wb->bdi,
+		.sync_mode	= WB_SYNC_NONE,
+		.older_than_this = older_than_this,
+		.for_kupdate	= older_than_this != NULL,
+		.range_cyclic	= 1,
+	};
+	long wrote = 0;
+
+	for (;;) {
+		if (nr_pages <= 0 && !(background && over_bground_thresh()))
+			break;
+
+		wbc.more_io = 0;
+		wbc.encountered_congestion = 0;
+		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
+		wbc.pages_skipped = 0;
+		writeback_inodes(&wbc);
+		nr_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
+		wrote += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
+
+		if (wbc.nr_to_write > 0 || wbc.pages_skipped > 0) {
+			/* Wrote less than expected */
+			if (wbc.more_io)
+				congestion_wait(WRITE, HZ/10);
+			else
+				break;	/* All the data is written */
+		}
+	}
+
+	return wrote;
+}
+
+/*
+ * Periodic writeback of "old" data.
+ *
+ * Define "old": the first time one of an inode's pages is dirtied, we mark the
+ * dirtying-time in the inode's address_space.  So this periodic writeback code
+ * just walks the superblock inode lists, writing back any inodes which are
+ * older than a specific point in time.
+ *
+ * Run once per dirty_writeback_interval.  older_than_this takes precedence
+ * over nr_to_write, so we'll only write back all dirty pages if they are all
+ * attached to "old" mappings.
+ */
+static long wb_check_old_data_flush(struct bdi_writeback *wb)
+{
+	unsigned long oldest_jif;
+	long nr_pages;
+
+	if (!dirty_writeback_interval ||
+	    time_before(jiffies, wb->last_old_flush + dirty_writeback_interval))
+		return 0;
+
+	wb->last_old_flush = jiffies;
+	oldest_jif = jiffies - dirty_expire_interval;
+	nr_pages = global_page_state(NR_FILE_DIRTY) +
+			global_page_state(NR_UNSTABLE_NFS) +
+			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+
+	return wb_writeback(wb, nr_pages, 0, &oldest_jif);
+}
+
+/**
+ * wb_do_writeback - do the writeback queued for a flusher thread
+ * @wb: the flusher state of the device
+ *
+ * Do the work asked for by bdi_start_writeback() since the last call, then
+ * the periodic writeback if it is due.  Returns the number of pages written.
+ */
+long wb_do_writeback(struct bdi_writeback *wb)
+{
+	struct backing_dev_info *bdi = wb->bdi;
+	long nr_pages, wrote = 0;
+	int background;
+
+	set_bit(BDI_writeback_running, &bdi->state);
+
+	spin_lock_bh(&bdi_lock);
+	nr_pages = wb->nr_pages;
+	background = wb->background;
+	wb->nr_pages = 0;
+	wb->background = 0;
+	spin_unlock_bh(&bdi_lock);
+
+	if (nr_pages || background)
+		wrote += wb_writeback(wb, nr_pages, background, NULL);
+
+	wrote += wb_check_old_data_flush(wb);
+
+	clear_bit(BDI_writeback_running, &bdi->state);
+	return wrote;
+}
+
+static inline int wb_has_work(struct bdi_writeback *wb)
+{
+	return wb->nr_pages || wb->background;
+}
+
+/**
+ * bdi_writeback_thread - the flusher thread of a backing device
+ * @data: the &struct bdi_writeback of the device
+ *
+ * Forked by bdi-default when the device has writeback to do.  Exits when it
+ * has been idle for BDI_MAX_IDLE, unless bdi_unregister() is stopping it.
+ */
+int bdi_writeback_thread(void *data)
+{
+	struct bdi_writeback *wb = data;
+
+	current->flags |= PF_FLUSHER | PF_SWAPWRITE;
+	set_freezable();
+
+	/*
+	 * We can spend a lot of time doing encryption via dm-crypt.  Don't do
+	 * that at our parent's priority.
+	 */
+	set_user_nice(current, 0);
+
+	wb->last_active = jiffies;
+
+	while (!kthread_should_stop()) {
+		if (wb_do_writeback(wb) || bdi_has_dirty_io(wb->bdi))
+			wb->last_active = jiffies;
+		else if (time_after(jiffies, wb->last_active + BDI_MAX_IDLE)) {
+			int idle;
+
+			spin_lock_bh(&bdi_lock);
+			idle = wb->task == current && !wb_has_work(wb);
+			if (idle)
+				wb->task = NULL;
+			spin_unlock_bh(&bdi_lock);
+			if (idle)
+				break;
+		}
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (wb_has_work(wb) || kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+		if (dirty_writeback_interval)
+			schedule_timeout(dirty_writeback_interval);
+		else
+			schedule();
+		try_to_freeze();
+	}
+
+	return 0;
+}
+
+/*
+ * Queue `nr_pages' pages of writeback, or background writeback if zero, for
+ * the flusher thread of `bdi', and wake it up.  If it has no thread, wake up
+ * bdi-default to fork one.  Called under bdi_lock.
+ */
+static void __bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
+{
+	struct bdi_writeback *wb = &bdi->wb;
+	struct task_struct *task;
+
+	if (nr_pages)
+		wb->nr_pages += nr_pages;
+	else
+		wb->background = 1;
+
+	task = wb->task;
+	if (!task && !list_empty(&bdi->bdi_list))
+		task = default_backing_dev_info.wb.task;
+	if (task)
+		wake_up_process(task);
+}
+
+/**
+ * bdi_start_writeback - start writeback against a backing device
+ * @bdi: the device to write back
+ * @nr_pages: pages to write, or zero to write down to the background threshold
+ *
+ * Hand the writeback to the flusher thread of @bdi and return.  May be called
+ * from atomic context.
+ */
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
+{
+	if (!bdi_cap_writeback_dirty(bdi))
+		return;
+
+	spin_lock_bh(&bdi_lock);
+	__bdi_start_writeback(bdi, nr_pages);
+	spin_unlock_bh(&bdi_lock);
+}
+
+/**
+ * wakeup_flusher_threads - start writeback against every device
+ * @nr_pages: pages to write on each device, or zero for all dirty pages
+ *
+ * Kick the flusher thread of each device which has dirty pages, so that all
+ * queues are written back in parallel.  May be called from atomic context,
+ * even from the laptop mode timer, so only the page counts are looked at:
+ * bdi_has_dirty_io() takes sb_lock and inode_lock.
+ */
+void wakeup_flusher_threads(long nr_pages)
+{
+	struct backing_dev_info *bdi;
+
+	if (nr_pages == 0)
+		nr_pages = global_page_state(NR_FILE_DIRTY) +
+				global_page_state(NR_UNSTABLE_NFS);
+	if (nr_pages <= 0)
+		return;
+
+	spin_lock_bh(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (bdi_cap_writeback_dirty(bdi) &&
+		    bdi_stat(bdi, BDI_RECLAIMABLE))
+			__bdi_start_writeback(bdi, nr_pages);
+	}
+	spin_unlock_bh(&bdi_lock);
+}
+
 /*
  * writeback and wait upon the filesystem's dirty inodes.  The caller will
  * do this in two passes - one to write, and one to wait.
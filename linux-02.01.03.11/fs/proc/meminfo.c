@@ -1,4 +1,5 @@
 #include <linux/fs.h>
+#include <linux/huge_mm.h>
 #include <linux/hugetlb.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
@@ -82,6 +83,9 @@ static int meminfo_proc_show(struct seq_file *m, void *v)
 		"Dirty:          %8lu kB\n"
 		"Writeback:      %8lu kB\n"
 		"AnonPages:      %8lu kB\n"
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		"AnonHugePages:  %8lu kB\n"
+#endif
 		"Mapped:         %8lu kB\n"
 		"Slab:           %8lu kB\n"
 		"SReclaimable:   %8lu kB\n"
@@ -127,6 +131,10 @@ static int meminfo_proc_show(struct seq_file *m, void *v)
 		K(global_page_state(NR_FILE_DIRTY)),
 		K(global_page_state(NR_WRITEBACK)),
 		K(global_page_state(NR_ANON_PAGES)),
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		K(global_page_state(NR_ANON_TRANSPARENT_HUGEPAGES) *
+				HPAGE_PMD_NR),
+#endif
 		K(global_page_state(NR_FILE_MAPPED)),
 		K(global_page_state(NR_SLAB_RECLAIMABLE) +
 				global_page_state(NR_SLAB_UNRECLAIMABLE)),
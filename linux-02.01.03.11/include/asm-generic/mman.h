@@ -35,6 +35,12 @@
 #define MADV_DONTFORK	10		/* don't inherit across fork */
 #define MADV_DOFORK	11		/* do inherit across fork */
 
+#define MADV_MERGEABLE   12		/* KSM may merge identical pages */
+#define MADV_UNMERGEABLE 13		/* KSM may not merge identical pages */
+
+#define MADV_HUGEPAGE	14		/* Worth backing with huge pages */
+#define MADV_NOHUGEPAGE	15		/* Not worth backing with huge pages */
+
 /* compatibility flags */
 #define MAP_FILE	0
 
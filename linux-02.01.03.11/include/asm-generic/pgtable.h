@@ -158,10 +158,22 @@ static inline void ptep_set_wrprotect(struct mm_struct *mm, unsigned long addres
 })
 #endif
 
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return 0;
+}
+#endif
+
 /*
  * When walking page tables, we usually want to skip any p?d_none entries;
  * and any p?d_bad entries - reporting the error before resetting to none.
  * Do the tests inline, but report and clear the bad entry in mm/memory.c.
+ *
+ * A transparent huge pmd looks bad, but is skipped without being cleared:
+ * walkers split it first if they care, so one found here has just been
+ * faulted in by a racing thread under mmap_sem held for reading, and
+ * can be treated like the none pmd it was a moment ago.
  */
 void pgd_clear_bad(pgd_t *);
 void pud_clear_bad(pud_t *);
@@ -194,6 +206,8 @@ static inline int pmd_none_or_clear_bad(pmd_t *pmd)
 	if (pmd_none(*pmd))
 		return 1;
 	if (unlikely(pmd_bad(*pmd))) {
+		if (pmd_trans_huge(*pmd))
+			return 1;
 		pmd_clear_bad(pmd);
 		return 1;
 	}
@@ -13,17 +13,20 @@
 #include <linux/proportions.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
 #include <asm/atomic.h>
 
 struct page;
 struct device;
 struct dentry;
+struct task_struct;
 
 /*
  * Bits in backing_dev_info.state
  */
 enum bdi_state {
-	BDI_pdflush,		/* A pdflush thread is working this device */
+	BDI_writeback_running,	/* The flusher thread is writing back */
 	BDI_write_congested,	/* The write queue is getting full */
 	BDI_read_congested,	/* The read queue is getting full */
 	BDI_unused,		/* Available bits start here */
@@ -39,6 +42,23 @@ enum bdi_stat_item {
 
 #define BDI_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 
+/*
+ * State of the flusher thread of a backing device.  The thread is forked
+ * on demand by the "bdi-default" thread and exits again when it has been
+ * idle for a while.  ->task, ->nr_pages and ->background are protected
+ * by bdi_lock.
+ */
+struct bdi_writeback {
+	struct backing_dev_info *bdi;	/* our parent bdi */
+	struct task_struct *task;	/* flusher thread, or NULL */
+
+	unsigned long last_old_flush;	/* last periodic writeback */
+	unsigned long last_active;	/* last time there was work to do */
+
+	long nr_pages;			/* pages asked to be written */
+	int background;			/* write down to background_thresh */
+};
+
 struct backing_dev_info {
 	unsigned long ra_pages;	/* max readahead in PAGE_CACHE_SIZE units */
 	unsigned long state;	/* Always use atomic bitops on this */
@@ -58,6 +78,9 @@ struct backing_dev_info {
 
 	struct device *dev;
 
+	struct list_head bdi_list;	/* on bdi_list once registered */
+	struct bdi_writeback wb;
+
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debug_dir;
 	struct dentry *debug_stats;
@@ -71,6 +94,12 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 		const char *fmt, ...);
 int bdi_register_dev(struct backing_dev_info *bdi, dev_t dev);
 void bdi_unregister(struct backing_dev_info *bdi);
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages);
+int bdi_writeback_thread(void *data);
+long wb_do_writeback(struct bdi_writeback *wb);
+
+extern spinlock_t bdi_lock;
+extern struct list_head bdi_list;
 
 static inline void __add_bdi_stat(struct backing_dev_info *bdi,
 		enum bdi_stat_item item, s64 amount)
@@ -135,6 +164,8 @@ static inline s64 bdi_stat_sum(struct backing_dev_info *bdi,
 	return sum;
 }
 
+int bdi_has_dirty_io(struct backing_dev_info *bdi);
+
 extern void bdi_writeout_inc(struct backing_dev_info *bdi);
 
 /*
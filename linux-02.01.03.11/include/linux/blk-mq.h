@@ -0,0 +1,112 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+/*
+ * Multiqueue block layer: per-cpu software staging queues mapped onto
+ * one or more hardware dispatch contexts, for drivers which want to
+ * avoid the single q->queue_lock of the request_fn model.  See
+ * block/blk-mq.c.
+ */
+
+struct blk_mq_hw_ctx;
+
+/* per-cpu software staging queue */
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+	unsigned int		cpu;
+	struct blk_mq_hw_ctx	*hctx;
+	unsigned int		index_hw;	/* index in hctx->ctxs */
+} ____cacheline_aligned_in_smp;
+
+/* hardware dispatch context */
+struct blk_mq_hw_ctx {
+	struct list_head	dispatch;	/* requests the driver bounced */
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+
+	struct request_queue	*queue;
+	void			*driver_data;
+	unsigned int		queue_num;
+
+	/* software queues mapped here, and which of them have requests */
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;
+
+	/* preallocated requests, one per tag, and the tag bitmap */
+	unsigned int		queue_depth;
+	struct request		**rqs;
+	unsigned long		*tag_map;
+	wait_queue_head_t	wait;		/* for a free tag */
+
+	int			numa_node;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued fine */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue IO for later */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end IO with error */
+
+	BLK_MQ_F_SHOULD_MERGE	= 1 << 0,
+
+	BLK_MQ_S_STOPPED	= 0,
+	BLK_MQ_S_RUNNING	= 1,	/* serializes dispatch */
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+/*
+ * ->queue_rq() is called for one request at a time, serialized per
+ * hardware context, from the submitting task or from kblockd.  It may
+ * sleep to allocate memory with GFP_NOIO, like a make_request_fn.  @last
+ * is false if more requests follow at once, so that the driver may delay
+ * notifying the hardware.  A driver returning
+ * BLK_MQ_RQ_QUEUE_BUSY must stop the hardware queue and start it again
+ * when resources free up; it is then also responsible for notifying the
+ * hardware of the requests it accepted before.
+ */
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *, bool);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+
+struct blk_mq_ops {
+	queue_rq_fn		*queue_rq;
+	init_hctx_fn		*init_hctx;	/* optional */
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* per hardware queue */
+	unsigned int		cmd_size;	/* per-request driver data */
+	int			numa_node;
+	unsigned int		flags;		/* BLK_MQ_F_* */
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data);
+
+void blk_mq_end_io(struct request *rq, int error);
+
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
+void blk_mq_run_queues(struct request_queue *q, bool async);
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
+void blk_mq_start_stopped_hw_queues(struct request_queue *q);
+
+/*
+ * Driver command data is immediately after the request. So subtract
+ * request size to get back to the original request.
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *)(rq + 1);
+}
+
+static inline struct request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return (struct request *)pdu - 1;
+}
+
+#endif
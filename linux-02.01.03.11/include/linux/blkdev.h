@@ -30,6 +30,9 @@ struct request_pm_state;
 struct blk_trace;
 struct request;
 struct sg_io_hdr;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -148,6 +151,7 @@ struct request {
 	int cpu;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;	/* staging queue, for blk-mq */
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -353,6 +357,15 @@ struct request_queue
 	 */
 	void			*queuedata;
 
+	/*
+	 * multiqueue queues (blk_mq_init_queue()) only
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx	*queue_ctx;	/* per-cpu */
+	unsigned int		nr_hw_queues;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		mq_flags;
+
 	/*
 	 * queue needs bounce pages for pages above this limit
 	 */
@@ -780,6 +793,36 @@ extern void blk_execute_rq_nowait(struct request_queue *, struct gendisk *,
 				  struct request *, int, rq_end_io_fn *);
 extern void blk_unplug(struct request_queue *q);
 
+/*
+ * A task can hold back the requests it builds on a plug of its own, see
+ * blk_start_plug().  Bios merge into them without the queue lock, and they
+ * reach the queues in one lock hold per queue when the plug is finished or
+ * the task goes to sleep.
+ */
+struct blk_plug {
+	struct list_head list;	/* requests, by queue and then by sector */
+};
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug_list(struct blk_plug *, bool);
+
+/* for schedule(), before the task sleeps */
+static inline void blk_schedule_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug)
+		blk_flush_plug_list(plug, true);
+}
+
+static inline bool blk_needs_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	return plug && !list_empty(&plug->list);
+}
+
 static inline struct request_queue *bdev_get_queue(struct block_device *bdev)
 {
 	return bdev->bd_disk->queue;
@@ -1078,6 +1121,8 @@ struct block_device_operations {
 	int (*media_changed) (struct gendisk *);
 	int (*revalidate_disk) (struct gendisk *);
 	int (*getgeo)(struct block_device *, struct hd_geometry *);
+	/* this callback is with swap_lock and sometimes page table lock held */
+	void (*swap_slot_free_notify) (struct block_device *, unsigned long);
 	struct module *owner;
 };
 
@@ -1094,6 +1139,28 @@ static inline long nr_blockdev_pages(void)
 	return 0;
 }
 
+struct task_struct;
+
+struct blk_plug {
+};
+
+static inline void blk_start_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_finish_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_schedule_flush_plug(struct task_struct *tsk)
+{
+}
+
+static inline bool blk_needs_flush_plug(struct task_struct *tsk)
+{
+	return false;
+}
+
 #endif /* CONFIG_BLOCK */
 
 #endif
@@ -0,0 +1,126 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+/*
+ * Transparent huge pages for anonymous memory.
+ *
+ * An aligned 2MB range of an anonymous vma may be mapped by a single
+ * pmd pointing to a compound page, instead of a page table of ptes:
+ * see mm/huge_memory.c.
+ */
+
+#include <linux/mm.h>
+
+struct mmu_gather;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define HPAGE_PMD_SHIFT		PMD_SHIFT
+#define HPAGE_PMD_SIZE		(1UL << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK		(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER		(HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR		(1 << HPAGE_PMD_ORDER)
+
+enum transparent_hugepage_flag {
+	TRANSPARENT_HUGEPAGE_FLAG,		/* "always" */
+	TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,	/* "madvise" */
+};
+
+extern unsigned long transparent_hugepage_flags;
+
+/*
+ * Whether a fault at @address in @vma may be served by a huge page:
+ * the vma must be private anonymous memory, not opted out, and cover
+ * the whole aligned huge page range around @address.
+ */
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma,
+					       unsigned long address)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags)) {
+		if (vma->vm_flags & VM_NOHUGEPAGE)
+			return 0;
+	} else if (!test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			     &transparent_hugepage_flags) ||
+		   !(vma->vm_flags & VM_HUGEPAGE))
+		return 0;
+
+	if (vma->vm_file || vma->vm_ops ||
+	    (vma->vm_flags & (VM_SHARED | VM_HUGETLB | VM_IO | VM_PFNMAP)))
+		return 0;
+	return haddr >= vma->vm_start && haddr + HPAGE_PMD_SIZE <= vma->vm_end;
+}
+
+extern int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+				      struct vm_area_struct *vma,
+				      unsigned long address, pmd_t *pmd);
+extern int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+			pmd_t *pmd);
+extern void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd,
+				  unsigned long address);
+extern void __vma_adjust_trans_huge(struct vm_area_struct *vma,
+				    unsigned long start, unsigned long end,
+				    long adjust_next);
+extern int hugepage_madvise(struct vm_area_struct *vma,
+			    unsigned long *vm_flags, int advice);
+
+/*
+ * Anything which needs to see the individual ptes of a range, or to
+ * change part of it, splits a huge pmd into a page table first.
+ */
+#define split_huge_page_pmd(__mm, __pmd, __address)			\
+	do {								\
+		if (unlikely(pmd_trans_huge(*(__pmd))))			\
+			__split_huge_page_pmd(__mm, __pmd, __address);	\
+	} while (0)
+
+/*
+ * Called by vma_adjust() before the vma boundaries move, so that no
+ * huge pmd ends up straddling two vmas.
+ */
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+	__vma_adjust_trans_huge(vma, start, end, adjust_next);
+}
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+#define HPAGE_PMD_SIZE ({ BUG(); 0; })
+
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma,
+					       unsigned long address)
+{
+	return 0;
+}
+
+static inline int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address, pmd_t *pmd)
+{
+	return VM_FAULT_FALLBACK;
+}
+
+static inline int zap_huge_pmd(struct mmu_gather *tlb,
+			       struct vm_area_struct *vma, pmd_t *pmd)
+{
+	return 0;
+}
+
+#define split_huge_page_pmd(__mm, __pmd, __address)	do { } while (0)
+#define __split_huge_page_pmd(__mm, __pmd, __address)	do { } while (0)
+
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+}
+
+static inline int hugepage_madvise(struct vm_area_struct *vma,
+				   unsigned long *vm_flags, int advice)
+{
+	BUG();
+	return 0;
+}
+#endif /* !CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
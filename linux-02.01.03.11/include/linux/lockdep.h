@@ -153,6 +153,8 @@ struct lock_class_stats {
 	struct lock_time		read_holdtime;
 	struct lock_time		write_holdtime;
 	unsigned long			bounces[nr_bounce_types];
+	unsigned long			spin_acquired;
+	unsigned long			spin_slept;
 };
 
 struct lock_class_stats lock_stats(struct lock_class *class);
@@ -370,6 +372,7 @@ struct lock_class_key { };
 
 extern void lock_contended(struct lockdep_map *lock, unsigned long ip);
 extern void lock_acquired(struct lockdep_map *lock, unsigned long ip);
+extern void lock_spun(struct lockdep_map *lock, int acquired);
 
 #define LOCK_CONTENDED(_lock, try, lock)			\
 do {								\
@@ -384,6 +387,7 @@ do {								\
 
 #define lock_contended(lockdep_map, ip) do {} while (0)
 #define lock_acquired(lockdep_map, ip) do {} while (0)
+#define lock_spun(lockdep_map, acquired) do {} while (0)
 
 #define LOCK_CONTENDED(_lock, try, lock) \
 	lock(_lock)
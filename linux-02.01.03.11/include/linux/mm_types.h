@@ -20,6 +20,7 @@
 #define AT_VECTOR_SIZE (2*(AT_VECTOR_SIZE_ARCH + AT_VECTOR_SIZE_BASE + 1))
 
 struct address_space;
+struct futex_hash;
 
 #define USE_SPLIT_PTLOCKS	(NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS)
 
@@ -274,6 +275,18 @@ struct mm_struct {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier_mm *mmu_notifier_mm;
 #endif
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	/*
+	 * Set when reclaim has cleared a pte of this mm but deferred the
+	 * TLB flush, see mm/rmap.c: anyone else who then finds the pte
+	 * none must flush before relying on it being gone from the TLBs.
+	 */
+	int tlb_flush_batched;
+#endif
+#ifdef CONFIG_FUTEX
+	/* hash table of the private futexes, see kernel/futex.c */
+	struct futex_hash *futex_hash;
+#endif
 };
 
 #endif /* _LINUX_MM_TYPES_H */
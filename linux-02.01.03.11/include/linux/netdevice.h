@@ -185,6 +185,7 @@ struct netif_rx_stats
 	unsigned dropped;
 	unsigned time_squeeze;
 	unsigned cpu_collision;
+	unsigned received_rps;
 };
 
 DECLARE_PER_CPU(struct netif_rx_stats, netdev_rx_stat);
@@ -434,6 +435,19 @@ enum netdev_queue_state_t
 	__QUEUE_STATE_FROZEN,
 };
 
+#ifdef CONFIG_RPS
+/*
+ * Receive packet steering map: the CPUs packets received on a device
+ * are spread across, indexed by flow hash.  Replaced under RCU.
+ */
+struct rps_map {
+	unsigned int		len;
+	struct rcu_head		rcu;
+	u16			cpus[0];
+};
+#define RPS_MAP_SIZE(_num) (sizeof(struct rps_map) + (_num * sizeof(u16)))
+#endif
+
 struct netdev_queue {
 	struct net_device	*dev;
 	struct Qdisc		*qdisc;
@@ -760,6 +774,11 @@ struct net_device
 
 	struct netdev_queue	rx_queue;
 
+#ifdef CONFIG_RPS
+	/* CPUs received packets are steered to, see get_rps_cpu() */
+	struct rps_map		*rps_map;
+#endif
+
 	struct netdev_queue	*_tx ____cacheline_aligned_in_smp;
 
 	/* Number of TX queues allocated at alloc_netdev_mq() time  */
@@ -1127,6 +1146,15 @@ struct softnet_data
 	struct list_head	poll_list;
 	struct sk_buff		*completion_queue;
 
+#ifdef CONFIG_RPS
+	/* remote backlogs to kick once this cpu's net_rx_action() is done */
+	struct softnet_data	*rps_ipi_list;
+
+	/* elements below can be accessed between CPUs for RPS */
+	struct call_single_data	csd ____cacheline_aligned_in_smp;
+	struct softnet_data	*rps_ipi_next;
+	unsigned int		cpu;
+#endif
 	struct napi_struct	backlog;
 };
 
@@ -65,6 +65,40 @@
 
 #ifdef CONFIG_SMP
 
+#ifdef CONFIG_HAVE_DYNAMIC_PER_CPU_AREA
+
+/*
+ * Room left in the first chunk, after the static area and the module
+ * reserve, for dynamic allocations: small users are served from there
+ * without creating any chunk.
+ */
+#if BITS_PER_LONG > 32
+#define PERCPU_DYNAMIC_RESERVE		(20 << 10)
+#else
+#define PERCPU_DYNAMIC_RESERVE		(12 << 10)
+#endif
+
+extern void *pcpu_base_addr;
+
+extern void __init pcpu_setup_first_chunk(void *base_addr, size_t static_size,
+					  size_t reserved_size,
+					  size_t unit_size);
+
+/*
+ * Use this to get to a cpu's version of the per-cpu object dynamically
+ * allocated.  Dynamic areas are laid out like the static ones, so this
+ * is the same base plus per-cpu offset as for per_cpu().  Non-atomic
+ * access to the current CPU's version should probably be combined with
+ * get_cpu()/put_cpu().
+ */
+#define per_cpu_ptr(ptr, cpu)	SHIFT_PERCPU_PTR((ptr), per_cpu_offset((cpu)))
+
+extern void *__alloc_percpu(size_t size, size_t align);
+extern void free_percpu(void *__pdata);
+extern phys_addr_t per_cpu_ptr_to_phys(void *addr);
+
+#else /* CONFIG_HAVE_DYNAMIC_PER_CPU_AREA */
+
 struct percpu_data {
 	void *ptrs[1];
 };
@@ -75,7 +109,7 @@ struct percpu_data {
  * allocated. Non-atomic access to the current CPU's version should
  * probably be combined with get_cpu()/put_cpu().
  */ 
-#define percpu_ptr(ptr, cpu)                              \
+#define per_cpu_ptr(ptr, cpu)                             \
 ({                                                        \
         struct percpu_data *__p = __percpu_disguise(ptr); \
         (__typeof__(ptr))__p->ptrs[(cpu)];	          \
@@ -84,9 +118,14 @@ struct percpu_data {
 extern void *__percpu_alloc_mask(size_t size, gfp_t gfp, cpumask_t *mask);
 extern void percpu_free(void *__pdata);
 
+#define per_cpu_ptr_to_phys(addr)	__pa(addr)
+
+#endif /* CONFIG_HAVE_DYNAMIC_PER_CPU_AREA */
+
 #else /* CONFIG_SMP */
 
-#define percpu_ptr(ptr, cpu) ({ (void)(cpu); (ptr); })
+#define per_cpu_ptr(ptr, cpu) ({ (void)(cpu); (ptr); })
+#define per_cpu_ptr_to_phys(addr)	__pa(addr)
 
 static __always_inline void *__percpu_alloc_mask(size_t size, gfp_t gfp, cpumask_t *mask)
 {
@@ -100,6 +139,8 @@ static inline void percpu_free(void *__pdata)
 
 #endif /* CONFIG_SMP */
 
+#if !defined(CONFIG_SMP) || !defined(CONFIG_HAVE_DYNAMIC_PER_CPU_AREA)
+
 #define percpu_alloc_mask(size, gfp, mask) \
 	__percpu_alloc_mask((size), (gfp), &(mask))
 
@@ -107,10 +148,14 @@ static inline void percpu_free(void *__pdata)
 
 /* (legacy) interface for use without CPU hotplug handling */
 
-#define __alloc_percpu(size)	percpu_alloc_mask((size), GFP_KERNEL, \
-						  cpu_possible_map)
-#define alloc_percpu(type)	(type *)__alloc_percpu(sizeof(type))
+#define __alloc_percpu(size, align)	percpu_alloc_mask((size), GFP_KERNEL, \
+							  cpu_possible_map)
 #define free_percpu(ptr)	percpu_free((ptr))
-#define per_cpu_ptr(ptr, cpu)	percpu_ptr((ptr), (cpu))
+
+#endif
+
+#define alloc_percpu(type)	(type *)__alloc_percpu(sizeof(type), \
+						       __alignof__(type))
+#define percpu_ptr(ptr, cpu)	per_cpu_ptr((ptr), (cpu))
 
 #endif /* __LINUX_PERCPU_H */
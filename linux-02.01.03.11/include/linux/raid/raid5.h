@@ -206,6 +206,7 @@ struct stripe_head {
 	spinlock_t		lock;
 	int			bm_seq;	/* sequence number for bitmap flushes */
 	int			disks;			/* disks in stripe */
+	int			cpu;	/* whose stripe worker handles it */
 	enum check_states	check_state;
 	enum reconstruct_states reconstruct_state;
 	/* stripe_operations
@@ -372,6 +373,9 @@ struct raid5_private_data {
 
 	struct page 		*spare_page; /* Used when checking P/Q in raid6 */
 
+	/* per cpu, NULL when raid5d handles all the stripes */
+	struct r5worker_group	*worker_groups;
+
 	/*
 	 * Free stripes pool
 	 */
@@ -389,6 +393,17 @@ struct raid5_private_data {
 
 typedef struct raid5_private_data raid5_conf_t;
 
+/*
+ * A cpu's stripe worker, when stripe_workers is enabled: it handles the
+ * stripes queued on that cpu, in parallel with the other cpus.
+ */
+struct r5worker_group {
+	struct list_head	handle_list; /* stripes to handle on this cpu */
+	struct work_struct	work;
+	raid5_conf_t		*conf;
+	struct page		*spare_page; /* Used when checking P/Q in raid6 */
+};
+
 #define mddev_to_conf(mddev) ((raid5_conf_t *) mddev->private)
 
 /*
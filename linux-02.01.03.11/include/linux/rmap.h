@@ -37,6 +37,16 @@ struct anon_vma {
 	struct list_head head;	/* List of private "related" vmas */
 };
 
+/* Flags for try_to_unmap() */
+enum ttu_flags {
+	TTU_UNMAP = 0,			/* unmap mode */
+	TTU_MIGRATION = 1,		/* migration mode */
+
+	TTU_ACTION_MASK = 0xff,
+	TTU_BATCH_FLUSH = (1 << 8),	/* batch TLB flushes where possible */
+};
+#define TTU_ACTION(x) ((x) & TTU_ACTION_MASK)
+
 #ifdef CONFIG_MMU
 
 static inline void anon_vma_lock(struct vm_area_struct *vma)
@@ -80,11 +90,18 @@ static inline void page_dup_rmap(struct page *page, struct vm_area_struct *vma,
 }
 #endif
 
+/*
+ * Lock the anon_vma of a mapped anonymous page, or return NULL
+ */
+struct anon_vma *page_lock_anon_vma(struct page *page);
+void page_unlock_anon_vma(struct anon_vma *anon_vma);
+
 /*
  * Called from mm/vmscan.c to handle paging out
  */
 int page_referenced(struct page *, int is_locked, struct mem_cgroup *cnt);
-int try_to_unmap(struct page *, int ignore_refs);
+
+int try_to_unmap(struct page *, enum ttu_flags flags);
 
 /*
  * Called from mm/filemap_xip.c to unmap empty zero page
@@ -96,7 +96,9 @@ struct exec_domain;
 struct futex_pi_state;
 struct robust_list_head;
 struct bio;
+struct blk_plug;
 struct bts_tracer;
+struct worker;
 
 /*
  * List of flags we want to share for kernel threads,
@@ -400,6 +402,7 @@ extern int get_dumpable(struct mm_struct *mm);
 #define MMF_DUMPABLE      0  /* core dump is permitted */
 #define MMF_DUMP_SECURELY 1  /* core file is readable only by root */
 #define MMF_DUMPABLE_BITS 2
+#define MMF_DUMPABLE_MASK ((1 << MMF_DUMPABLE_BITS) - 1)
 
 /* coredump filter bits */
 #define MMF_DUMP_ANON_PRIVATE	2
@@ -422,6 +425,10 @@ extern int get_dumpable(struct mm_struct *mm);
 #else
 # define MMF_DUMP_MASK_DEFAULT_ELF	0
 #endif
+					/* leave room for more dump flags */
+#define MMF_VM_MERGEABLE	16	/* KSM may merge identical pages */
+
+#define MMF_INIT_MASK		(MMF_DUMPABLE_MASK | MMF_DUMP_FILTER_MASK)
 
 struct sighand_struct {
 	atomic_t		count;
@@ -1094,6 +1101,22 @@ struct sched_rt_entity {
 #endif
 };
 
+/* TLB flushes pending for pages unmapped by reclaim, see mm/rmap.c */
+struct tlbflush_unmap_batch {
+	/* CPUs which may hold a TLB entry for one of the unmapped pages */
+	cpumask_t cpumask;
+
+	/* Set if any bit in cpumask is set */
+	int flush_required;
+
+	/*
+	 * Set if one of the ptes was dirty: the TLBs must then be flushed
+	 * before I/O is started on the pages, or a stale entry could
+	 * still modify one without redirtying it.
+	 */
+	int writable;
+};
+
 struct task_struct {
 	volatile long state;	/* -1 unrunnable, 0 runnable, >0 stopped */
 	void *stack;
@@ -1316,11 +1339,22 @@ struct task_struct {
 /* journalling filesystem info */
 	void *journal_info;
 
+/* workqueue worker info, valid if PF_WQ_WORKER is set */
+	struct worker *wq_worker;
+
 /* stacked block device info */
 	struct bio *bio_list, **bio_tail;
 
+#ifdef CONFIG_BLOCK
+/* stack plugging */
+	struct blk_plug *plug;
+#endif
+
 /* VM state */
 	struct reclaim_state *reclaim_state;
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+	struct tlbflush_unmap_batch tlb_ubc;
+#endif
 
 	struct backing_dev_info *backing_dev_info;
 
@@ -1587,6 +1621,7 @@ extern cputime_t task_gtime(struct task_struct *p);
 #define PF_EXITING	0x00000004	/* getting shut down */
 #define PF_EXITPIDONE	0x00000008	/* pi exit done on shut down */
 #define PF_VCPU		0x00000010	/* I'm a virtual CPU */
+#define PF_WQ_WORKER	0x00000020	/* I'm a workqueue worker */
 #define PF_FORKNOEXEC	0x00000040	/* forked but didn't exec */
 #define PF_SUPERPRIV	0x00000100	/* used super-user privileges */
 #define PF_DUMPCORE	0x00000200	/* dumped core */
@@ -1746,6 +1781,10 @@ static inline int rt_mutex_getprio(struct task_struct *p)
 # define rt_mutex_adjust_pi(p)		do { } while (0)
 #endif
 
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+extern int mutex_spin_on_owner(struct mutex *lock, struct thread_info *owner);
+#endif
+
 extern void set_user_nice(struct task_struct *p, long nice);
 extern int task_prio(const struct task_struct *p);
 extern int task_nice(const struct task_struct *p);
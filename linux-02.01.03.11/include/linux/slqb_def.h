@@ -0,0 +1,194 @@
+#ifndef _LINUX_SLQB_DEF_H
+#define _LINUX_SLQB_DEF_H
+
+/*
+ * SLQB : A slab allocator with per cpu object queues.
+ *
+ * Every cpu keeps a LIFO queue of free objects for each cache, and owns
+ * the slabs those objects come from.  Allocating and freeing on the
+ * owning cpu only touches that queue, with interrupts disabled and
+ * without taking any lock.  Objects freed on another cpu are gathered
+ * on the freeing cpu and handed back to the owner in batches.
+ */
+#include <linux/types.h>
+#include <linux/gfp.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/cache.h>
+
+/*
+ * Objects freed to a kmem_cache_list by other cpus.  They are appended
+ * in batches under the lock and taken back by the owner all at once.
+ */
+struct kmlist_remote_free {
+	spinlock_t lock;
+	void **head;
+	void **tail;
+	unsigned long nr;
+};
+
+/*
+ * The objects and slabs owned by one cpu.  Everything but remote_free
+ * is only ever touched by the owning cpu with interrupts disabled.
+ */
+struct kmem_cache_list {
+	void **freelist;		/* LIFO queue of free objects */
+	unsigned long freelist_nr;	/* Number of objects on the queue */
+	struct list_head partial;	/* Slabs with free objects */
+	unsigned long nr_partial;
+	unsigned long nr_slabs;		/* Slabs owned by this list */
+	unsigned long nr_objects;	/* Objects in those slabs */
+	unsigned long nr_free;		/* Free objects left in the slabs */
+	struct kmem_cache *cache;
+
+	/* Written by other cpus, keep it away from the fields above */
+	int remote_free_check ____cacheline_aligned_in_smp;
+	struct kmlist_remote_free remote_free;
+};
+
+struct kmem_cache_cpu {
+	struct kmem_cache_list list;	/* The objects of this cpu */
+
+	/*
+	 * Objects freed on this cpu that belong to another list, all to the
+	 * same one, waiting to be handed back to it.
+	 */
+	struct kmem_cache_list *rlist_target;
+	void **rhead;
+	void **rtail;
+	unsigned long rnr;
+} ____cacheline_aligned;
+
+/*
+ * Slab cache management.
+ */
+struct kmem_cache {
+	unsigned long flags;
+	int batch;		/* Objects moved between queue and slabs */
+	int hiwater;		/* Queue length that triggers a flush */
+	int freebatch;		/* Remote frees gathered before handing back */
+	int size;		/* The size of an object including meta data */
+	int objsize;		/* The size of an object without meta data */
+	int offset;		/* Free pointer offset. */
+	int order;		/* Preferred page order of a slab */
+	int min_order;		/* Fallback order if that one fails */
+	gfp_t allocflags;	/* gfp flags to use on each alloc */
+	void (*ctor)(void *);
+	int align;		/* Alignment */
+	const char *name;	/* Name (only for display!) */
+	struct list_head list;	/* List of slab caches */
+#ifdef CONFIG_SMP
+	struct kmem_cache_cpu *cpu_slab[NR_CPUS];
+#else
+	struct kmem_cache_cpu cpu_slab;
+#endif
+};
+
+/*
+ * Kmalloc subsystem.
+ */
+#if defined(ARCH_KMALLOC_MINALIGN) && ARCH_KMALLOC_MINALIGN > 8
+#define KMALLOC_MIN_SIZE ARCH_KMALLOC_MINALIGN
+#else
+#define KMALLOC_MIN_SIZE 8
+#endif
+
+#define KMALLOC_SHIFT_LOW ilog2(KMALLOC_MIN_SIZE)
+
+/*
+ * We keep the general caches in an array of slab caches that are used for
+ * 2^x bytes of allocations.
+ */
+extern struct kmem_cache kmalloc_caches[PAGE_SHIFT + 1];
+
+/*
+ * Sorry that the following has to be that ugly but some versions of GCC
+ * have trouble with constant propagation and loops.
+ */
+static __always_inline int kmalloc_index(size_t size)
+{
+	if (!size)
+		return 0;
+
+	if (size <= KMALLOC_MIN_SIZE)
+		return KMALLOC_SHIFT_LOW;
+
+#if KMALLOC_MIN_SIZE <= 64
+	if (size > 64 && size <= 96)
+		return 1;
+	if (size > 128 && size <= 192)
+		return 2;
+#endif
+	if (size <=          8) return 3;
+	if (size <=         16) return 4;
+	if (size <=         32) return 5;
+	if (size <=         64) return 6;
+	if (size <=        128) return 7;
+	if (size <=        256) return 8;
+	if (size <=        512) return 9;
+	if (size <=       1024) return 10;
+	if (size <=   2 * 1024) return 11;
+	if (size <=   4 * 1024) return 12;
+/*
+ * The following is only needed to support architectures with a larger page
+ * size than 4k.
+ */
+	if (size <=   8 * 1024) return 13;
+	if (size <=  16 * 1024) return 14;
+	if (size <=  32 * 1024) return 15;
+	if (size <=  64 * 1024) return 16;
+	if (size <= 128 * 1024) return 17;
+	if (size <= 256 * 1024) return 18;
+	return -1;
+}
+
+/*
+ * Find the slab cache for a given size.
+ *
+ * This ought to end up with a global pointer to the right cache
+ * in kmalloc_caches.
+ */
+static __always_inline struct kmem_cache *kmalloc_slab(size_t size)
+{
+	int index = kmalloc_index(size);
+
+	if (index == 0)
+		return NULL;
+
+	return &kmalloc_caches[index];
+}
+
+#ifdef CONFIG_ZONE_DMA
+#define SLQB_DMA __GFP_DMA
+#else
+/* Disable DMA functionality */
+#define SLQB_DMA (__force gfp_t)0
+#endif
+
+void *kmem_cache_alloc(struct kmem_cache *, gfp_t);
+void *__kmalloc(size_t size, gfp_t flags);
+
+static __always_inline void *kmalloc_large(size_t size, gfp_t flags)
+{
+	return (void *)__get_free_pages(flags | __GFP_COMP, get_order(size));
+}
+
+static __always_inline void *kmalloc(size_t size, gfp_t flags)
+{
+	if (__builtin_constant_p(size)) {
+		if (size > PAGE_SIZE)
+			return kmalloc_large(size, flags);
+
+		if (!(flags & SLQB_DMA)) {
+			struct kmem_cache *s = kmalloc_slab(size);
+
+			if (!s)
+				return ZERO_SIZE_PTR;
+
+			return kmem_cache_alloc(s, flags);
+		}
+	}
+	return __kmalloc(size, flags);
+}
+
+#endif /* _LINUX_SLQB_DEF_H */
@@ -30,6 +30,8 @@ enum stat_item {
 	DEACTIVATE_TO_TAIL,	/* Cpu slab was moved to the tail of partials */
 	DEACTIVATE_REMOTE_FREES,/* Slab contained remotely freed objects */
 	ORDER_FALLBACK,		/* Number of times fallback was necessary */
+	FREE_REMOTE_BUFFER,	/* Free added to the remote free buffer */
+	FREE_REMOTE_FLUSH,	/* Remote free buffer flushed to its slab */
 	NR_SLUB_STAT_ITEMS };
 
 struct kmem_cache_cpu {
@@ -38,6 +40,14 @@ struct kmem_cache_cpu {
 	int node;		/* The node of the page (or -1 for debug) */
 	unsigned int offset;	/* Freepointer offset (in word units) */
 	unsigned int objsize;	/* Size of an object (from kmem_cache) */
+	/*
+	 * Objects freed to a slab that is not the cpu slab, all to the same
+	 * one, not yet put back on its freelist.
+	 */
+	struct page *rfree_page;
+	void **rfree_head;
+	void **rfree_tail;
+	unsigned int rfree_nr;
 #ifdef CONFIG_SLUB_STATS
 	unsigned stat[NR_SLUB_STAT_ITEMS];
 #endif
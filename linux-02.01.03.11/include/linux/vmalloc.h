@@ -91,7 +91,10 @@ extern struct vm_struct *remove_vm_area(const void *addr);
 
 extern int map_vm_area(struct vm_struct *area, pgprot_t prot,
 			struct page ***pages);
+extern int map_kernel_range(unsigned long addr, unsigned long size,
+			    pgprot_t prot, struct page **pages);
 extern void unmap_kernel_range(unsigned long addr, unsigned long size);
+extern void __init vm_area_register_early(struct vm_struct *vm, size_t align);
 
 /* Allocate/destroy a 'vmalloc' VM area. */
 extern struct vm_struct *alloc_vm_area(size_t size);
@@ -161,11 +161,11 @@ struct execute_work {
 
 extern struct workqueue_struct *
 __create_workqueue_key(const char *name, int singlethread,
-		       int freezeable, int rt, struct lock_class_key *key,
-		       const char *lock_name);
+		       int freezeable, int rt, int rescuer,
+		       struct lock_class_key *key, const char *lock_name);
 
 #ifdef CONFIG_LOCKDEP
-#define __create_workqueue(name, singlethread, freezeable, rt)	\
+#define __create_workqueue(name, singlethread, freezeable, rt, rescuer) \
 ({								\
 	static struct lock_class_key __key;			\
 	const char *__lock_name;				\
@@ -176,19 +176,28 @@ __create_workqueue_key(const char *name, int singlethread,
 		__lock_name = #name;				\
 								\
 	__create_workqueue_key((name), (singlethread),		\
-			       (freezeable), (rt), &__key,	\
-			       __lock_name);			\
+			       (freezeable), (rt), (rescuer),	\
+			       &__key, __lock_name);		\
 })
 #else
-#define __create_workqueue(name, singlethread, freezeable, rt)	\
+#define __create_workqueue(name, singlethread, freezeable, rt, rescuer) \
 	__create_workqueue_key((name), (singlethread), (freezeable), (rt), \
-			       NULL, NULL)
+			       (rescuer), NULL, NULL)
 #endif
 
-#define create_workqueue(name) __create_workqueue((name), 0, 0, 0)
-#define create_rt_workqueue(name) __create_workqueue((name), 0, 0, 1)
-#define create_freezeable_workqueue(name) __create_workqueue((name), 1, 1, 0)
-#define create_singlethread_workqueue(name) __create_workqueue((name), 1, 0, 0)
+#define create_workqueue(name) __create_workqueue((name), 0, 0, 0, 0)
+#define create_rt_workqueue(name) __create_workqueue((name), 0, 0, 1, 0)
+#define create_freezeable_workqueue(name) __create_workqueue((name), 1, 1, 0, 0)
+#define create_singlethread_workqueue(name) __create_workqueue((name), 1, 0, 0, 0)
+
+/*
+ * Workqueues which may be needed to make progress under memory pressure,
+ * like the ones sitting on the I/O path, get a rescuer thread which runs
+ * their work when the shared worker pools can't create workers.
+ */
+#define create_reclaim_workqueue(name) __create_workqueue((name), 0, 0, 0, 1)
+#define create_singlethread_reclaim_workqueue(name)		\
+	__create_workqueue((name), 1, 0, 0, 1)
 
 extern void destroy_workqueue(struct workqueue_struct *wq);
 
@@ -17,12 +17,12 @@ extern struct list_head inode_unused;
  * Yes, writeback.h requires sched.h
  * No, sched.h is not included from here.
  */
-static inline int task_is_pdflush(struct task_struct *task)
+static inline int task_is_flusher(struct task_struct *task)
 {
 	return task->flags & PF_FLUSHER;
 }
 
-#define current_is_pdflush()	task_is_pdflush(current)
+#define current_is_flusher()	task_is_flusher(current)
 
 /*
  * fs/fs-writeback.c
@@ -77,6 +77,7 @@ struct writeback_control {
  * fs/fs-writeback.c
  */	
 void writeback_inodes(struct writeback_control *wbc);
+void wakeup_flusher_threads(long nr_pages);
 int inode_wait(void *);
 void sync_inodes_sb(struct super_block *, int wait);
 void sync_inodes(int wait);
@@ -99,7 +100,6 @@ static inline void inode_sync_wait(struct inode *inode)
 /*
  * mm/page-writeback.c
  */
-int wakeup_pdflush(long nr_pages);
 void laptop_io_completion(void);
 void laptop_sync_completion(void);
 void throttle_vm_writeout(gfp_t gfp_mask);
@@ -151,7 +151,6 @@ balance_dirty_pages_ratelimited(struct address_space *mapping)
 typedef int (*writepage_t)(struct page *page, struct writeback_control *wbc,
 				void *data);
 
-int pdflush_operation(void (*fn)(unsigned long), unsigned long arg0);
 int generic_writepages(struct address_space *mapping,
 		       struct writeback_control *wbc);
 int write_cache_pages(struct address_space *mapping,
@@ -165,9 +164,8 @@ int sync_page_range_nolock(struct inode *inode, struct address_space *mapping,
 void set_page_dirty_balance(struct page *page, int page_mkwrite);
 void writeback_set_ratelimit(void);
 
-/* pdflush.c */
-extern int nr_pdflush_threads;	/* Global so it can be exported to sysctl
-				   read-only. */
+/* backing-dev.c */
+extern int nr_pdflush_threads;	/* Always 0, kept for the read-only sysctl */
 
 
 #endif		/* WRITEBACK_H */
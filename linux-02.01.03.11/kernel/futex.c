@@ -55,6 +55,9 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
 
 #include <asm/futex.h>
 
@@ -62,7 +65,21 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
+/*
+ * The global hash table gets a bucket per 2^FUTEX_HASH_SCALE bytes of
+ * low memory, up to FUTEX_HASH_MAX buckets.
+ */
 #define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
+#define FUTEX_HASH_SCALE	18
+#define FUTEX_HASH_MAX		(1 << 16)
+
+/*
+ * Size limits of the per-mm hash tables, and how many buckets they
+ * should have per thread sharing the mm.
+ */
+#define FUTEX_MM_HASHBITS_MIN	4
+#define FUTEX_MM_HASHBITS_MAX	(CONFIG_BASE_SMALL ? 6 : 10)
+#define FUTEX_MM_BUCKETS_PER_THREAD	4
 
 /*
  * Priority Inheritance state:
@@ -119,19 +136,95 @@ struct futex_q {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
+	/* the waiters moved on to a bigger table, see futex_hash_move() */
+	int dead;
 };
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+/*
+ * Shared futexes are hashed into the global futex_queues.  Private
+ * futexes of a process with several threads are hashed into a table
+ * of its own, hanging off its mm, so that they don't contend on the
+ * bucket locks of unrelated processes.  That table grows along with
+ * the number of threads; the tables it replaced are kept on the old
+ * list until the mm is freed, as waiters may still look at them.
+ */
+struct futex_hash {
+	unsigned int bits;
+	struct futex_hash *old;
+	struct futex_hash_bucket buckets[0];
+};
+
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned int futex_hashmask __read_mostly;
+
+/* serializes the growing of the per-mm tables */
+static DEFINE_MUTEX(futex_hash_grow_lock);
+
+static inline int futex_key_is_private(union futex_key *key)
+{
+	return !(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED));
+}
+
+static inline u32 futex_jhash(union futex_key *key)
+{
+	return jhash2((u32*)&key->both.word,
+		      (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
+		      key->both.offset);
+}
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
-	u32 hash = jhash2((u32*)&key->both.word,
-			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
-			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+	u32 hash = futex_jhash(key);
+
+	if (futex_key_is_private(key)) {
+		struct futex_hash *fh;
+
+		fh = ACCESS_ONCE(key->private.mm->futex_hash);
+		if (fh) {
+			smp_read_barrier_depends();
+			return &fh->buckets[hash & ((1 << fh->bits) - 1)];
+		}
+	}
+	return &futex_queues[hash & futex_hashmask];
+}
+
+/*
+ * Lock the hash bucket of @key.  Buckets of a per-mm table die when the
+ * table is replaced by a bigger one, the key is hashed again then.
+ */
+static struct futex_hash_bucket *futex_hb_lock(union futex_key *key)
+{
+	struct futex_hash_bucket *hb;
+
+	for (;;) {
+		hb = hash_futex(key);
+		spin_lock(&hb->lock);
+		if (likely(!hb->dead))
+			return hb;
+		spin_unlock(&hb->lock);
+		cpu_relax();
+	}
+}
+
+/*
+ * Lock the hash bucket a queued futex_q is on.  The waiter can be moved
+ * to another bucket by a requeue or when its per-mm table grows, so
+ * q->lock_ptr has to be checked again once it is locked.
+ */
+static spinlock_t *futex_q_lock(struct futex_q *q)
+{
+	spinlock_t *lock_ptr;
+
+	for (;;) {
+		lock_ptr = q->lock_ptr;
+		spin_lock(lock_ptr);
+		if (likely(lock_ptr == q->lock_ptr))
+			return lock_ptr;
+		spin_unlock(lock_ptr);
+	}
 }
 
 /*
@@ -440,6 +533,7 @@ void exit_pi_state_list(struct task_struct *curr)
 	struct futex_pi_state *pi_state;
 	struct futex_hash_bucket *hb;
 	union futex_key key = FUTEX_KEY_INIT;
+	struct mm_struct *mm;
 
 	if (!futex_cmpxchg_enabled)
 		return;
@@ -454,10 +548,19 @@ void exit_pi_state_list(struct task_struct *curr)
 		next = head->next;
 		pi_state = list_entry(next, struct futex_pi_state, list);
 		key = pi_state->key;
-		hb = hash_futex(&key);
+		/*
+		 * We already left our mm, and the waiters keeping it
+		 * alive can go away once we drop the pi-lock.  Pin it,
+		 * as a private key hashes into its futex hash table.
+		 */
+		mm = NULL;
+		if (futex_key_is_private(&key)) {
+			mm = key.private.mm;
+			atomic_inc(&mm->mm_count);
+		}
 		spin_unlock_irq(&curr->pi_lock);
 
-		spin_lock(&hb->lock);
+		hb = futex_hb_lock(&key);
 
 		spin_lock_irq(&curr->pi_lock);
 		/*
@@ -465,7 +568,11 @@ void exit_pi_state_list(struct task_struct *curr)
 		 * task still owns the PI-state:
 		 */
 		if (head->next != next) {
+			spin_unlock_irq(&curr->pi_lock);
 			spin_unlock(&hb->lock);
+			if (mm)
+				mmdrop(mm);
+			spin_lock_irq(&curr->pi_lock);
 			continue;
 		}
 
@@ -478,6 +585,8 @@ void exit_pi_state_list(struct task_struct *curr)
 		rt_mutex_unlock(&pi_state->pi_mutex);
 
 		spin_unlock(&hb->lock);
+		if (mm)
+			mmdrop(mm);
 
 		spin_lock_irq(&curr->pi_lock);
 	}
@@ -676,20 +785,46 @@ static int unlock_futex_pi(u32 __user *uaddr, u32 uval)
 	return 0;
 }
 
+static inline void
+double_unlock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2)
+{
+	spin_unlock(&hb1->lock);
+	if (hb1 != hb2)
+		spin_unlock(&hb2->lock);
+}
+
 /*
+ * Lock the hash buckets of two keys, see futex_hb_lock().
  * Express the locking dependencies for lockdep:
  */
 static inline void
-double_lock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2)
+double_lock_hb(union futex_key *key1, union futex_key *key2,
+	       struct futex_hash_bucket **phb1, struct futex_hash_bucket **phb2)
 {
-	if (hb1 <= hb2) {
-		spin_lock(&hb1->lock);
-		if (hb1 < hb2)
-			spin_lock_nested(&hb2->lock, SINGLE_DEPTH_NESTING);
-	} else { /* hb1 > hb2 */
-		spin_lock(&hb2->lock);
-		spin_lock_nested(&hb1->lock, SINGLE_DEPTH_NESTING);
+	struct futex_hash_bucket *hb1, *hb2;
+
+	for (;;) {
+		hb1 = hash_futex(key1);
+		hb2 = hash_futex(key2);
+
+		if (hb1 <= hb2) {
+			spin_lock(&hb1->lock);
+			if (hb1 < hb2)
+				spin_lock_nested(&hb2->lock,
+						 SINGLE_DEPTH_NESTING);
+		} else { /* hb1 > hb2 */
+			spin_lock(&hb2->lock);
+			spin_lock_nested(&hb1->lock, SINGLE_DEPTH_NESTING);
+		}
+
+		if (likely(!hb1->dead && !hb2->dead))
+			break;
+		double_unlock_hb(hb1, hb2);
+		cpu_relax();
 	}
+
+	*phb1 = hb1;
+	*phb2 = hb2;
 }
 
 /*
@@ -711,8 +846,7 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 	if (unlikely(ret != 0))
 		goto out;
 
-	hb = hash_futex(&key);
-	spin_lock(&hb->lock);
+	hb = futex_hb_lock(&key);
 	head = &hb->chain;
 
 	plist_for_each_entry_safe(this, next, head, list) {
@@ -760,19 +894,14 @@ retryfull:
 	if (unlikely(ret != 0))
 		goto out_put_key1;
 
-	hb1 = hash_futex(&key1);
-	hb2 = hash_futex(&key2);
-
 retry:
-	double_lock_hb(hb1, hb2);
+	double_lock_hb(&key1, &key2, &hb1, &hb2);
 
 	op_ret = futex_atomic_op_inuser(op, uaddr2);
 	if (unlikely(op_ret < 0)) {
 		u32 dummy;
 
-		spin_unlock(&hb1->lock);
-		if (hb1 != hb2)
-			spin_unlock(&hb2->lock);
+		double_unlock_hb(hb1, hb2);
 
 #ifndef CONFIG_MMU
 		/*
@@ -834,9 +963,7 @@ retry:
 		ret += op_ret;
 	}
 
-	spin_unlock(&hb1->lock);
-	if (hb1 != hb2)
-		spin_unlock(&hb2->lock);
+	double_unlock_hb(hb1, hb2);
 out_put_keys:
 	put_futex_key(fshared, &key2);
 out_put_key1:
@@ -866,10 +993,7 @@ retry:
 	if (unlikely(ret != 0))
 		goto out_put_key1;
 
-	hb1 = hash_futex(&key1);
-	hb2 = hash_futex(&key2);
-
-	double_lock_hb(hb1, hb2);
+	double_lock_hb(&key1, &key2, &hb1, &hb2);
 
 	if (likely(cmpval != NULL)) {
 		u32 curval;
@@ -877,9 +1001,7 @@ retry:
 		ret = get_futex_value_locked(&curval, uaddr1);
 
 		if (unlikely(ret)) {
-			spin_unlock(&hb1->lock);
-			if (hb1 != hb2)
-				spin_unlock(&hb2->lock);
+			double_unlock_hb(hb1, hb2);
 
 			ret = get_user(curval, uaddr1);
 
@@ -923,9 +1045,7 @@ retry:
 	}
 
 out_unlock:
-	spin_unlock(&hb1->lock);
-	if (hb1 != hb2)
-		spin_unlock(&hb2->lock);
+	double_unlock_hb(hb1, hb2);
 
 	/* drop_futex_key_refs() must be called outside the spinlocks. */
 	while (--drop_count >= 0)
@@ -947,10 +1067,9 @@ static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 	init_waitqueue_head(&q->waiter);
 
 	get_futex_key_refs(&q->key);
-	hb = hash_futex(&q->key);
+	hb = futex_hb_lock(&q->key);
 	q->lock_ptr = &hb->lock;
 
-	spin_lock(&hb->lock);
 	return hb;
 }
 
@@ -1138,7 +1257,7 @@ handle_fault:
 
 	ret = futex_handle_fault((unsigned long)uaddr, attempt++);
 
-	spin_lock(q->lock_ptr);
+	futex_q_lock(q);
 
 	/*
 	 * Check if someone else fixed it for us:
@@ -1501,7 +1620,7 @@ retry_locked:
 		ret = ret ? 0 : -EWOULDBLOCK;
 	}
 
-	spin_lock(q.lock_ptr);
+	futex_q_lock(&q);
 
 	if (!ret) {
 		/*
@@ -1634,9 +1753,8 @@ retry:
 	if (unlikely(ret != 0))
 		goto out;
 
-	hb = hash_futex(&key);
 retry_unlocked:
-	spin_lock(&hb->lock);
+	hb = futex_hb_lock(&key);
 
 	/*
 	 * To avoid races, try to do the TID -> 0 atomic transition
@@ -2012,6 +2130,134 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 	return do_futex(uaddr, op, val, tp, uaddr2, val2, val3);
 }
 
+static struct futex_hash *futex_hash_alloc(unsigned int bits, gfp_t gfp)
+{
+	struct futex_hash *fh;
+	int i;
+
+	fh = kmalloc(sizeof(*fh) + (sizeof(fh->buckets[0]) << bits), gfp);
+	if (!fh)
+		return NULL;
+
+	fh->bits = bits;
+	fh->old = NULL;
+	for (i = 0; i < (1 << bits); i++) {
+		struct futex_hash_bucket *hb = &fh->buckets[i];
+
+		plist_head_init(&hb->chain, &hb->lock);
+		spin_lock_init(&hb->lock);
+		hb->dead = 0;
+	}
+
+	return fh;
+}
+
+/*
+ * Move the waiters queued on @old to @new, which is not published yet.
+ * Every bucket of @old is marked dead under its lock, so whoever
+ * hashed into it meanwhile hashes again until @new is published.
+ * They spin doing so: the caller must not be preempted until then, or
+ * a waiter running in its place would never let it finish.
+ */
+static void futex_hash_move(struct futex_hash *old, struct futex_hash *new)
+{
+	u32 mask = (1 << new->bits) - 1;
+	int i;
+
+	for (i = 0; i < (1 << old->bits); i++) {
+		struct futex_hash_bucket *ohb = &old->buckets[i];
+		struct futex_q *this, *next;
+
+		spin_lock(&ohb->lock);
+		ohb->dead = 1;
+		plist_for_each_entry_safe(this, next, &ohb->chain, list) {
+			struct futex_hash_bucket *hb;
+
+			hb = &new->buckets[futex_jhash(&this->key) & mask];
+			spin_lock_nested(&hb->lock, SINGLE_DEPTH_NESTING);
+			plist_del(&this->list, &ohb->chain);
+			plist_add(&this->list, &hb->chain);
+			this->lock_ptr = &hb->lock;
+#ifdef CONFIG_DEBUG_PI_LIST
+			this->list.plist.lock = &hb->lock;
+#endif
+			spin_unlock(&hb->lock);
+		}
+		spin_unlock(&ohb->lock);
+	}
+}
+
+/**
+ * futex_mm_grow - size the private futex hash of an mm for a new thread
+ * @mm:		the mm the new thread is going to share
+ *
+ * Called by copy_mm() for CLONE_VM.  The first clone gets @mm a hash
+ * table of its own, which is then doubled whenever there would be fewer
+ * than FUTEX_MM_BUCKETS_PER_THREAD buckets per thread.  Only the first
+ * table is mandatory, failing to grow it later is not an error.
+ */
+int futex_mm_grow(struct mm_struct *mm)
+{
+	struct futex_hash *fh, *new;
+	unsigned int bits;
+	int ret = 0;
+
+	bits = order_base_2((atomic_read(&mm->mm_users) + 1) *
+			    FUTEX_MM_BUCKETS_PER_THREAD);
+	bits = clamp_t(unsigned int, bits,
+		       FUTEX_MM_HASHBITS_MIN, FUTEX_MM_HASHBITS_MAX);
+
+	fh = mm->futex_hash;
+	if (fh && fh->bits >= bits)
+		return 0;
+
+	mutex_lock(&futex_hash_grow_lock);
+	fh = mm->futex_hash;
+	if (fh && fh->bits >= bits)
+		goto out;
+
+	new = futex_hash_alloc(bits, fh ? GFP_KERNEL | __GFP_NOWARN :
+				      GFP_KERNEL);
+	if (!new) {
+		if (!fh)
+			ret = -ENOMEM;
+		goto out;
+	}
+
+	/*
+	 * Without a table of its own, @mm had a single thread which
+	 * is busy cloning, so nothing of it is queued in futex_queues.
+	 * The old table has at most 1 << FUTEX_MM_HASHBITS_MAX buckets,
+	 * short enough to move with preemption disabled.
+	 */
+	preempt_disable();
+	if (fh)
+		futex_hash_move(fh, new);
+	new->old = fh;
+
+	smp_wmb();
+	mm->futex_hash = new;
+	preempt_enable();
+out:
+	mutex_unlock(&futex_hash_grow_lock);
+	return ret;
+}
+
+/*
+ * Called by __mmdrop(): no waiter can be left on the tables of @mm.
+ */
+void futex_mm_free(struct mm_struct *mm)
+{
+	struct futex_hash *fh = mm->futex_hash;
+
+	while (fh) {
+		struct futex_hash *old = fh->old;
+
+		kfree(fh);
+		fh = old;
+	}
+}
+
 static int __init futex_init(void)
 {
 	u32 curval;
@@ -2031,9 +2277,16 @@ static int __init futex_init(void)
 	if (curval == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
+	futex_queues = alloc_large_system_hash("Futex",
+					sizeof(struct futex_hash_bucket),
+					CONFIG_BASE_SMALL ? 1 << FUTEX_HASHBITS : 0,
+					FUTEX_HASH_SCALE, 0, NULL,
+					&futex_hashmask, FUTEX_HASH_MAX);
+
+	for (i = 0; i <= futex_hashmask; i++) {
 		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
 		spin_lock_init(&futex_queues[i].lock);
+		futex_queues[i].dead = 0;
 	}
 
 	return 0;
@@ -197,6 +197,9 @@ struct lock_class_stats lock_stats(struct lock_class *class)
 
 		for (i = 0; i < ARRAY_SIZE(stats.bounces); i++)
 			stats.bounces[i] += pcs->bounces[i];
+
+		stats.spin_acquired += pcs->spin_acquired;
+		stats.spin_slept += pcs->spin_slept;
 	}
 
 	return stats;
@@ -3092,6 +3095,43 @@ found_it:
 	lock->ip = ip;
 }
 
+static void
+__lock_spun(struct lockdep_map *lock, int acquired)
+{
+	struct task_struct *curr = current;
+	struct held_lock *hlock, *prev_hlock;
+	struct lock_class_stats *stats;
+	unsigned int depth;
+	int i;
+
+	depth = curr->lockdep_depth;
+	if (DEBUG_LOCKS_WARN_ON(!depth))
+		return;
+
+	prev_hlock = NULL;
+	for (i = depth-1; i >= 0; i--) {
+		hlock = curr->held_locks + i;
+		/*
+		 * We must not cross into another context:
+		 */
+		if (prev_hlock && prev_hlock->irq_context != hlock->irq_context)
+			break;
+		if (hlock->instance == lock)
+			goto found_it;
+		prev_hlock = hlock;
+	}
+	print_lock_contention_bug(curr, lock, _RET_IP_);
+	return;
+
+found_it:
+	stats = get_lock_stats(hlock_class(hlock));
+	if (acquired)
+		stats->spin_acquired++;
+	else
+		stats->spin_slept++;
+	put_lock_stats(stats);
+}
+
 void lock_contended(struct lockdep_map *lock, unsigned long ip)
 {
 	unsigned long flags;
@@ -3129,6 +3169,30 @@ void lock_acquired(struct lockdep_map *lock, unsigned long ip)
 	raw_local_irq_restore(flags);
 }
 EXPORT_SYMBOL_GPL(lock_acquired);
+
+/*
+ * Called by locks which spin on a running owner before blocking (see
+ * CONFIG_MUTEX_SPIN_ON_OWNER) once they either got the lock spinning or
+ * gave up and are going to sleep.
+ */
+void lock_spun(struct lockdep_map *lock, int acquired)
+{
+	unsigned long flags;
+
+	if (unlikely(!lock_stat))
+		return;
+
+	if (unlikely(current->lockdep_recursion))
+		return;
+
+	raw_local_irq_save(flags);
+	check_flags(flags);
+	current->lockdep_recursion = 1;
+	__lock_spun(lock, acquired);
+	current->lockdep_recursion = 0;
+	raw_local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(lock_spun);
 #endif
 
 /*
@@ -551,6 +551,12 @@ static void seq_stats(struct seq_file *m, struct lock_stat_data *data)
 		seq_puts(m, "\n");
 	}
 
+	if (stats->spin_acquired + stats->spin_slept) {
+		seq_printf(m, "%38s-S:", name);
+		seq_printf(m, "%14lu %14lu\n",
+				stats->spin_acquired, stats->spin_slept);
+	}
+
 	if (stats->read_waittime.nr + stats->write_waittime.nr == 0)
 		return;
 
@@ -600,7 +606,7 @@ static void seq_stats(struct seq_file *m, struct lock_stat_data *data)
 
 static void seq_header(struct seq_file *m)
 {
-	seq_printf(m, "lock_stat version 0.3\n");
+	seq_printf(m, "lock_stat version 0.4\n");
 	seq_line(m, '-', 0, 40 + 1 + 10 * (14 + 1));
 	seq_printf(m, "%40s %14s %14s %14s %14s %14s %14s %14s %14s "
 			"%14s %14s\n",
@@ -10,13 +10,12 @@
  * More details are in kernel/mutex-debug.c.
  */
 
-/*
- * This must be called with lock->wait_lock held.
- */
-extern void
-debug_mutex_set_owner(struct mutex *lock, struct thread_info *new_owner);
+static inline void mutex_set_owner(struct mutex *lock)
+{
+	lock->owner = current_thread_info();
+}
 
-static inline void debug_mutex_clear_owner(struct mutex *lock)
+static inline void mutex_clear_owner(struct mutex *lock)
 {
 	lock->owner = NULL;
 }
@@ -0,0 +1,216 @@
+/*
+ * Spinlock contention benchmark
+ *
+ * Starts one thread per online cpu, all of them taking the same lock in
+ * a tight loop for a while, and reports the lock throughput, how the
+ * acquisitions were spread across cpus and the worst wait seen on each
+ * cpu.  The architecture lock primitives are used directly, so what is
+ * measured is the raw lock and not the debugging or lockbreak layers.
+ *
+ * Load with "rwlock=1" to benchmark read/write locks instead, with
+ * read_pct percent of the acquisitions taken for reading.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <linux/cpu.h>
+#include <linux/delay.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+static int duration = 10;
+module_param(duration, int, 0444);
+MODULE_PARM_DESC(duration, "Seconds to run the benchmark for (default 10)");
+
+static int hold_loops = 10;
+module_param(hold_loops, int, 0444);
+MODULE_PARM_DESC(hold_loops, "Busy loops with the lock held (default 10)");
+
+static int delay_loops;
+module_param(delay_loops, int, 0444);
+MODULE_PARM_DESC(delay_loops, "Busy loops between acquisitions (default 0)");
+
+static int rwlock;
+module_param(rwlock, bool, 0444);
+MODULE_PARM_DESC(rwlock, "Benchmark a rwlock instead of a spinlock");
+
+static int read_pct = 90;
+module_param(read_pct, int, 0444);
+MODULE_PARM_DESC(read_pct, "Percentage of read acquisitions with rwlock=1");
+
+static raw_spinlock_t bench_lock = __RAW_SPIN_LOCK_UNLOCKED;
+static raw_rwlock_t bench_rwlock = __RAW_RW_LOCK_UNLOCKED;
+static unsigned long bench_shared;
+
+static DECLARE_WAIT_QUEUE_HEAD(bench_wait);
+static int bench_go;
+static int bench_stop;
+
+struct bench_stats {
+	struct task_struct	*task;
+	unsigned long		acquisitions;
+	unsigned long long	max_wait;
+};
+
+static DEFINE_PER_CPU(struct bench_stats, bench_stats);
+
+static inline void bench_spin(int loops)
+{
+	while (loops-- > 0)
+		cpu_relax();
+}
+
+static void bench_one(struct bench_stats *st, int read)
+{
+	unsigned long long start, wait;
+
+	preempt_disable();
+	start = sched_clock();
+
+	if (!rwlock)
+		__raw_spin_lock(&bench_lock);
+	else if (read)
+		__raw_read_lock(&bench_rwlock);
+	else
+		__raw_write_lock(&bench_rwlock);
+
+	wait = sched_clock() - start;
+
+	/* make the lock protect some shared data, like the real thing */
+	if (read)
+		(void)ACCESS_ONCE(bench_shared);
+	else
+		bench_shared++;
+	bench_spin(hold_loops);
+
+	if (!rwlock)
+		__raw_spin_unlock(&bench_lock);
+	else if (read)
+		__raw_read_unlock(&bench_rwlock);
+	else
+		__raw_write_unlock(&bench_rwlock);
+
+	preempt_enable();
+
+	st->acquisitions++;
+	if (wait > st->max_wait)
+		st->max_wait = wait;
+}
+
+static int bench_thread(void *data)
+{
+	struct bench_stats *st = data;
+	unsigned long seed = (unsigned long)st;
+
+	wait_event(bench_wait, bench_go || kthread_should_stop());
+
+	while (!ACCESS_ONCE(bench_stop)) {
+		int read = 0;
+
+		if (rwlock) {
+			seed = seed * 1103515245 + 12345;
+			read = (seed >> 16) % 100 < read_pct;
+		}
+
+		bench_one(st, read);
+		bench_spin(delay_loops);
+		cond_resched();
+	}
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void bench_report(void)
+{
+	unsigned long total = 0, min = ULONG_MAX, max = 0;
+	unsigned long long max_wait = 0;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		struct bench_stats *st = &per_cpu(bench_stats, cpu);
+
+		printk(KERN_INFO "spinlock_bench: cpu%d: %lu acquisitions, "
+		       "max wait %llu ns\n", cpu, st->acquisitions,
+		       st->max_wait);
+
+		total += st->acquisitions;
+		min = min(min, st->acquisitions);
+		max = max(max, st->acquisitions);
+		max_wait = max(max_wait, st->max_wait);
+	}
+
+	printk(KERN_INFO "spinlock_bench: %s: %lu acquisitions in %d s "
+	       "(%lu/s), per cpu min %lu max %lu, max wait %llu ns\n",
+	       rwlock ? "rwlock" : "spinlock", total, duration,
+	       total / duration, min, max, max_wait);
+}
+
+static int __init spinlock_bench_init(void)
+{
+	int cpu, err = 0;
+
+	if (duration <= 0 || read_pct < 0 || read_pct > 100)
+		return -EINVAL;
+
+	get_online_cpus();
+
+	for_each_online_cpu(cpu) {
+		struct bench_stats *st = &per_cpu(bench_stats, cpu);
+		struct task_struct *p;
+
+		p = kthread_create(bench_thread, st, "lockbench/%d", cpu);
+		if (IS_ERR(p)) {
+			err = PTR_ERR(p);
+			goto stop;
+		}
+		kthread_bind(p, cpu);
+		st->task = p;
+		wake_up_process(p);
+	}
+
+	bench_go = 1;
+	wake_up_all(&bench_wait);
+	ssleep(duration);
+stop:
+	bench_stop = 1;
+
+	for_each_online_cpu(cpu) {
+		struct bench_stats *st = &per_cpu(bench_stats, cpu);
+
+		if (st->task)
+			kthread_stop(st->task);
+		st->task = NULL;
+	}
+
+	if (!err)
+		bench_report();
+
+	put_online_cpus();
+
+	return err;
+}
+
+static void __exit spinlock_bench_exit(void)
+{
+}
+
+module_init(spinlock_bench_init);
+module_exit(spinlock_bench_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Spinlock contention benchmark");
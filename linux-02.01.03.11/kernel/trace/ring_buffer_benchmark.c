@@ -0,0 +1,231 @@
+/*
+ * Ring buffer writer benchmark
+ *
+ * Writes events into a ring buffer from one cpu, then from two cpus at
+ * once, and so on up to all online cpus, and reports what a reserve and
+ * commit pair costs on average for each number of writers.  Every
+ * writer only touches the buffer of its own cpu, so the cost per event
+ * should not go up as cpus are added.  Unless loaded with "consumer=0",
+ * a reader thread consumes the events of all cpus meanwhile, to show
+ * that readers do not hold the writers up either.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+
+#include <linux/ring_buffer.h>
+#include <linux/cpu.h>
+#include <linux/delay.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+#include <asm/div64.h>
+
+#define RB_BENCH_BUFFER_SIZE	(1 << 20)
+#define RB_BENCH_BATCH		100
+
+static int duration = 2;
+module_param(duration, int, 0444);
+MODULE_PARM_DESC(duration, "Seconds to run each step for (default 2)");
+
+static int event_size = 8;
+module_param(event_size, int, 0444);
+MODULE_PARM_DESC(event_size, "Bytes of data per event (default 8)");
+
+static int consumer = 1;
+module_param(consumer, bool, 0444);
+MODULE_PARM_DESC(consumer, "Consume the events while writing (default 1)");
+
+static struct ring_buffer *buffer;
+
+static DECLARE_WAIT_QUEUE_HEAD(bench_wait);
+static int bench_go;
+static int bench_stop;
+
+struct bench_writer {
+	struct task_struct	*task;
+	unsigned long		events;
+	unsigned long		missed;
+	unsigned long long	ns;
+};
+
+static DEFINE_PER_CPU(struct bench_writer, bench_writer);
+
+static void bench_park(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+static int bench_writer_thread(void *data)
+{
+	struct bench_writer *w = data;
+	unsigned long long start;
+
+	wait_event(bench_wait, bench_go || kthread_should_stop());
+
+	start = sched_clock();
+
+	while (!ACCESS_ONCE(bench_stop)) {
+		struct ring_buffer_event *event;
+		unsigned long flags;
+		int i;
+
+		for (i = 0; i < RB_BENCH_BATCH; i++) {
+			event = ring_buffer_lock_reserve(buffer, event_size,
+							 &flags);
+			if (!event) {
+				w->missed++;
+				continue;
+			}
+			memset(ring_buffer_event_data(event), i, event_size);
+			ring_buffer_unlock_commit(buffer, event, flags);
+			w->events++;
+		}
+		cond_resched();
+	}
+
+	w->ns = sched_clock() - start;
+
+	bench_park();
+
+	return 0;
+}
+
+static int bench_consumer_thread(void *data)
+{
+	unsigned long *consumed = data;
+	int cpu;
+
+	while (!kthread_should_stop()) {
+		for_each_online_cpu(cpu) {
+			while (ring_buffer_consume(buffer, cpu, NULL))
+				(*consumed)++;
+		}
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static int bench_step(int nr_writers)
+{
+	struct task_struct *reader = NULL;
+	unsigned long events = 0, missed = 0, consumed = 0;
+	unsigned long long ns = 0;
+	int cpu, n = 0, err = 0;
+
+	ring_buffer_reset(buffer);
+	bench_go = 0;
+	bench_stop = 0;
+
+	for_each_online_cpu(cpu) {
+		struct bench_writer *w = &per_cpu(bench_writer, cpu);
+		struct task_struct *p;
+
+		if (n++ == nr_writers)
+			break;
+
+		memset(w, 0, sizeof(*w));
+		p = kthread_create(bench_writer_thread, w, "rbbench/%d", cpu);
+		if (IS_ERR(p)) {
+			err = PTR_ERR(p);
+			goto stop;
+		}
+		kthread_bind(p, cpu);
+		w->task = p;
+		wake_up_process(p);
+	}
+
+	if (consumer) {
+		reader = kthread_run(bench_consumer_thread, &consumed,
+				     "rbbench_reader");
+		if (IS_ERR(reader)) {
+			err = PTR_ERR(reader);
+			reader = NULL;
+			goto stop;
+		}
+	}
+
+	bench_go = 1;
+	wake_up_all(&bench_wait);
+	ssleep(duration);
+ stop:
+	bench_stop = 1;
+
+	for_each_online_cpu(cpu) {
+		struct bench_writer *w = &per_cpu(bench_writer, cpu);
+
+		if (!w->task)
+			continue;
+		kthread_stop(w->task);
+		w->task = NULL;
+
+		events += w->events;
+		missed += w->missed;
+		ns += w->ns;
+	}
+
+	if (reader)
+		kthread_stop(reader);
+
+	if (err)
+		return err;
+
+	if (events)
+		do_div(ns, events);
+
+	printk(KERN_INFO "ring_buffer_benchmark: %d writer%s: %lu events "
+	       "(%lu/s), %llu ns/event, %lu dropped, %lu overruns, "
+	       "%lu consumed\n", nr_writers, nr_writers > 1 ? "s" : "",
+	       events, events / duration, ns, missed,
+	       ring_buffer_overruns(buffer), consumed);
+
+	return 0;
+}
+
+static int __init ring_buffer_benchmark_init(void)
+{
+	int nr, err = 0;
+
+	if (duration <= 0 || event_size <= 0)
+		return -EINVAL;
+
+	buffer = ring_buffer_alloc(RB_BENCH_BUFFER_SIZE, RB_FL_OVERWRITE);
+	if (!buffer)
+		return -ENOMEM;
+
+	get_online_cpus();
+
+	for (nr = 1; nr <= num_online_cpus(); nr++) {
+		err = bench_step(nr);
+		if (err)
+			break;
+	}
+
+	put_online_cpus();
+
+	ring_buffer_free(buffer);
+
+	return err;
+}
+
+static void __exit ring_buffer_benchmark_exit(void)
+{
+}
+
+module_init(ring_buffer_benchmark_init);
+module_exit(ring_buffer_benchmark_exit);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Ring buffer writer benchmark");
@@ -14,6 +14,8 @@
  *   Theodore Ts'o <tytso@mit.edu>
  *
  * Made to use alloc_percpu by Christoph Lameter.
+ *
+ * Shared, concurrency managed per-cpu worker pools.
  */
 
 #include <linux/module.h>
@@ -33,6 +35,103 @@
 #include <linux/kallsyms.h>
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
+#include <linux/timer.h>
+
+#include "workqueue_sched.h"
+
+/*
+ * Concurrency managed worker pools.
+ *
+ * Apart from the rt and freezeable ones, workqueues don't have threads of
+ * their own.  Every cpu has a single pool of workers shared by all of
+ * them: a cpu_workqueue_struct with pending work is put on the pool's
+ * worklist and the next available worker runs one work item off it.
+ * A cwq is normally being run by one worker at a time, so the works of
+ * a given cwq are still executed one after another in queueing order,
+ * and the barriers used by the flush functions work as before.
+ *
+ * keventd is shared by everybody, and one of its works blocking must not
+ * hold up all the others queued behind it.  Its cwqs may have up to
+ * max_active works in flight: a worker about to run one of them puts
+ * the cwq back on the pool first if there's more, so should it block,
+ * the worker woken up in its place goes on with the next work.  A work
+ * is still never run by two workers of a cwq at once, and a barrier
+ * only runs once everything queued before it has completed.
+ *
+ * The scheduler tells us when a worker blocks and when it becomes
+ * runnable again (wq_worker_sleeping() and wq_worker_waking_up()), so
+ * each pool knows how many of its workers are actually running.  A new
+ * worker is kicked off only when the last running one blocks while work
+ * is pending, and a worker about to run work makes sure there's an idle
+ * one left to do that.  Idle workers above that retire after
+ * IDLE_WORKER_TIMEOUT.
+ *
+ * When a cpu goes down its pool is disassociated: the workers lose their
+ * binding and concurrency management, finish whatever was queued on the
+ * pool and exit.  Work queued on that cpu's cwqs from then on is run by
+ * the pool of the queueing cpu.
+ *
+ * Creating a worker may need memory, and workqueues on the reclaim path
+ * must not depend on that.  Those get a rescuer thread of their own:
+ * if one of their cwqs sits on a pool worklist for MAYDAY_INITIAL_TIMEOUT
+ * while none of the pool's workers is running, the pool sends a mayday
+ * to the rescuer, which takes the cwq off the pool and runs it itself.
+ */
+
+/* pool->flags */
+#define POOL_DISASSOCIATED	0x01	/* cpu is not online, not managed */
+#define POOL_STOPPING		0x02	/* workers exit when out of work */
+
+/* worker->flags */
+#define WORKER_PREP		0x01	/* not running work */
+#define WORKER_IDLE		0x02	/* on pool->idle_list */
+#define WORKER_UNBOUND		0x04	/* not bound to pool->cpu */
+
+#define WORKER_NOT_RUNNING	(WORKER_PREP | WORKER_IDLE | WORKER_UNBOUND)
+
+#define IDLE_WORKER_TIMEOUT	(300 * HZ)
+#define KEVENTD_MAX_ACTIVE	16	/* see init_workqueues() */
+#define MAYDAY_INITIAL_TIMEOUT	(HZ / 100 >= 2 ? HZ / 100 : 2)
+#define MAYDAY_INTERVAL		(HZ / 10)	/* resend while still stalled */
+
+struct worker_pool {
+	spinlock_t		lock;
+	struct list_head	worklist;	/* cwqs with pending work */
+	unsigned int		cpu;
+	unsigned int		flags;
+
+	int			nr_workers;
+	int			nr_idle;
+	int			nr_starting;	/* created, not running yet */
+	int			next_id;
+	struct list_head	idle_list;
+	struct list_head	workers;
+	wait_queue_head_t	drain_wait;	/* cpu down waits for workers */
+	struct timer_list	mayday_timer;	/* rescue stalled cwqs */
+
+	/*
+	 * Number of bound workers which are neither idle nor blocked.
+	 * Updated from the scheduler with only the runqueue lock held.
+	 */
+	atomic_t		nr_running ____cacheline_aligned_in_smp;
+} ____cacheline_aligned_in_smp;
+
+struct worker {
+	struct list_head	entry;		/* on pool->idle_list */
+	struct list_head	node;		/* on pool->workers */
+	struct task_struct	*task;
+	struct worker_pool	*pool;
+	unsigned int		flags;		/* protected by pool->lock */
+	int			id;
+
+	/* protected by current_cwq->lock */
+	struct cpu_workqueue_struct *current_cwq;
+	struct work_struct	*current_work;
+	struct list_head	busy_entry;	/* on current_cwq->busy_list */
+	struct list_head	barriers;	/* wait for current_work */
+};
+
+static DEFINE_PER_CPU(struct worker_pool, worker_pools);
 
 /*
  * The per-CPU workqueue (if single thread, we always use the first
@@ -47,7 +146,22 @@ struct cpu_workqueue_struct {
 	struct work_struct *current_work;
 
 	struct workqueue_struct *wq;
-	struct task_struct *thread;
+	struct task_struct *thread;	/* rt and freezeable wqs only */
+
+	/*
+	 * Pool side, for the shared workqueues.  ->pool is set while the
+	 * cwq is on a pool's worklist or being run by one of its workers,
+	 * both under ->lock.  ->home is the pool of our cpu, NULL for
+	 * single thread workqueues which are run wherever they're queued.
+	 */
+	struct worker_pool *home;
+	struct worker_pool *pool;
+	struct list_head pool_entry;
+	struct list_head busy_list;	/* workers running our works */
+	int nr_active;			/* workers on ->busy_list */
+	int parked;			/* see cwq_done() */
+	struct list_head mayday_entry;	/* on wq->mayday_list */
+	struct completion *release_done; /* destroy waits for ->pool */
 
 	int run_depth;		/* Detect run_workqueue() recursion depth */
 } ____cacheline_aligned;
@@ -63,6 +177,10 @@ struct workqueue_struct {
 	int singlethread;
 	int freezeable;		/* Freeze threads during suspend */
 	int rt;
+	int max_active;		/* works of a cwq run at once, if pooled */
+	struct worker *rescuer;		/* reclaim workqueues only */
+	spinlock_t mayday_lock;
+	struct list_head mayday_list;	/* cwqs the rescuer should run */
 #ifdef CONFIG_LOCKDEP
 	struct lockdep_map lockdep_map;
 #endif
@@ -95,6 +213,15 @@ static const struct cpumask *wq_cpu_map(struct workqueue_struct *wq)
 		? cpu_singlethread_map : cpu_populated_map;
 }
 
+/*
+ * rt and freezeable workqueues keep dedicated threads: the pool workers
+ * are neither, and are shared with everybody else.
+ */
+static inline int is_wq_pooled(struct workqueue_struct *wq)
+{
+	return !wq->rt && !wq->freezeable;
+}
+
 static
 struct cpu_workqueue_struct *wq_per_cpu(struct workqueue_struct *wq, int cpu)
 {
@@ -125,6 +252,176 @@ struct cpu_workqueue_struct *get_wq_data(struct work_struct *work)
 	return (void *) (atomic_long_read(&work->data) & WORK_STRUCT_WQ_DATA_MASK);
 }
 
+struct wq_barrier {
+	struct work_struct	work;
+	struct completion	done;
+};
+
+static void wq_barrier_func(struct work_struct *work)
+{
+	struct wq_barrier *barr = container_of(work, struct wq_barrier, work);
+	complete(&barr->done);
+}
+
+static inline int need_more_worker(struct worker_pool *pool)
+{
+	return !list_empty(&pool->worklist) &&
+		((pool->flags & POOL_DISASSOCIATED) ||
+		 !atomic_read(&pool->nr_running));
+}
+
+static inline int keep_working(struct worker_pool *pool)
+{
+	return !list_empty(&pool->worklist) &&
+		((pool->flags & POOL_DISASSOCIATED) ||
+		 atomic_read(&pool->nr_running) <= 1);
+}
+
+/* Called with pool->lock held. */
+static void wake_up_worker(struct worker_pool *pool)
+{
+	struct worker *worker;
+
+	if (list_empty(&pool->idle_list))
+		return;
+	worker = list_first_entry(&pool->idle_list, struct worker, entry);
+	wake_up_process(worker->task);
+}
+
+/*
+ * Pick the pool which is going to run @cwq.  Called with cwq->lock held
+ * and irqs disabled, which keeps cpu hotplug from disassociating the
+ * pool under us.
+ */
+static struct worker_pool *cwq_pick_pool(struct cpu_workqueue_struct *cwq)
+{
+	struct worker_pool *pool = cwq->home;
+
+	if (!pool || (pool->flags & POOL_DISASSOCIATED))
+		pool = &per_cpu(worker_pools, raw_smp_processor_id());
+	return pool;
+}
+
+/*
+ * Put @cwq at the tail of @pool's worklist.  Called with cwq->lock and
+ * pool->lock held.
+ */
+static void pool_add_cwq(struct worker_pool *pool,
+			 struct cpu_workqueue_struct *cwq)
+{
+	cwq->pool = pool;
+	list_add_tail(&cwq->pool_entry, &pool->worklist);
+	if (cwq->wq->rescuer && !timer_pending(&pool->mayday_timer))
+		mod_timer(&pool->mayday_timer, jiffies + MAYDAY_INITIAL_TIMEOUT);
+}
+
+/*
+ * Nobody is running @cwq any more and it's on no worklist.  Called with
+ * cwq->lock held.
+ */
+static void cwq_release(struct cpu_workqueue_struct *cwq)
+{
+	cwq->pool = NULL;
+	if (unlikely(cwq->release_done))
+		complete(cwq->release_done);
+}
+
+/*
+ * Put @cwq at the tail of the worklist of the pool which is to run it,
+ * and make sure a worker is coming if that's not @pool, the pool we're
+ * running from (NULL if none).  Called with cwq->lock held.
+ */
+static void cwq_requeue(struct cpu_workqueue_struct *cwq,
+			struct worker_pool *pool)
+{
+	struct worker_pool *next = cwq_pick_pool(cwq);
+
+	spin_lock(&next->lock);
+	pool_add_cwq(next, cwq);
+	if (next != pool && need_more_worker(next))
+		wake_up_worker(next);
+	spin_unlock(&next->lock);
+}
+
+/*
+ * Return the worker of @cwq which is running @work, if any.  Called with
+ * cwq->lock held.
+ */
+static struct worker *cwq_find_worker(struct cpu_workqueue_struct *cwq,
+				      struct work_struct *work)
+{
+	struct worker *worker;
+
+	list_for_each_entry(worker, &cwq->busy_list, busy_entry)
+		if (worker->current_work == work)
+			return worker;
+	return NULL;
+}
+
+/*
+ * Return the work a worker may start on @cwq now, NULL if none: no more
+ * than wq->max_active works run at once, a work isn't run again while
+ * it's still running, and a barrier waits for everything before it.
+ * Called with cwq->lock held.
+ */
+static struct work_struct *cwq_next_work(struct cpu_workqueue_struct *cwq)
+{
+	struct work_struct *work;
+
+	if (cwq->nr_active >= cwq->wq->max_active)
+		return NULL;
+
+	list_for_each_entry(work, &cwq->worklist, entry) {
+		if (work->func == wq_barrier_func)
+			return cwq->nr_active ? NULL : work;
+		if (!cwq_find_worker(cwq, work))
+			return work;
+	}
+	return NULL;
+}
+
+/*
+ * Done running @cwq for now: requeue it at the tail if there's more, so
+ * that one busy workqueue can't starve the others on this cpu, or let go
+ * of it.  @pool is the pool it was run from, NULL for the rescuer.
+ *
+ * While other workers are still running works of @cwq and there's nothing
+ * more it can start, it's parked instead: it keeps ->pool, and whoever
+ * next queues a work it can start or completes one of its works requeues
+ * or releases it.  Called with cwq->lock held.
+ */
+static void cwq_done(struct cpu_workqueue_struct *cwq,
+		     struct worker_pool *pool)
+{
+	if (cwq_next_work(cwq))
+		cwq_requeue(cwq, pool);
+	else if (cwq->nr_active)
+		cwq->parked = 1;
+	else
+		cwq_release(cwq);
+}
+
+/*
+ * Work has been added to @cwq, make sure somebody is going to run it.
+ * Called with cwq->lock held.
+ */
+static void cwq_kick(struct cpu_workqueue_struct *cwq)
+{
+	if (!is_wq_pooled(cwq->wq)) {
+		wake_up(&cwq->more_work);
+		return;
+	}
+
+	/* already queued, or whoever runs it will see the new work */
+	if (cwq->pool) {
+		if (!cwq->parked || !cwq_next_work(cwq))
+			return;
+		cwq->parked = 0;
+	}
+
+	cwq_requeue(cwq, NULL);
+}
+
 static void insert_work(struct cpu_workqueue_struct *cwq,
 			struct work_struct *work, struct list_head *head)
 {
@@ -135,7 +432,7 @@ static void insert_work(struct cpu_workqueue_struct *cwq,
 	 */
 	smp_wmb();
 	list_add_tail(&work->entry, head);
-	wake_up(&cwq->more_work);
+	cwq_kick(cwq);
 }
 
 static void __queue_work(struct cpu_workqueue_struct *cwq,
@@ -259,6 +556,75 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 }
 EXPORT_SYMBOL_GPL(queue_delayed_work_on);
 
+/*
+ * Run @work off @cwq->worklist, on behalf of @worker if it's a pool
+ * worker or the rescuer.  Called with cwq->lock held and irqs disabled,
+ * drops it around the callback.
+ */
+static void run_one_work(struct cpu_workqueue_struct *cwq,
+			 struct work_struct *work, struct worker *worker)
+{
+	work_func_t f = work->func;
+	struct wq_barrier *barr, *next;
+#ifdef CONFIG_LOCKDEP
+	/*
+	 * It is permissible to free the struct work_struct
+	 * from inside the function that is called from it,
+	 * this we need to take into account for lockdep too.
+	 * To avoid bogus "held lock freed" warnings as well
+	 * as problems when looking into work->lockdep_map,
+	 * make a copy and use that here.
+	 */
+	struct lockdep_map lockdep_map = work->lockdep_map;
+#endif
+
+	if (worker) {
+		worker->current_cwq = cwq;
+		worker->current_work = work;
+		list_add(&worker->busy_entry, &cwq->busy_list);
+		cwq->nr_active++;
+	} else
+		cwq->current_work = work;
+	list_del_init(&work->entry);
+	spin_unlock_irq(&cwq->lock);
+
+	BUG_ON(get_wq_data(work) != cwq);
+	work_clear_pending(work);
+	lock_map_acquire(&cwq->wq->lockdep_map);
+	lock_map_acquire(&lockdep_map);
+	f(work);
+	lock_map_release(&lockdep_map);
+	lock_map_release(&cwq->wq->lockdep_map);
+
+	if (unlikely(in_atomic() || lockdep_depth(current) > 0)) {
+		printk(KERN_ERR "BUG: workqueue leaked lock or atomic: "
+				"%s/0x%08x/%d\n",
+				current->comm, preempt_count(),
+			       	task_pid_nr(current));
+		printk(KERN_ERR "    last function: ");
+		print_symbol("%s\n", (unsigned long)f);
+		debug_show_held_locks(current);
+		dump_stack();
+	}
+
+	spin_lock_irq(&cwq->lock);
+	if (!worker) {
+		cwq->current_work = NULL;
+		return;
+	}
+
+	list_del(&worker->busy_entry);
+	cwq->nr_active--;
+	worker->current_work = NULL;
+	worker->current_cwq = NULL;
+
+	/* wake up flush_work() and cancel_work_sync() waiting for @work */
+	list_for_each_entry_safe(barr, next, &worker->barriers, work.entry) {
+		list_del_init(&barr->work.entry);
+		complete(&barr->done);
+	}
+}
+
 static void run_workqueue(struct cpu_workqueue_struct *cwq)
 {
 	spin_lock_irq(&cwq->lock);
@@ -269,53 +635,18 @@ static void run_workqueue(struct cpu_workqueue_struct *cwq)
 			__func__, cwq->run_depth);
 		dump_stack();
 	}
-	while (!list_empty(&cwq->worklist)) {
-		struct work_struct *work = list_entry(cwq->worklist.next,
-						struct work_struct, entry);
-		work_func_t f = work->func;
-#ifdef CONFIG_LOCKDEP
-		/*
-		 * It is permissible to free the struct work_struct
-		 * from inside the function that is called from it,
-		 * this we need to take into account for lockdep too.
-		 * To avoid bogus "held lock freed" warnings as well
-		 * as problems when looking into work->lockdep_map,
-		 * make a copy and use that here.
-		 */
-		struct lockdep_map lockdep_map = work->lockdep_map;
-#endif
-
-		cwq->current_work = work;
-		list_del_init(cwq->worklist.next);
-		spin_unlock_irq(&cwq->lock);
-
-		BUG_ON(get_wq_data(work) != cwq);
-		work_clear_pending(work);
-		lock_map_acquire(&cwq->wq->lockdep_map);
-		lock_map_acquire(&lockdep_map);
-		f(work);
-		lock_map_release(&lockdep_map);
-		lock_map_release(&cwq->wq->lockdep_map);
-
-		if (unlikely(in_atomic() || lockdep_depth(current) > 0)) {
-			printk(KERN_ERR "BUG: workqueue leaked lock or atomic: "
-					"%s/0x%08x/%d\n",
-					current->comm, preempt_count(),
-				       	task_pid_nr(current));
-			printk(KERN_ERR "    last function: ");
-			print_symbol("%s\n", (unsigned long)f);
-			debug_show_held_locks(current);
-			dump_stack();
-		}
-
-		spin_lock_irq(&cwq->lock);
-		cwq->current_work = NULL;
-	}
+	while (!list_empty(&cwq->worklist))
+		run_one_work(cwq, list_entry(cwq->worklist.next,
+					     struct work_struct, entry), NULL);
 	cwq->run_depth--;
 	spin_unlock_irq(&cwq->lock);
 }
 
-static int worker_thread(void *__cwq)
+/*
+ * Thread function of the dedicated per-cwq threads of rt and freezeable
+ * workqueues.
+ */
+static int cwq_thread(void *__cwq)
 {
 	struct cpu_workqueue_struct *cwq = __cwq;
 	DEFINE_WAIT(wait);
@@ -344,33 +675,446 @@ static int worker_thread(void *__cwq)
 	return 0;
 }
 
-struct wq_barrier {
-	struct work_struct	work;
-	struct completion	done;
-};
+/*
+ * Worker flags are changed under pool->lock with irqs disabled.  Moving
+ * in or out of the WORKER_NOT_RUNNING states adjusts pool->nr_running.
+ */
+static void worker_set_flags(struct worker *worker, unsigned int flags)
+{
+	if ((flags & WORKER_NOT_RUNNING) &&
+	    !(worker->flags & WORKER_NOT_RUNNING))
+		atomic_dec(&worker->pool->nr_running);
+	worker->flags |= flags;
+}
 
-static void wq_barrier_func(struct work_struct *work)
+static void worker_clr_flags(struct worker *worker, unsigned int flags)
 {
-	struct wq_barrier *barr = container_of(work, struct wq_barrier, work);
-	complete(&barr->done);
+	unsigned int oflags = worker->flags;
+
+	worker->flags &= ~flags;
+	if ((oflags & WORKER_NOT_RUNNING) &&
+	    !(worker->flags & WORKER_NOT_RUNNING))
+		atomic_inc(&worker->pool->nr_running);
 }
 
-static void insert_wq_barrier(struct cpu_workqueue_struct *cwq,
-			struct wq_barrier *barr, struct list_head *head)
+static void worker_enter_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	worker_set_flags(worker, WORKER_IDLE);
+	list_add(&worker->entry, &pool->idle_list);
+	pool->nr_idle++;
+
+	if (pool->flags & POOL_DISASSOCIATED)
+		wake_up(&pool->drain_wait);
+}
+
+static void worker_leave_idle(struct worker *worker)
+{
+	worker_clr_flags(worker, WORKER_IDLE);
+	list_del_init(&worker->entry);
+	worker->pool->nr_idle--;
+}
+
+/*
+ * Bind the calling worker to its pool's cpu unless that has gone away.
+ * Only bound workers take part in concurrency management.
+ */
+static void worker_maybe_bind(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	if (!(worker->flags & WORKER_UNBOUND) ||
+	    (pool->flags & POOL_DISASSOCIATED))
+		return;
+
+	if (set_cpus_allowed_ptr(current, cpumask_of(pool->cpu)))
+		return;
+
+	spin_lock_irq(&pool->lock);
+	if (!(pool->flags & POOL_DISASSOCIATED) &&
+	    raw_smp_processor_id() == pool->cpu) {
+		current->flags |= PF_THREAD_BOUND;
+		worker_clr_flags(worker, WORKER_UNBOUND);
+	}
+	spin_unlock_irq(&pool->lock);
+}
+
+/**
+ * wq_worker_waking_up - a worker is waking up
+ * @task: task waking up
+ * @cpu: cpu @task is waking up to
+ *
+ * Called from try_to_wake_up() with the runqueue lock of @cpu held.
+ */
+void wq_worker_waking_up(struct task_struct *task, unsigned int cpu)
+{
+	struct worker *worker = task->wq_worker;
+
+	if (!(worker->flags & WORKER_NOT_RUNNING))
+		atomic_inc(&worker->pool->nr_running);
+}
+
+/**
+ * wq_worker_sleeping - a worker is going to sleep
+ * @task: task going to sleep
+ * @cpu: cpu in question, must be the current cpu
+ *
+ * Called from schedule() with the runqueue lock of @cpu held.  Returns
+ * the idle worker to wake up if @task was the last running worker of
+ * its pool and there's work pending, NULL otherwise.
+ */
+struct task_struct *wq_worker_sleeping(struct task_struct *task,
+				       unsigned int cpu)
+{
+	struct worker *worker = task->wq_worker, *to_wakeup;
+	struct worker_pool *pool = worker->pool;
+
+	if (worker->flags & WORKER_NOT_RUNNING)
+		return NULL;
+
+	if (WARN_ON_ONCE(pool->cpu != cpu))
+		return NULL;
+
+	if (!atomic_dec_and_test(&pool->nr_running) ||
+	    list_empty(&pool->worklist))
+		return NULL;
+
+	/*
+	 * We can't take pool->lock under the runqueue lock.  The idle
+	 * list is only changed under pool->lock by bound workers, all of
+	 * which run on this cpu, and we have irqs disabled here, so it
+	 * can't change under us.
+	 */
+	if (list_empty(&pool->idle_list))
+		return NULL;
+	to_wakeup = list_first_entry(&pool->idle_list, struct worker, entry);
+	if (to_wakeup->flags & WORKER_UNBOUND)
+		return NULL;
+	return to_wakeup->task;
+}
+
+static int worker_thread(void *__worker);
+
+/*
+ * Create a new worker for @pool.  It's not started, the caller has to
+ * wake_up_process() it.  Returns NULL on failure.
+ */
+static struct worker *create_worker(struct worker_pool *pool)
+{
+	struct worker *worker;
+	struct task_struct *p;
+	int id;
+
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (!worker)
+		return NULL;
+
+	spin_lock_irq(&pool->lock);
+	id = pool->next_id++;
+	spin_unlock_irq(&pool->lock);
+
+	INIT_LIST_HEAD(&worker->entry);
+	INIT_LIST_HEAD(&worker->barriers);
+	worker->pool = pool;
+	worker->id = id;
+	worker->flags = WORKER_PREP | WORKER_UNBOUND;
+
+	p = kthread_create(worker_thread, worker, "kworker/%u:%d",
+			   pool->cpu, id);
+	if (IS_ERR(p)) {
+		kfree(worker);
+		return NULL;
+	}
+	worker->task = p;
+
+	spin_lock_irq(&pool->lock);
+	list_add_tail(&worker->node, &pool->workers);
+	pool->nr_workers++;
+	pool->nr_starting++;
+	spin_unlock_irq(&pool->lock);
+
+	return worker;
+}
+
+/*
+ * Take the first cwq off @worker's pool worklist and run one work of it.
+ * Called with pool->lock held and irqs disabled, drops it meanwhile.
+ */
+static void process_one_cwq(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+	struct cpu_workqueue_struct *cwq;
+	struct work_struct *work;
+	int requeued = 0;
+
+	cwq = list_first_entry(&pool->worklist, struct cpu_workqueue_struct,
+			       pool_entry);
+	list_del_init(&cwq->pool_entry);
+	spin_unlock(&pool->lock);
+
+	spin_lock(&cwq->lock);
+	work = cwq_next_work(cwq);
+	if (work) {
+		/*
+		 * If the cwq may run more works at once, hand it back to
+		 * the pool now: should ours block, the worker woken up in
+		 * our place goes on with the next one.
+		 */
+		if (cwq->nr_active + 1 < cwq->wq->max_active &&
+		    !list_is_singular(&cwq->worklist)) {
+			cwq_requeue(cwq, pool);
+			requeued = 1;
+		}
+		run_one_work(cwq, work, worker);
+	}
+	if (!requeued || cwq->parked) {
+		cwq->parked = 0;
+		cwq_done(cwq, pool);
+	}
+	spin_unlock(&cwq->lock);
+
+	spin_lock(&pool->lock);
+}
+
+static int worker_thread(void *__worker)
+{
+	struct worker *worker = __worker;
+	struct worker_pool *pool = worker->pool;
+	int spare_failed = 0;
+	long timeout;
+
+	current->wq_worker = worker;
+	current->flags |= PF_WQ_WORKER;
+	set_user_nice(current, -5);
+	worker_maybe_bind(worker);
+
+	spin_lock_irq(&pool->lock);
+	pool->nr_starting--;
+
+	for (;;) {
+		if (need_more_worker(pool)) {
+			/*
+			 * Make sure there's somebody left to take over
+			 * should the work we're about to run block.  If we
+			 * can't create a worker, carry on anyway.
+			 */
+			if (!pool->nr_idle && !pool->nr_starting &&
+			    !(pool->flags & POOL_DISASSOCIATED) &&
+			    !spare_failed) {
+				struct worker *spare;
+
+				spin_unlock_irq(&pool->lock);
+				spare = create_worker(pool);
+				if (spare)
+					wake_up_process(spare->task);
+				else
+					spare_failed = 1;
+				spin_lock_irq(&pool->lock);
+				continue;
+			}
+			spare_failed = 0;
+
+			worker_clr_flags(worker, WORKER_PREP);
+			do {
+				process_one_cwq(worker);
+			} while (keep_working(pool));
+			worker_set_flags(worker, WORKER_PREP);
+			continue;
+		}
+
+		if (pool->flags & POOL_STOPPING)
+			break;
+
+		worker_enter_idle(worker);
+		__set_current_state(TASK_INTERRUPTIBLE);
+		spin_unlock_irq(&pool->lock);
+
+		timeout = schedule_timeout(IDLE_WORKER_TIMEOUT);
+		worker_maybe_bind(worker);
+
+		spin_lock_irq(&pool->lock);
+		worker_leave_idle(worker);
+
+		/* retire if we timed out and another idle worker is left */
+		if (!timeout && pool->nr_idle && list_empty(&pool->worklist))
+			break;
+	}
+
+	list_del(&worker->node);
+	pool->nr_workers--;
+	current->flags &= ~PF_WQ_WORKER;
+	current->wq_worker = NULL;
+	wake_up(&pool->drain_wait);
+	spin_unlock_irq(&pool->lock);
+
+	kfree(worker);
+	return 0;
+}
+
+/* Called with pool->lock held. */
+static void send_mayday(struct cpu_workqueue_struct *cwq)
+{
+	struct workqueue_struct *wq = cwq->wq;
+
+	spin_lock(&wq->mayday_lock);
+	if (list_empty(&cwq->mayday_entry)) {
+		list_add_tail(&cwq->mayday_entry, &wq->mayday_list);
+		wake_up_process(wq->rescuer->task);
+	}
+	spin_unlock(&wq->mayday_lock);
+}
+
+/*
+ * Work of a reclaim workqueue has been waiting on the pool for a while.
+ * If none of the workers is running, they are all blocked or still being
+ * created, which may need memory only that work can free: call in the
+ * rescuers.
+ */
+static void pool_mayday_timeout(unsigned long __pool)
+{
+	struct worker_pool *pool = (void *)__pool;
+	struct cpu_workqueue_struct *cwq;
+	int rearm = 0;
+
+	spin_lock_irq(&pool->lock);
+	list_for_each_entry(cwq, &pool->worklist, pool_entry) {
+		if (!cwq->wq->rescuer)
+			continue;
+		if (need_more_worker(pool))
+			send_mayday(cwq);
+		rearm = 1;
+	}
+	if (rearm)
+		mod_timer(&pool->mayday_timer, jiffies + MAYDAY_INTERVAL);
+	spin_unlock_irq(&pool->lock);
+}
+
+/*
+ * Take @cwq off the pool it's waiting on and run the works it has now.
+ * The cwq stays owned through ->pool meanwhile, so no worker picks it up
+ * behind the rescuer's back.
+ */
+static void rescue_cwq(struct worker *rescuer, struct cpu_workqueue_struct *cwq)
+{
+	struct worker_pool *pool;
+	struct work_struct *work;
+	struct list_head *pos;
+	int nr_works = 0;
+
+	spin_lock_irq(&cwq->lock);
+	pool = cwq->pool;
+	if (!pool)
+		goto out_unlock;
+	spin_lock(&pool->lock);
+	if (list_empty(&cwq->pool_entry)) {
+		/* a worker got to it first */
+		spin_unlock(&pool->lock);
+		goto out_unlock;
+	}
+	list_del_init(&cwq->pool_entry);
+	spin_unlock(&pool->lock);
+	spin_unlock_irq(&cwq->lock);
+
+	/* best effort, the works don't depend on it for correctness */
+	if (!(pool->flags & POOL_DISASSOCIATED))
+		set_cpus_allowed_ptr(current, cpumask_of(pool->cpu));
+
+	spin_lock_irq(&cwq->lock);
+	list_for_each(pos, &cwq->worklist)
+		nr_works++;
+	while (nr_works-- && (work = cwq_next_work(cwq)))
+		run_one_work(cwq, work, rescuer);
+	cwq_done(cwq, NULL);
+out_unlock:
+	spin_unlock_irq(&cwq->lock);
+}
+
+static int rescuer_thread(void *__wq)
+{
+	struct workqueue_struct *wq = __wq;
+	struct cpu_workqueue_struct *cwq;
+
+	set_user_nice(current, -5);
+
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock_irq(&wq->mayday_lock);
+		if (list_empty(&wq->mayday_list)) {
+			spin_unlock_irq(&wq->mayday_lock);
+			if (kthread_should_stop())
+				break;
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		cwq = list_first_entry(&wq->mayday_list,
+				       struct cpu_workqueue_struct, mayday_entry);
+		list_del_init(&cwq->mayday_entry);
+		spin_unlock_irq(&wq->mayday_lock);
+
+		rescue_cwq(wq->rescuer, cwq);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static void init_wq_barrier(struct wq_barrier *barr)
 {
 	INIT_WORK(&barr->work, wq_barrier_func);
 	__set_bit(WORK_STRUCT_PENDING, work_data_bits(&barr->work));
 
 	init_completion(&barr->done);
+}
 
+static void insert_wq_barrier(struct cpu_workqueue_struct *cwq,
+			struct wq_barrier *barr, struct list_head *head)
+{
+	init_wq_barrier(barr);
 	insert_work(cwq, &barr->work, head);
 }
 
+/*
+ * Make @barr complete once @work, if it's running on @cwq, returns.
+ * Called with cwq->lock held.  Returns 0 if @work isn't running.
+ */
+static int insert_wq_barrier_running(struct cpu_workqueue_struct *cwq,
+				     struct wq_barrier *barr,
+				     struct work_struct *work)
+{
+	struct worker *worker = cwq_find_worker(cwq, work);
+
+	if (worker) {
+		init_wq_barrier(barr);
+		list_add_tail(&barr->work.entry, &worker->barriers);
+		return 1;
+	}
+	if (cwq->current_work == work) {
+		insert_wq_barrier(cwq, barr, cwq->worklist.next);
+		return 1;
+	}
+	return 0;
+}
+
+/* Is the current task running work off @cwq? */
+static inline int cwq_is_current(struct cpu_workqueue_struct *cwq)
+{
+	struct worker *worker = NULL;
+
+	if (cwq->thread == current)
+		return 1;
+	if (current->flags & PF_WQ_WORKER)
+		worker = current->wq_worker;
+	else if (cwq->wq->rescuer && cwq->wq->rescuer->task == current)
+		worker = cwq->wq->rescuer;
+	return worker && worker->current_cwq == cwq;
+}
+
 static int flush_cpu_workqueue(struct cpu_workqueue_struct *cwq)
 {
 	int active;
 
-	if (cwq->thread == current) {
+	if (cwq_is_current(cwq)) {
 		/*
 		 * Probably keventd trying to flush its own queue. So simply run
 		 * it by hand rather than deadlocking.
@@ -382,7 +1126,8 @@ static int flush_cpu_workqueue(struct cpu_workqueue_struct *cwq)
 
 		active = 0;
 		spin_lock_irq(&cwq->lock);
-		if (!list_empty(&cwq->worklist) || cwq->current_work != NULL) {
+		if (!list_empty(&cwq->worklist) || cwq->current_work != NULL ||
+		    cwq->nr_active) {
 			insert_wq_barrier(cwq, &barr, &cwq->worklist);
 			active = 1;
 		}
@@ -434,8 +1179,8 @@ EXPORT_SYMBOL_GPL(flush_workqueue);
 int flush_work(struct work_struct *work)
 {
 	struct cpu_workqueue_struct *cwq;
-	struct list_head *prev;
 	struct wq_barrier barr;
+	int waiting = 0;
 
 	might_sleep();
 	cwq = get_wq_data(work);
@@ -445,7 +1190,6 @@ int flush_work(struct work_struct *work)
 	lock_map_acquire(&cwq->wq->lockdep_map);
 	lock_map_release(&cwq->wq->lockdep_map);
 
-	prev = NULL;
 	spin_lock_irq(&cwq->lock);
 	if (!list_empty(&work->entry)) {
 		/*
@@ -453,18 +1197,14 @@ int flush_work(struct work_struct *work)
 		 * If it was re-queued under us we are not going to wait.
 		 */
 		smp_rmb();
-		if (unlikely(cwq != get_wq_data(work)))
-			goto out;
-		prev = &work->entry;
-	} else {
-		if (cwq->current_work != work)
-			goto out;
-		prev = &cwq->worklist;
-	}
-	insert_wq_barrier(cwq, &barr, prev->next);
-out:
+		if (likely(cwq == get_wq_data(work))) {
+			insert_wq_barrier(cwq, &barr, work->entry.next);
+			waiting = 1;
+		}
+	} else
+		waiting = insert_wq_barrier_running(cwq, &barr, work);
 	spin_unlock_irq(&cwq->lock);
-	if (!prev)
+	if (!waiting)
 		return 0;
 
 	wait_for_completion(&barr.done);
@@ -515,13 +1255,10 @@ static void wait_on_cpu_work(struct cpu_workqueue_struct *cwq,
 				struct work_struct *work)
 {
 	struct wq_barrier barr;
-	int running = 0;
+	int running;
 
 	spin_lock_irq(&cwq->lock);
-	if (unlikely(cwq->current_work == work)) {
-		insert_wq_barrier(cwq, &barr, cwq->worklist.next);
-		running = 1;
-	}
+	running = insert_wq_barrier_running(cwq, &barr, work);
 	spin_unlock_irq(&cwq->lock);
 
 	if (unlikely(running))
@@ -745,7 +1482,7 @@ int current_is_keventd(void)
 	BUG_ON(!keventd_wq);
 
 	cwq = per_cpu_ptr(keventd_wq->cpu_wq, cpu);
-	if (current == cwq->thread)
+	if (cwq_is_current(cwq))
 		ret = 1;
 
 	return ret;
@@ -761,6 +1498,11 @@ init_cpu_workqueue(struct workqueue_struct *wq, int cpu)
 	spin_lock_init(&cwq->lock);
 	INIT_LIST_HEAD(&cwq->worklist);
 	init_waitqueue_head(&cwq->more_work);
+	INIT_LIST_HEAD(&cwq->pool_entry);
+	INIT_LIST_HEAD(&cwq->busy_list);
+	INIT_LIST_HEAD(&cwq->mayday_entry);
+	if (!is_wq_single_threaded(wq))
+		cwq->home = &per_cpu(worker_pools, cpu);
 
 	return cwq;
 }
@@ -772,7 +1514,7 @@ static int create_workqueue_thread(struct cpu_workqueue_struct *cwq, int cpu)
 	const char *fmt = is_wq_single_threaded(wq) ? "%s" : "%s/%d";
 	struct task_struct *p;
 
-	p = kthread_create(worker_thread, cwq, fmt, wq->name, cpu);
+	p = kthread_create(cwq_thread, cwq, fmt, wq->name, cpu);
 	/*
 	 * Nobody can add the work_struct to this cwq,
 	 *	if (caller is __create_workqueue)
@@ -805,6 +1547,7 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 						int singlethread,
 						int freezeable,
 						int rt,
+						int rescuer,
 						struct lock_class_key *key,
 						const char *lock_name)
 {
@@ -827,12 +1570,35 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 	wq->singlethread = singlethread;
 	wq->freezeable = freezeable;
 	wq->rt = rt;
+	wq->max_active = 1;
 	INIT_LIST_HEAD(&wq->list);
+	spin_lock_init(&wq->mayday_lock);
+	INIT_LIST_HEAD(&wq->mayday_list);
+
+	if (rescuer && is_wq_pooled(wq)) {
+		struct task_struct *p;
+
+		wq->rescuer = kzalloc(sizeof(*wq->rescuer), GFP_KERNEL);
+		if (!wq->rescuer)
+			goto err_free;
+		p = kthread_create(rescuer_thread, wq, "%s", name);
+		if (IS_ERR(p)) {
+			kfree(wq->rescuer);
+			goto err_free;
+		}
+		INIT_LIST_HEAD(&wq->rescuer->entry);
+		INIT_LIST_HEAD(&wq->rescuer->node);
+		INIT_LIST_HEAD(&wq->rescuer->barriers);
+		wq->rescuer->task = p;
+		wake_up_process(p);
+	}
 
 	if (singlethread) {
 		cwq = init_cpu_workqueue(wq, singlethread_cpu);
-		err = create_workqueue_thread(cwq, singlethread_cpu);
-		start_workqueue_thread(cwq, -1);
+		if (!is_wq_pooled(wq)) {
+			err = create_workqueue_thread(cwq, singlethread_cpu);
+			start_workqueue_thread(cwq, -1);
+		}
 	} else {
 		cpu_maps_update_begin();
 		/*
@@ -852,7 +1618,7 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 		 */
 		for_each_possible_cpu(cpu) {
 			cwq = init_cpu_workqueue(wq, cpu);
-			if (err || !cpu_online(cpu))
+			if (err || !cpu_online(cpu) || is_wq_pooled(wq))
 				continue;
 			err = create_workqueue_thread(cwq, cpu);
 			start_workqueue_thread(cwq, cpu);
@@ -865,6 +1631,11 @@ struct workqueue_struct *__create_workqueue_key(const char *name,
 		wq = NULL;
 	}
 	return wq;
+
+err_free:
+	free_percpu(wq->cpu_wq);
+	kfree(wq);
+	return NULL;
 }
 EXPORT_SYMBOL_GPL(__create_workqueue_key);
 
@@ -895,6 +1666,33 @@ static void cleanup_workqueue_thread(struct cpu_workqueue_struct *cwq)
 	cwq->thread = NULL;
 }
 
+/*
+ * Flush a shared workqueue's cwq for destruction.  The barrier completes
+ * while the worker which ran it still holds on to the cwq, so wait for
+ * it to let go as well.
+ */
+static void cleanup_pooled_cwq(struct cpu_workqueue_struct *cwq)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	int busy;
+
+	lock_map_acquire(&cwq->wq->lockdep_map);
+	lock_map_release(&cwq->wq->lockdep_map);
+
+	flush_cpu_workqueue(cwq);
+
+	spin_lock_irq(&cwq->lock);
+	busy = cwq->pool != NULL;
+	if (busy)
+		cwq->release_done = &done;
+	spin_unlock_irq(&cwq->lock);
+
+	if (busy)
+		wait_for_completion(&done);
+	/* cwq_release() is called under ->lock */
+	spin_unlock_wait(&cwq->lock);
+}
+
 /**
  * destroy_workqueue - safely terminate a workqueue
  * @wq: target workqueue
@@ -911,20 +1709,117 @@ void destroy_workqueue(struct workqueue_struct *wq)
 	list_del(&wq->list);
 	spin_unlock(&workqueue_lock);
 
-	for_each_cpu_mask_nr(cpu, *cpu_map)
-		cleanup_workqueue_thread(per_cpu_ptr(wq->cpu_wq, cpu));
+	for_each_cpu_mask_nr(cpu, *cpu_map) {
+		struct cpu_workqueue_struct *cwq = per_cpu_ptr(wq->cpu_wq, cpu);
+
+		if (is_wq_pooled(wq))
+			cleanup_pooled_cwq(cwq);
+		else
+			cleanup_workqueue_thread(cwq);
+	}
  	cpu_maps_update_done();
 
+	if (wq->rescuer) {
+		kthread_stop(wq->rescuer->task);
+		kfree(wq->rescuer);
+	}
+
 	free_percpu(wq->cpu_wq);
 	kfree(wq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
 
+static void pool_wake_up_all(struct worker_pool *pool)
+{
+	struct worker *worker;
+
+	spin_lock_irq(&pool->lock);
+	list_for_each_entry(worker, &pool->workers, node)
+		wake_up_process(worker->task);
+	spin_unlock_irq(&pool->lock);
+}
+
+/*
+ * Bring up the pool of @cpu: create its first worker.  It's started by
+ * pool_online() once the cpu is up.
+ */
+static int pool_prepare(struct worker_pool *pool)
+{
+	spin_lock_irq(&pool->lock);
+	BUG_ON(pool->nr_workers);
+	pool->flags = POOL_DISASSOCIATED;
+	atomic_set(&pool->nr_running, 0);
+	spin_unlock_irq(&pool->lock);
+
+	if (!create_worker(pool))
+		return -ENOMEM;
+	return 0;
+}
+
+static void pool_online(struct worker_pool *pool)
+{
+	spin_lock_irq(&pool->lock);
+	pool->flags &= ~POOL_DISASSOCIATED;
+	spin_unlock_irq(&pool->lock);
+
+	pool_wake_up_all(pool);
+}
+
+/*
+ * Called on the dying cpu with everybody else stopped: the workers are
+ * going to be migrated elsewhere, so they stop being bound and concurrency
+ * managed from now on.
+ */
+static void pool_disassociate(struct worker_pool *pool)
+{
+	struct worker *worker;
+
+	spin_lock(&pool->lock);
+	pool->flags |= POOL_DISASSOCIATED;
+	list_for_each_entry(worker, &pool->workers, node)
+		worker->flags |= WORKER_UNBOUND;
+	atomic_set(&pool->nr_running, 0);
+	spin_unlock(&pool->lock);
+}
+
+static int pool_drained(struct worker_pool *pool)
+{
+	int ret;
+
+	spin_lock_irq(&pool->lock);
+	ret = list_empty(&pool->worklist) && pool->nr_idle == pool->nr_workers;
+	spin_unlock_irq(&pool->lock);
+
+	return ret;
+}
+
+/*
+ * Let the workers of a disassociated pool run whatever is left on it,
+ * then make them exit.  Nothing new gets queued on a disassociated pool.
+ */
+static void pool_stop(struct worker_pool *pool)
+{
+	pool_wake_up_all(pool);
+	wait_event(pool->drain_wait, pool_drained(pool));
+
+	spin_lock_irq(&pool->lock);
+	pool->flags |= POOL_STOPPING;
+	spin_unlock_irq(&pool->lock);
+
+	pool_wake_up_all(pool);
+	wait_event(pool->drain_wait, !ACCESS_ONCE(pool->nr_workers));
+
+	spin_lock_irq(&pool->lock);
+	pool->flags &= ~POOL_STOPPING;
+	spin_unlock_irq(&pool->lock);
+}
+
 static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 						unsigned long action,
 						void *hcpu)
 {
 	unsigned int cpu = (unsigned long)hcpu;
+	struct worker_pool *pool = &per_cpu(worker_pools, cpu);
 	struct cpu_workqueue_struct *cwq;
 	struct workqueue_struct *wq;
 	int ret = NOTIFY_OK;
@@ -934,9 +1829,21 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 	switch (action) {
 	case CPU_UP_PREPARE:
 		cpumask_set_cpu(cpu, cpu_populated_map);
+		if (pool_prepare(pool)) {
+			printk(KERN_ERR "workqueue pool for %i failed\n", cpu);
+			action = CPU_UP_CANCELED;
+			ret = NOTIFY_BAD;
+		}
+		break;
+	case CPU_DYING:
+		pool_disassociate(pool);
+		return NOTIFY_OK;
 	}
 undo:
 	list_for_each_entry(wq, &workqueues, list) {
+		if (is_wq_pooled(wq))
+			continue;
+
 		cwq = per_cpu_ptr(wq->cpu_wq, cpu);
 
 		switch (action) {
@@ -962,8 +1869,12 @@ undo:
 	}
 
 	switch (action) {
+	case CPU_ONLINE:
+		pool_online(pool);
+		break;
 	case CPU_UP_CANCELED:
 	case CPU_POST_DEAD:
+		pool_stop(pool);
 		cpumask_clear_cpu(cpu, cpu_populated_map);
 	}
 
@@ -1013,14 +1924,43 @@ EXPORT_SYMBOL_GPL(work_on_cpu);
 
 void __init init_workqueues(void)
 {
+	int cpu;
+
 	alloc_cpumask_var(&cpu_populated_map, GFP_KERNEL);
 
 	cpumask_copy(cpu_populated_map, cpu_online_mask);
 	singlethread_cpu = cpumask_first(cpu_possible_mask);
 	cpu_singlethread_map = cpumask_of(singlethread_cpu);
+
+	for_each_possible_cpu(cpu) {
+		struct worker_pool *pool = &per_cpu(worker_pools, cpu);
+
+		spin_lock_init(&pool->lock);
+		INIT_LIST_HEAD(&pool->worklist);
+		INIT_LIST_HEAD(&pool->idle_list);
+		INIT_LIST_HEAD(&pool->workers);
+		init_waitqueue_head(&pool->drain_wait);
+		setup_timer(&pool->mayday_timer, pool_mayday_timeout,
+			    (unsigned long)pool);
+		pool->cpu = cpu;
+		pool->flags = POOL_DISASSOCIATED;
+	}
+	for_each_online_cpu(cpu) {
+		struct worker_pool *pool = &per_cpu(worker_pools, cpu);
+
+		BUG_ON(pool_prepare(pool));
+		pool_online(pool);
+	}
+
 	hotcpu_notifier(workqueue_cpu_callback, 0);
 	keventd_wq = create_workqueue("events");
 	BUG_ON(!keventd_wq);
+	/*
+	 * Anybody can queue work on keventd, and much of it blocks: let
+	 * one cwq run several works at once, so the others aren't held
+	 * up behind it.  Nothing can have been queued on it yet.
+	 */
+	keventd_wq->max_active = KEVENTD_MAX_ACTIVE;
 #ifdef CONFIG_SMP
 	work_on_cpu_wq = create_workqueue("work_on_cpu");
 	BUG_ON(!work_on_cpu_wq);
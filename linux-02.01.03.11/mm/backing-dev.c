@@ -6,10 +6,25 @@
 #include <linux/module.h>
 #include <linux/writeback.h>
 #include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 
 
 static struct class *bdi_class;
 
+/*
+ * bdi_lock protects bdi_list and the task and work fields of the flusher
+ * state of each device.  It is taken from timer context, by laptop mode.
+ * bdi_mutex serializes changes to bdi_list against bdi-default forking
+ * flusher threads, which has to sleep.
+ */
+DEFINE_SPINLOCK(bdi_lock);
+LIST_HEAD(bdi_list);
+static DEFINE_MUTEX(bdi_mutex);
+
+/* pdflush is gone; its read-only sysctl stays at zero */
+int nr_pdflush_threads;
+
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
@@ -190,6 +205,12 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 	bdi->dev = dev;
 	bdi_debug_register(bdi, dev_name(dev));
 
+	mutex_lock(&bdi_mutex);
+	spin_lock_bh(&bdi_lock);
+	list_add_tail(&bdi->bdi_list, &bdi_list);
+	spin_unlock_bh(&bdi_lock);
+	mutex_unlock(&bdi_mutex);
+
 exit:
 	return ret;
 }
@@ -201,9 +222,31 @@ int bdi_register_dev(struct backing_dev_info *bdi, dev_t dev)
 }
 EXPORT_SYMBOL(bdi_register_dev);
 
+/*
+ * Take the device off bdi_list, so that bdi-default no longer forks a flusher
+ * thread for it, and stop the one it has.
+ */
+static void bdi_wb_shutdown(struct backing_dev_info *bdi)
+{
+	struct task_struct *task;
+
+	mutex_lock(&bdi_mutex);
+	spin_lock_bh(&bdi_lock);
+	list_del_init(&bdi->bdi_list);
+	/* Clearing ->task keeps the thread from exiting on its own */
+	task = bdi->wb.task;
+	bdi->wb.task = NULL;
+	spin_unlock_bh(&bdi_lock);
+	mutex_unlock(&bdi_mutex);
+
+	if (task)
+		kthread_stop(task);
+}
+
 void bdi_unregister(struct backing_dev_info *bdi)
 {
 	if (bdi->dev) {
+		bdi_wb_shutdown(bdi);
 		bdi_debug_unregister(bdi);
 		device_unregister(bdi->dev);
 		bdi->dev = NULL;
@@ -218,6 +261,11 @@ int bdi_init(struct backing_dev_info *bdi)
 
 	bdi->dev = NULL;
 
+	INIT_LIST_HEAD(&bdi->bdi_list);
+	memset(&bdi->wb, 0, sizeof(bdi->wb));
+	bdi->wb.bdi = bdi;
+	bdi->wb.last_old_flush = jiffies;
+
 	bdi->min_ratio = 0;
 	bdi->max_ratio = 100;
 	bdi->max_prop_frac = PROP_FRAC_BASE;
@@ -254,6 +302,133 @@ void bdi_destroy(struct backing_dev_info *bdi)
 }
 EXPORT_SYMBOL(bdi_destroy);
 
+/*
+ * Does the device need a flusher thread forked?  Called under bdi_lock.
+ */
+static int bdi_needs_task(struct backing_dev_info *bdi)
+{
+	struct bdi_writeback *wb = &bdi->wb;
+
+	if (wb->task || !bdi_cap_writeback_dirty(bdi))
+		return 0;
+	return wb->nr_pages || wb->background || bdi_has_dirty_io(bdi);
+}
+
+static int bdi_pending_fork(void)
+{
+	struct backing_dev_info *bdi;
+	int ret = 0;
+
+	spin_lock_bh(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (!bdi->wb.task &&
+		    (bdi->wb.nr_pages || bdi->wb.background)) {
+			ret = 1;
+			break;
+		}
+	}
+	spin_unlock_bh(&bdi_lock);
+	return ret;
+}
+
+/*
+ * Fork the flusher threads of the devices that need one.  If a fork fails,
+ * do the writeback from here instead, so that it never stalls.
+ */
+static void bdi_fork_threads(void)
+{
+	struct backing_dev_info *bdi;
+
+	mutex_lock(&bdi_mutex);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		struct task_struct *task;
+		int needs_task;
+
+		spin_lock_bh(&bdi_lock);
+		needs_task = bdi_needs_task(bdi);
+		spin_unlock_bh(&bdi_lock);
+		if (!needs_task)
+			continue;
+
+		task = kthread_create(bdi_writeback_thread, &bdi->wb,
+				      "flush-%s", dev_name(bdi->dev));
+		if (IS_ERR(task)) {
+			wb_do_writeback(&bdi->wb);
+			continue;
+		}
+
+		spin_lock_bh(&bdi_lock);
+		bdi->wb.task = task;
+		spin_unlock_bh(&bdi_lock);
+		wake_up_process(task);
+	}
+	mutex_unlock(&bdi_mutex);
+}
+
+/*
+ * bdi-default: the flusher thread of default_backing_dev_info, which also
+ * forks the flusher threads of the other devices, and writes back the
+ * superblocks every dirty_writeback_interval.
+ */
+static int bdi_forker_thread(void *data)
+{
+	struct bdi_writeback *me = data;
+	unsigned long last_sync = jiffies;
+
+	current->flags |= PF_FLUSHER | PF_SWAPWRITE;
+	set_freezable();
+	set_user_nice(current, 0);
+
+	while (!kthread_should_stop()) {
+		if (dirty_writeback_interval &&
+		    time_after_eq(jiffies, last_sync + dirty_writeback_interval)) {
+			last_sync = jiffies;
+			sync_supers();
+		}
+
+		wb_do_writeback(me);
+		bdi_fork_threads();
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (me->nr_pages || me->background || bdi_pending_fork() ||
+		    kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+		if (dirty_writeback_interval)
+			schedule_timeout(dirty_writeback_interval);
+		else
+			schedule();
+		try_to_freeze();
+	}
+
+	return 0;
+}
+
+static int __init default_bdi_init(void)
+{
+	struct backing_dev_info *bdi = &default_backing_dev_info;
+	struct task_struct *task;
+	int err;
+
+	err = bdi_init(bdi);
+	if (err)
+		return err;
+	bdi_register(bdi, NULL, "default");
+
+	task = kthread_create(bdi_forker_thread, &bdi->wb, "bdi-default");
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+
+	spin_lock_bh(&bdi_lock);
+	bdi->wb.task = task;
+	spin_unlock_bh(&bdi_lock);
+	wake_up_process(task);
+
+	return 0;
+}
+subsys_initcall(default_bdi_init);
+
 static wait_queue_head_t congestion_wqh[2] = {
 		__WAIT_QUEUE_HEAD_INITIALIZER(congestion_wqh[0]),
 		__WAIT_QUEUE_HEAD_INITIALIZER(congestion_wqh[1])
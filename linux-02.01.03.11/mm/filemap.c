@@ -1604,8 +1604,89 @@ page_not_uptodate:
 }
 EXPORT_SYMBOL(filemap_fault);
 
+/**
+ * filemap_map_pages - map the cached pages around a read fault
+ * @vma:	vma in which the fault was taken
+ * @vmf:	struct vm_fault with the range to map and its ptes
+ *
+ * Called with the page table lock held, to map the pages from vmf->pgoff
+ * to vmf->max_pgoff which are already in the page cache, up to date and
+ * not locked by anyone else.  Nothing is read in and nothing waits: any
+ * page which does not qualify is simply left for filemap_fault().  Pages
+ * marked for async readahead are left alone too, so that the fault on
+ * them still kicks off the next readahead window.
+ */
+void filemap_map_pages(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct file *file = vma->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	unsigned long address = (unsigned long)vmf->virtual_address;
+	pgoff_t index = vmf->pgoff;
+	struct pagevec pvec;
+	pgoff_t size;
+	int i;
+
+	pagevec_init(&pvec, 0);
+	while (index <= vmf->max_pgoff) {
+		unsigned nr = min_t(pgoff_t, PAGEVEC_SIZE,
+					vmf->max_pgoff - index + 1);
+		pgoff_t next = index + 1;
+
+		if (!pagevec_lookup(&pvec, mapping, index, nr))
+			break;
+
+		for (i = 0; i < pagevec_count(&pvec); i++) {
+			struct page *page = pvec.pages[i];
+			pgoff_t pgoff = page->index;
+			pte_t *pte;
+
+			if (pgoff >= next)
+				next = pgoff + 1;
+			if (pgoff > vmf->max_pgoff)
+				goto skip;
+
+			if (!PageUptodate(page) || PageReadahead(page))
+				goto skip;
+			if (!trylock_page(page))
+				goto skip;
+
+			/* Recheck everything under the page lock */
+			if (page->mapping != mapping || !PageUptodate(page) ||
+			    page->index != pgoff)
+				goto unlock;
+			size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1)
+							>> PAGE_CACHE_SHIFT;
+			if (pgoff >= size)
+				goto unlock;
+
+			pte = vmf->pte + pgoff - vmf->pgoff;
+			if (!pte_none(*pte))
+				goto unlock;
+
+			if (file->f_ra.mmap_miss > 0)
+				file->f_ra.mmap_miss--;
+			/* The pte keeps the reference from the lookup */
+			do_set_pte(vma, address +
+				   ((pgoff - vmf->pgoff) << PAGE_SHIFT),
+				   page, pte, 0, 0);
+			unlock_page(page);
+			continue;
+unlock:
+			unlock_page(page);
+skip:
+			page_cache_release(page);
+		}
+		/* Don't go through pagevec_release(): it drains the LRU */
+		pagevec_reinit(&pvec);
+
+		index = next;
+	}
+}
+EXPORT_SYMBOL(filemap_map_pages);
+
 struct vm_operations_struct generic_file_vm_ops = {
 	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
 };
 
 /* This is used for a general mmap of a disk file */
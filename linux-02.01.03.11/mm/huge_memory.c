@@ -0,0 +1,524 @@
+/*
+ * Transparent huge pages for anonymous memory.
+ *
+ * A page fault in an aligned 2MB range of a private anonymous vma is
+ * served with a single compound page mapped by a pmd, when one can be
+ * allocated without effort, and by regular ptes otherwise.  Applications
+ * with large randomly accessed working sets then need one TLB entry
+ * where they needed 512, and take one fault where they took 512.
+ *
+ * A huge page is mapped by exactly one pmd of one mm: fork splits it
+ * before copying, and so does anything else which needs to see the
+ * individual ptes of the range (get_user_pages, mprotect, mremap, page
+ * table walkers) or to change part of it (munmap, vma splits).  Splitting
+ * replaces the huge pmd by a page table mapping the 512 subpages, which
+ * from then on are ordinary anonymous pages.  The page table is allocated
+ * at fault time and deposited with the huge page, so that splitting can
+ * neither fail nor sleep.
+ *
+ * Huge pages are kept off the LRU lists, on a list of their own; a
+ * shrinker splits the oldest of them under memory pressure, so that
+ * reclaim can swap out their subpages like any others.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/mman.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/spinlock.h>
+#include <linux/memcontrol.h>
+#include <linux/kobject.h>
+#include <linux/init.h>
+#include <linux/huge_mm.h>
+
+#include <asm/tlb.h>
+#include <asm/pgalloc.h>
+#include "internal.h"
+
+unsigned long transparent_hugepage_flags __read_mostly =
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE_ALWAYS
+	(1 << TRANSPARENT_HUGEPAGE_FLAG);
+#else
+	(1 << TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG);
+#endif
+
+/*
+ * Every huge page mapped by a pmd is on huge_page_list, linked through
+ * page->lru of its head page, oldest first.  The list is only changed
+ * with the page_table_lock of the mapping mm held, so that a page is on
+ * the list exactly while it is mapped huge; huge_page_lock nests inside.
+ */
+static LIST_HEAD(huge_page_list);
+static DEFINE_SPINLOCK(huge_page_lock);
+
+static int huge_page_charge(struct page *page, struct mm_struct *mm)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (mem_cgroup_newpage_charge(page + i, mm, GFP_KERNEL)) {
+			while (--i >= 0)
+				mem_cgroup_uncharge_page(page + i);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void huge_page_uncharge(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		mem_cgroup_uncharge_page(page + i);
+}
+
+static void clear_huge_page(struct page *page, unsigned long haddr)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		cond_resched();
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+	}
+}
+
+static inline pmd_t mk_huge_pmd(struct page *page, struct vm_area_struct *vma)
+{
+	pmd_t entry;
+
+	entry = pmd_mkyoung(pmd_mkhuge(mk_pmd(page, vma->vm_page_prot)));
+	if (likely(vma->vm_flags & VM_WRITE))
+		entry = pmd_mkwrite(pmd_mkdirty(entry));
+	return entry;
+}
+
+/*
+ * Allocate, clear and map a huge page for the pmd_none @pmd.  Returns
+ * VM_FAULT_FALLBACK when the caller should fault in a regular page
+ * instead.
+ */
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct anon_vma *anon_vma;
+	struct page *page;
+	pgtable_t pgtable;
+
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+
+	/*
+	 * Not __GFP_COMP yet: the memory controller only charges pages
+	 * which are not compound, so the page is made compound afterwards.
+	 */
+	page = alloc_pages(GFP_HIGHUSER_MOVABLE | __GFP_NOWARN | __GFP_NORETRY,
+			   HPAGE_PMD_ORDER);
+	if (unlikely(!page)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		goto out_free;
+	if (unlikely(huge_page_charge(page, mm))) {
+		pte_free(mm, pgtable);
+		goto out_free;
+	}
+	clear_huge_page(page, haddr);
+	prep_compound_page(page, HPAGE_PMD_ORDER);
+	__SetPageUptodate(page);
+	SetPageSwapBacked(page);
+
+	/* The page table is deposited with the page, for the split */
+	set_page_private(page, (unsigned long)pgtable);
+	anon_vma = vma->anon_vma;
+	page->mapping = (struct address_space *)
+				((void *)anon_vma + PAGE_MAPPING_ANON);
+	page->index = linear_page_index(vma, haddr);
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		/* Raced with another fault: let the access be retried */
+		spin_unlock(&mm->page_table_lock);
+		page->mapping = NULL;
+		set_page_private(page, 0);
+		huge_page_uncharge(page);
+		pte_free(mm, pgtable);
+		put_page(page);
+		return 0;
+	}
+	atomic_set(&page->_mapcount, 0);
+	__mod_zone_page_state(page_zone(page), NR_ANON_PAGES, HPAGE_PMD_NR);
+	__inc_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	add_mm_counter(mm, anon_rss, HPAGE_PMD_NR);
+	set_pmd(pmd, mk_huge_pmd(page, vma));
+	spin_lock(&huge_page_lock);
+	list_add_tail(&page->lru, &huge_page_list);
+	spin_unlock(&huge_page_lock);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FAULT_ALLOC);
+	return 0;
+
+out_free:
+	__free_pages(page, HPAGE_PMD_ORDER);
+	count_vm_event(THP_FAULT_FALLBACK);
+	return VM_FAULT_FALLBACK;
+}
+
+/*
+ * Unmap the huge page mapped by @pmd, for zap_pmd_range() tearing down
+ * its whole range.  Returns 0 if @pmd turned out not to be huge after all.
+ */
+int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+		 pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page;
+	pgtable_t pgtable;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	page = pmd_page(*pmd);
+	pmd_clear(pmd);
+	spin_lock(&huge_page_lock);
+	list_del(&page->lru);
+	spin_unlock(&huge_page_lock);
+	atomic_set(&page->_mapcount, -1);
+	__mod_zone_page_state(page_zone(page), NR_ANON_PAGES, -HPAGE_PMD_NR);
+	__dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	add_mm_counter(mm, anon_rss, -HPAGE_PMD_NR);
+	spin_unlock(&mm->page_table_lock);
+
+	pgtable = (pgtable_t)page_private(page);
+	set_page_private(page, 0);
+	huge_page_uncharge(page);
+	page->mapping = NULL;
+	pte_free(mm, pgtable);
+	/* Freed by the mmu_gather, once the TLBs have been flushed */
+	tlb_remove_page(tlb, page);
+	return 1;
+}
+
+/*
+ * Turn the compound page into HPAGE_PMD_NR ordinary anonymous pages,
+ * each mapped once, and put them on the LRU.
+ */
+static void __split_huge_page(struct page *page, struct vm_area_struct *vma)
+{
+	unsigned long copied = (1L << PG_referenced) | (1L << PG_uptodate) |
+			       (1L << PG_swapbacked);
+	int i;
+
+	for (i = 1; i < HPAGE_PMD_NR; i++) {
+		struct page *tail = page + i;
+
+		VM_BUG_ON(page_count(tail));
+		__ClearPageTail(tail);
+		tail->flags |= page->flags & copied;
+		set_page_private(tail, 0);	/* was ->first_page */
+		tail->mapping = page->mapping;
+		tail->index = page->index + i;
+		atomic_set(&tail->_mapcount, 0);
+		init_page_count(tail);
+	}
+	__ClearPageHead(page);
+	__dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (page_evictable(page + i, vma))
+			lru_cache_add_lru(page + i, LRU_ACTIVE_ANON);
+		else
+			add_page_to_unevictable_list(page + i);
+	}
+}
+
+/*
+ * Replace the huge pmd mapping @address by the page table deposited with
+ * its page.  Called with mmap_sem held.
+ */
+void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd,
+			   unsigned long address)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct vm_area_struct *vma;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t orig;
+	pte_t *pte;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	orig = *pmd;
+	if (unlikely(!pmd_trans_huge(orig))) {
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
+	vma = find_vma(mm, haddr);
+	VM_BUG_ON(!vma || vma->vm_start > haddr ||
+		  vma->vm_end < haddr + HPAGE_PMD_SIZE);
+	page = pmd_page(orig);
+	spin_lock(&huge_page_lock);
+	list_del(&page->lru);
+	spin_unlock(&huge_page_lock);
+
+	/* No cpu may keep using the huge TLB entry once subpages can go */
+	pmd_clear(pmd);
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+
+	__split_huge_page(page, vma);
+
+	pgtable = (pgtable_t)page_private(page);
+	set_page_private(page, 0);
+	pte = (pte_t *)page_address(pgtable);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		pte_t entry = pte_mkdirty(mk_pte(page + i, vma->vm_page_prot));
+
+		if (pmd_write(orig))
+			entry = pte_mkwrite(entry);
+		if (!pmd_young(orig))
+			entry = pte_mkold(entry);
+		set_pte_at(mm, haddr + i * PAGE_SIZE, pte + i, entry);
+	}
+	smp_wmb(); /* See comment in __pte_alloc */
+	mm->nr_ptes++;
+	pmd_populate(mm, pmd, pgtable);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_SPLIT);
+}
+
+static pmd_t *huge_pmd_lookup(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+	return pmd_offset(pud, address);
+}
+
+static void split_huge_page_address(struct mm_struct *mm,
+				    unsigned long address)
+{
+	pmd_t *pmd = huge_pmd_lookup(mm, address);
+
+	if (pmd)
+		split_huge_page_pmd(mm, pmd, address);
+}
+
+/*
+ * A huge pmd which would end up straddling a vma boundary at @address
+ * has to be split before the boundary moves there.
+ */
+static void split_huge_page_boundary(struct vm_area_struct *vma,
+				     unsigned long address)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+
+	if (!vma->anon_vma || vma->vm_ops)
+		return;
+	if ((address & ~HPAGE_PMD_MASK) && haddr >= vma->vm_start &&
+	    haddr + HPAGE_PMD_SIZE <= vma->vm_end)
+		split_huge_page_address(vma->vm_mm, address);
+}
+
+void __vma_adjust_trans_huge(struct vm_area_struct *vma, unsigned long start,
+			     unsigned long end, long adjust_next)
+{
+	split_huge_page_boundary(vma, start);
+	split_huge_page_boundary(vma, end);
+
+	/*
+	 * When vm_next->vm_start moves up, part of next goes to vma:
+	 * the new boundary may fall inside a huge pmd of next.
+	 */
+	if (adjust_next > 0) {
+		struct vm_area_struct *next = vma->vm_next;
+
+		split_huge_page_boundary(next,
+				next->vm_start + (adjust_next << PAGE_SHIFT));
+	}
+}
+
+int hugepage_madvise(struct vm_area_struct *vma, unsigned long *vm_flags,
+		     int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		/* Only private anonymous memory is backed by huge pages */
+		if (vma->vm_file || vma->vm_ops ||
+		    (*vm_flags & (VM_SHARED | VM_HUGETLB | VM_IO | VM_PFNMAP)))
+			return -EINVAL;
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		break;
+	case MADV_NOHUGEPAGE:
+		/* Huge pages already there stay, until split by something */
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Split the oldest huge page, so that reclaim can get at its subpages.
+ * Returns 0 when there are no huge pages left to try.
+ */
+static int split_one_huge_page(void)
+{
+	struct mm_struct *mm = NULL;
+	struct vm_area_struct *vma;
+	struct anon_vma *anon_vma;
+	unsigned long address = 0;
+	struct page *page;
+	pmd_t *pmd;
+
+	spin_lock(&huge_page_lock);
+	if (list_empty(&huge_page_list)) {
+		spin_unlock(&huge_page_lock);
+		return 0;
+	}
+	page = list_entry(huge_page_list.next, struct page, lru);
+	/* Rotate it, so that one we fail to split does not block the rest */
+	list_move_tail(&page->lru, &huge_page_list);
+	/* It is mapped while on the list, so not freed yet */
+	get_page(page);
+	spin_unlock(&huge_page_lock);
+
+	/*
+	 * huge_page_lock nests inside page_table_lock, which rmap takes
+	 * inside the anon_vma lock: only lock the anon_vma once it is
+	 * dropped.  By then the page may have been unmapped or split, so
+	 * page_lock_anon_vma() checks it is still mapped, and the pmd is
+	 * checked again below.  A vma still linked on the anon_vma still
+	 * has its page tables, see free_pgtables().  Find the one pmd
+	 * mapping the page.
+	 */
+	anon_vma = page_lock_anon_vma(page);
+	if (!anon_vma)
+		goto out;
+	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
+		address = vma->vm_start +
+			((page->index - vma->vm_pgoff) << PAGE_SHIFT);
+		if (address < vma->vm_start || address >= vma->vm_end)
+			continue;
+		pmd = huge_pmd_lookup(vma->vm_mm, address);
+		if (!pmd || !pmd_trans_huge(*pmd) || pmd_page(*pmd) != page)
+			continue;
+		if (atomic_inc_not_zero(&vma->vm_mm->mm_users))
+			mm = vma->vm_mm;
+		break;
+	}
+	page_unlock_anon_vma(anon_vma);
+out:
+	put_page(page);
+
+	if (!mm)
+		return 1;
+	if (down_read_trylock(&mm->mmap_sem)) {
+		split_huge_page_address(mm, address);
+		up_read(&mm->mmap_sem);
+	}
+	mmput(mm);
+	return 1;
+}
+
+static int shrink_huge_pages(int nr_to_scan, gfp_t gfp_mask)
+{
+	if (nr_to_scan) {
+		/* mmput() may have to tear down a whole mm */
+		if (!(gfp_mask & __GFP_FS))
+			return -1;
+		while (nr_to_scan-- > 0 && split_one_huge_page())
+			;
+	}
+	return global_page_state(NR_ANON_TRANSPARENT_HUGEPAGES);
+}
+
+static struct shrinker huge_page_shrinker = {
+	.shrink = shrink_huge_pages,
+	.seeks = DEFAULT_SEEKS,
+};
+
+#ifdef CONFIG_SYSFS
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags))
+		return sprintf(buf, "[always] madvise never\n");
+	else if (test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags))
+		return sprintf(buf, "always [madvise] never\n");
+	else
+		return sprintf(buf, "always madvise [never]\n");
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	if (!memcmp("always", buf, min(sizeof("always")-1, count))) {
+		set_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+	} else if (!memcmp("madvise", buf, min(sizeof("madvise")-1, count))) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		set_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags);
+	} else if (!memcmp("never", buf, min(sizeof("never")-1, count))) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+	} else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static struct attribute *hugepage_attrs[] = {
+	&enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.attrs = hugepage_attrs,
+	.name = "transparent_hugepage",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init hugepage_init(void)
+{
+#ifdef CONFIG_SYSFS
+	int err;
+
+	err = sysfs_create_group(mm_kobj, &hugepage_attr_group);
+	if (err) {
+		printk(KERN_ERR "hugepage: register sysfs failed\n");
+		return err;
+	}
+#endif /* CONFIG_SYSFS */
+
+	register_shrinker(&huge_page_shrinker);
+	return 0;
+}
+module_init(hugepage_init)
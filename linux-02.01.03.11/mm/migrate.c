@@ -100,7 +100,7 @@ static void remove_migration_pte(struct vm_area_struct *vma,
                 return;
 
 	pmd = pmd_offset(pud, addr);
-	if (!pmd_present(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		return;
 
 	ptep = pte_offset_map(pmd, addr);
@@ -178,7 +178,9 @@ static void remove_anon_migration_ptes(struct page *old, struct page *new)
 		return;
 
 	/*
-	 * We hold the mmap_sem lock. So no need to call page_lock_anon_vma.
+	 * The page was mapped when migration started, and unmap_and_move()
+	 * holds rcu_read_lock() since, so the anon_vma is still there,
+	 * even without mmap_sem (compaction doesn't take it).
 	 */
 	anon_vma = (struct anon_vma *) (mapping - PAGE_MAPPING_ANON);
 	spin_lock(&anon_vma->lock);
@@ -540,7 +542,8 @@ static int fallback_migrate_page(struct address_space *mapping,
  *   < 0 - error code
  *  == 0 - success
  */
-static int move_to_new_page(struct page *newpage, struct page *page)
+static int move_to_new_page(struct page *newpage, struct page *page,
+			    int remap_swapcache)
 {
 	struct address_space *mapping;
 	int rc;
@@ -576,7 +579,8 @@ static int move_to_new_page(struct page *newpage, struct page *page)
 		rc = fallback_migrate_page(mapping, newpage, page);
 
 	if (!rc) {
-		remove_migration_ptes(page, newpage);
+		if (remap_swapcache)
+			remove_migration_ptes(page, newpage);
 	} else
 		newpage->mapping = NULL;
 
@@ -596,6 +600,7 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	int *result = NULL;
 	struct page *newpage = get_new_page(page, private, &result);
 	int rcu_locked = 0;
+	int remap_swapcache = 1;
 	int charge = 0;
 	struct mem_cgroup *mem;
 
@@ -640,6 +645,19 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	if (PageAnon(page)) {
 		rcu_read_lock();
 		rcu_locked = 1;
+
+		/*
+		 * Without mmap_sem, as from compaction, nothing keeps the
+		 * anon_vma of a page that is no longer mapped: it may be
+		 * freed already.  An unmapped swapcache page has no ptes to
+		 * restore, so it is migrated without touching the anon_vma;
+		 * any other unmapped anon page is about to be freed anyway.
+		 */
+		if (!page_mapped(page)) {
+			if (!PageSwapCache(page))
+				goto rcu_unlock;
+			remap_swapcache = 0;
+		}
 	}
 
 	/*
@@ -669,12 +687,12 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	}
 
 	/* Establish migration ptes or remove ptes */
-	try_to_unmap(page, 1);
+	try_to_unmap(page, TTU_MIGRATION);
 
 	if (!page_mapped(page))
-		rc = move_to_new_page(newpage, page);
+		rc = move_to_new_page(newpage, page, remap_swapcache);
 
-	if (rc)
+	if (rc && remap_swapcache)
 		remove_migration_ptes(page, page);
 rcu_unlock:
 	if (rcu_locked)
@@ -10,6 +10,7 @@
 #include <linux/slab.h>
 #include <linux/pagemap.h>
 #include <linux/mm.h>
+#include <linux/huge_mm.h>
 #include <linux/mman.h>
 #include <linux/syscalls.h>
 #include <linux/swap.h>
@@ -95,6 +96,11 @@ static long do_mincore(unsigned long addr, unsigned char *vec, unsigned long pag
 	if (pud_none_or_clear_bad(pud))
 		goto none_mapped;
 	pmd = pmd_offset(pud, addr);
+	if (pmd_trans_huge(*pmd)) {
+		/* nr does not reach beyond this pmd: all of it is resident */
+		memset(vec, 1, nr);
+		return nr;
+	}
 	if (pmd_none_or_clear_bad(pmd))
 		goto none_mapped;
 
@@ -46,6 +46,7 @@
 #include <linux/page-isolation.h>
 #include <linux/page_cgroup.h>
 #include <linux/debugobjects.h>
+#include <linux/compaction.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -77,6 +78,7 @@ int pageblock_order __read_mostly;
 #endif
 
 static void __free_pages_ok(struct page *page, unsigned int order);
+static void free_pcp_page(struct page *page, int order, int cold);
 
 /*
  * results with 256, 32 in the lowmem_reserve sysctl:
@@ -562,6 +564,13 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 	arch_free_page(page, order);
 	kernel_map_pages(page, 1 << order, 0);
 
+	if (order <= PCP_MAX_ORDER) {
+		if (PageCompound(page) && destroy_compound_page(page, order))
+			return;
+		free_pcp_page(page, order, 0);
+		return;
+	}
+
 	local_irq_save(flags);
 	__count_vm_events(PGFREE, 1 << order);
 	free_one_page(page_zone(page), page, order);
@@ -894,18 +903,25 @@ static int rmqueue_bulk(struct zone *zone, unsigned int order,
  * Note that this function must be called with the thread pinned to
  * a single processor.
  */
-void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
+void drain_zone_pages(struct zone *zone, struct per_cpu_pageset *pset)
 {
 	unsigned long flags;
-	int to_drain;
+	int order;
 
 	local_irq_save(flags);
-	if (pcp->count >= pcp->batch)
-		to_drain = pcp->batch;
-	else
-		to_drain = pcp->count;
-	free_pages_bulk(zone, to_drain, &pcp->list, 0);
-	pcp->count -= to_drain;
+	for (order = 0; order <= PCP_MAX_ORDER; order++) {
+		struct per_cpu_pages *pcp = &pset->pcp[order];
+		int to_drain;
+
+		if (pcp->count >= pcp->batch)
+			to_drain = pcp->batch;
+		else
+			to_drain = pcp->count;
+		if (!to_drain)
+			continue;
+		free_pages_bulk(zone, to_drain, &pcp->list, order);
+		pcp->count -= to_drain;
+	}
 	local_irq_restore(flags);
 }
 #endif
@@ -924,17 +940,20 @@ static void drain_pages(unsigned int cpu)
 
 	for_each_zone(zone) {
 		struct per_cpu_pageset *pset;
-		struct per_cpu_pages *pcp;
+		int order;
 
 		if (!populated_zone(zone))
 			continue;
 
 		pset = zone_pcp(zone, cpu);
 
-		pcp = &pset->pcp;
 		local_irq_save(flags);
-		free_pages_bulk(zone, pcp->count, &pcp->list, 0);
-		pcp->count = 0;
+		for (order = 0; order <= PCP_MAX_ORDER; order++) {
+			struct per_cpu_pages *pcp = &pset->pcp[order];
+
+			free_pages_bulk(zone, pcp->count, &pcp->list, order);
+			pcp->count = 0;
+		}
 		local_irq_restore(flags);
 	}
 }
@@ -992,29 +1011,19 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Put a free block of up to PCP_MAX_ORDER on the per cpu list of the local
+ * cpu, and hand a batch back to the buddy allocator once the list reaches
+ * its high watermark.
  */
-static void free_hot_cold_page(struct page *page, int cold)
+static void free_pcp_page(struct page *page, int order, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
 	unsigned long flags;
 
-	if (PageAnon(page))
-		page->mapping = NULL;
-	if (free_pages_check(page))
-		return;
-
-	if (!PageHighMem(page)) {
-		debug_check_no_locks_freed(page_address(page), PAGE_SIZE);
-		debug_check_no_obj_freed(page_address(page), PAGE_SIZE);
-	}
-	arch_free_page(page, 0);
-	kernel_map_pages(page, 1, 0);
-
-	pcp = &zone_pcp(zone, get_cpu())->pcp;
+	pcp = &zone_pcp(zone, get_cpu())->pcp[order];
 	local_irq_save(flags);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 	if (cold)
 		list_add_tail(&page->lru, &pcp->list);
 	else
@@ -1022,13 +1031,33 @@ static void free_hot_cold_page(struct page *page, int cold)
 	set_page_private(page, get_pageblock_migratetype(page));
 	pcp->count++;
 	if (pcp->count >= pcp->high) {
-		free_pages_bulk(zone, pcp->batch, &pcp->list, 0);
+		free_pages_bulk(zone, pcp->batch, &pcp->list, order);
 		pcp->count -= pcp->batch;
 	}
 	local_irq_restore(flags);
 	put_cpu();
 }
 
+/*
+ * Free a 0-order page
+ */
+static void free_hot_cold_page(struct page *page, int cold)
+{
+	if (PageAnon(page))
+		page->mapping = NULL;
+	if (free_pages_check(page))
+		return;
+
+	if (!PageHighMem(page)) {
+		debug_check_no_locks_freed(page_address(page), PAGE_SIZE);
+		debug_check_no_obj_freed(page_address(page), PAGE_SIZE);
+	}
+	arch_free_page(page, 0);
+	kernel_map_pages(page, 1, 0);
+
+	free_pcp_page(page, 0, cold);
+}
+
 void free_hot_page(struct page *page)
 {
 	free_hot_cold_page(page, 0);
@@ -1057,6 +1086,53 @@ void split_page(struct page *page, unsigned int order)
 		set_page_refcounted(page + i);
 }
 
+#ifdef CONFIG_COMPACTION
+/*
+ * Similar to split_page except the page is already free. As this is only
+ * being used for migration, the migratetype of the block also changes.
+ * As this is called with interrupts disabled, the caller is responsible
+ * for calling arch_alloc_page() and kernel_map_page() after interrupts
+ * are enabled.
+ *
+ * Returns the number of pages split off, 0 if taking them would break
+ * the zone's low watermark.  Called with zone->lock held.
+ */
+int split_free_page(struct page *page)
+{
+	unsigned int order;
+	unsigned long watermark;
+	struct zone *zone;
+
+	BUG_ON(!PageBuddy(page));
+
+	zone = page_zone(page);
+	order = page_order(page);
+
+	/* Obey watermarks as if the page was being allocated */
+	watermark = zone->pages_low + (1 << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return 0;
+
+	/* Remove page from free list */
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+	rmv_page_order(page);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+
+	/* Split into individual pages */
+	set_page_refcounted(page);
+	split_page(page, order);
+
+	if (order >= pageblock_order - 1) {
+		struct page *endpage = page + (1 << order) - 1;
+		for (; page < endpage; page += pageblock_nr_pages)
+			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+	}
+
+	return 1 << order;
+}
+#endif /* CONFIG_COMPACTION */
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1073,13 +1149,13 @@ static struct page *buffered_rmqueue(struct zone *preferred_zone,
 
 again:
 	cpu  = get_cpu();
-	if (likely(order == 0)) {
+	if (likely(order <= PCP_MAX_ORDER)) {
 		struct per_cpu_pages *pcp;
 
-		pcp = &zone_pcp(zone, cpu)->pcp;
+		pcp = &zone_pcp(zone, cpu)->pcp[order];
 		local_irq_save(flags);
 		if (!pcp->count) {
-			pcp->count = rmqueue_bulk(zone, 0,
+			pcp->count = rmqueue_bulk(zone, order,
 					pcp->batch, &pcp->list, migratetype);
 			if (unlikely(!pcp->count))
 				goto failed;
@@ -1098,7 +1174,7 @@ again:
 
 		/* Allocate more to the pcp list if necessary */
 		if (unlikely(&page->lru == &pcp->list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
+			pcp->count += rmqueue_bulk(zone, order,
 					pcp->batch, &pcp->list, migratetype);
 			page = list_entry(pcp->list.next, struct page, lru);
 		}
@@ -1460,6 +1536,62 @@ try_next_zone:
 	return page;
 }
 
+#ifdef CONFIG_COMPACTION
+/* Try memory compaction for high-order allocations before reclaim */
+static struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags)
+{
+	struct zone *preferred_zone;
+	unsigned long compact_result;
+	struct page *page;
+
+	if (!order)
+		return NULL;
+
+	first_zones_zonelist(zonelist, high_zoneidx, nodemask, &preferred_zone);
+	if (!preferred_zone || compaction_deferred(preferred_zone))
+		return NULL;
+
+	current->flags |= PF_MEMALLOC;
+	compact_result = try_to_compact_pages(zonelist, order, gfp_mask,
+						nodemask);
+	current->flags &= ~PF_MEMALLOC;
+	if (compact_result == COMPACT_SKIPPED)
+		return NULL;
+
+	/* Pages freed by migration may still sit on per-cpu lists */
+	drain_all_pages();
+
+	page = get_page_from_freelist(gfp_mask, nodemask, order,
+				zonelist, high_zoneidx, alloc_flags);
+	if (page) {
+		count_vm_event(COMPACTSUCCESS);
+		compaction_succeeded(preferred_zone);
+		return page;
+	}
+
+	/*
+	 * Compaction ran but did not produce a page of this order: back off
+	 * from compacting this zone for a while, reclaim is needed first.
+	 */
+	count_vm_event(COMPACTFAIL);
+	defer_compaction(preferred_zone);
+	cond_resched();
+
+	return NULL;
+}
+#else
+static inline struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags)
+{
+	return NULL;
+}
+#endif /* CONFIG_COMPACTION */
+
 /*
  * This is the 'heart' of the zoned buddy allocator.
  */
@@ -1571,6 +1703,16 @@ nofail_alloc:
 
 	cond_resched();
 
+	/*
+	 * Try direct compaction before reclaim: free memory may be plentiful
+	 * but too fragmented for this order, in which case moving movable
+	 * pages together is cheaper than evicting anything.
+	 */
+	page = __alloc_pages_direct_compact(gfp_mask, order, zonelist,
+				high_zoneidx, nodemask, alloc_flags);
+	if (page)
+		goto got_pg;
+
 	/* We now go into synchronous reclaim */
 	cpuset_memory_pressure_bump();
 	/*
@@ -1887,8 +2029,8 @@ void show_free_areas(void)
 			pageset = zone_pcp(zone, cpu);
 
 			printk("CPU %4d: hi:%5d, btch:%4d usd:%4d\n",
-			       cpu, pageset->pcp.high,
-			       pageset->pcp.batch, pageset->pcp.count);
+			       cpu, pageset->pcp[0].high,
+			       pageset->pcp[0].batch, pageset->pcp[0].count);
 		}
 	}
 
@@ -2717,17 +2859,55 @@ static int zone_batchsize(struct zone *zone)
 	return batch;
 }
 
-static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
+/*
+ * Blocks of order 1 to PCP_MAX_ORDER are moved in batches of about the
+ * same memory as order 0 pages, but fewer of them are kept around: each
+ * cpu caches at most its share of 1/PCP_ORDER_ZONE_FRACTION of the zone
+ * in each order, so that many cpus don't keep too much of the scarcer
+ * larger blocks away from the buddy allocator.
+ */
+#define PCP_ORDER_ZONE_FRACTION	256
+
+static void setup_pageset_order(struct per_cpu_pages *pcp,
+				struct zone *zone, int order)
 {
+	unsigned long batch = 0;
+	unsigned long high = 0;
+
+	if (zone) {
+		batch = zone_batchsize(zone) >> order;
+		high = zone->present_pages /
+			(PCP_ORDER_ZONE_FRACTION * num_possible_cpus());
+		high = min(4 * batch, high >> order);
+	}
+
+	/* a batch must never be bigger than what the list can hold */
+	pcp->count = 0;
+	pcp->high = high;
+	pcp->batch = max(1UL, min(batch, high));
+	INIT_LIST_HEAD(&pcp->list);
+}
+
+/*
+ * Set up the per cpu lists of @zone, or with a NULL @zone lists that hand
+ * every page straight back to the buddy allocator.
+ */
+static void setup_pageset(struct per_cpu_pageset *p, struct zone *zone)
+{
+	unsigned long batch = zone ? zone_batchsize(zone) : 0;
 	struct per_cpu_pages *pcp;
+	int order;
 
 	memset(p, 0, sizeof(*p));
 
-	pcp = &p->pcp;
+	pcp = &p->pcp[0];
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
 	INIT_LIST_HEAD(&pcp->list);
+
+	for (order = 1; order <= PCP_MAX_ORDER; order++)
+		setup_pageset_order(&p->pcp[order], zone, order);
 }
 
 /*
@@ -2740,7 +2920,7 @@ static void setup_pagelist_highmark(struct per_cpu_pageset *p,
 {
 	struct per_cpu_pages *pcp;
 
-	pcp = &p->pcp;
+	pcp = &p->pcp[0];
 	pcp->high = high;
 	pcp->batch = max(1UL, high/4);
 	if ((high/4) > (PAGE_SHIFT * 8))
@@ -2789,7 +2969,7 @@ static int __cpuinit process_zones(int cpu)
 		if (!zone_pcp(zone, cpu))
 			goto bad;
 
-		setup_pageset(zone_pcp(zone, cpu), zone_batchsize(zone));
+		setup_pageset(zone_pcp(zone, cpu), zone);
 
 		if (percpu_pagelist_fraction)
 			setup_pagelist_highmark(zone_pcp(zone, cpu),
@@ -2918,9 +3098,9 @@ static __meminit void zone_pcp_init(struct zone *zone)
 #ifdef CONFIG_NUMA
 		/* Early boot. Slab allocator not functional yet */
 		zone_pcp(zone, cpu) = &boot_pageset[cpu];
-		setup_pageset(&boot_pageset[cpu],0);
+		setup_pageset(&boot_pageset[cpu], NULL);
 #else
-		setup_pageset(zone_pcp(zone,cpu), batch);
+		setup_pageset(zone_pcp(zone, cpu), zone);
 #endif
 	}
 	if (zone->present_pages)
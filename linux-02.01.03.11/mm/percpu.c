@@ -0,0 +1,746 @@
+/*
+ * linux/mm/percpu.c - percpu memory allocator
+ *
+ * This file is released under the GPLv2.
+ *
+ * Dynamic percpu areas are carved out of chunks.  A chunk consists of
+ * nr_cpu_ids units of pcpu_unit_size bytes laid out back to back in the
+ * vmalloc area, unit N belonging to cpu N:
+ *
+ *  c0                           c1                         c2
+ *  -------------------          -------------------        ------------
+ * | u0 | u1 | u2 | u3 |        | u0 | u1 | u2 | u3 |      | u0 | u1 | u
+ *  -------------------  ......  -------------------  ....  ------------
+ *
+ * An area is allocated at the same offset in every unit of a chunk, so
+ * the distance between the copies of an area for two cpus is the same
+ * for all areas of all chunks, and equal to the distance between their
+ * static percpu areas.  The first chunk is the one set up by the arch
+ * code at boot, which holds the static percpu variables of the kernel
+ * (and the module reserve) at its start; the pointer returned for a
+ * dynamic area is its address in the first unit, translated the same
+ * way a static variable's address is.  per_cpu_ptr() is then just base
+ * plus per_cpu_offset(), as for per_cpu(), with no indirection table,
+ * and small objects are packed densely instead of taking a cacheline
+ * each from kmalloc.
+ *
+ * Allocation within a chunk is done through an area map: an array of
+ * ints, one per area in address order, holding the area's size, negated
+ * if the area is in use.  Chunks are kept on lists (slots) by how much
+ * free space they have, so that allocations look at the fullest chunks
+ * that can possibly satisfy them first; the last slot holds fully free
+ * chunks, all but one of which are given back.
+ *
+ * The pages of a chunk are allocated on the node of the cpu owning the
+ * unit they belong to, and mapped when the chunk is created.
+ *
+ * Allocation may sleep.  Freeing can be done from any context.
+ */
+
+#include <linux/bootmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include <asm/cacheflush.h>
+#include <asm/sections.h>
+#include <asm/tlbflush.h>
+
+#define PCPU_SLOT_BASE_SHIFT		5	/* 1-31 shares the same slot */
+#define PCPU_DFL_MAP_ALLOC		16	/* start a map with 16 ents */
+#define PCPU_STATIC_MAP_ALLOC		128	/* map entries of the first chunk */
+
+struct pcpu_chunk {
+	struct list_head	list;		/* linked to pcpu_slot lists */
+	void			*base_addr;	/* base address of this chunk */
+	struct vm_struct	*vm;		/* mapped vmalloc region */
+	int			free_size;	/* free bytes in the chunk */
+	int			contig_hint;	/* max contiguous size hint */
+	int			map_used;	/* # of map entries used */
+	int			map_alloc;	/* # of map entries allocated */
+	int			*map;		/* allocation map */
+	struct page		*page[];	/* #cpus * UNIT_PAGES */
+};
+
+static int pcpu_unit_pages __read_mostly;
+static int pcpu_unit_size __read_mostly;
+static int pcpu_chunk_size __read_mostly;
+static int pcpu_nr_slots __read_mostly;
+static size_t pcpu_chunk_struct_size __read_mostly;
+
+/* the address of the first chunk which starts with the kernel static area */
+void *pcpu_base_addr __read_mostly;
+EXPORT_SYMBOL_GPL(pcpu_base_addr);
+
+static struct pcpu_chunk *pcpu_first_chunk __read_mostly;
+static int pcpu_first_map[PCPU_STATIC_MAP_ALLOC];
+
+/*
+ * pcpu_alloc_mutex serializes allocation, chunk creation and reclaim,
+ * all of which may sleep.  pcpu_lock protects the area maps and the
+ * slot lists; it is irq-safe so that free_percpu() works in any context.
+ *
+ * Only allocation grows an area map, so a map which has been checked
+ * to have room under pcpu_alloc_mutex keeps it until the mutex is
+ * released, even if pcpu_lock is dropped meanwhile.
+ */
+static DEFINE_MUTEX(pcpu_alloc_mutex);
+static DEFINE_SPINLOCK(pcpu_lock);
+
+static struct list_head *pcpu_slot __read_mostly; /* chunk list slots */
+
+/* reclaim work to release fully free chunks, scheduled from free path */
+static void pcpu_reclaim(struct work_struct *work);
+static DECLARE_WORK(pcpu_reclaim_work, pcpu_reclaim);
+
+static int __pcpu_size_to_slot(int size)
+{
+	int highbit = fls(size);	/* size is in bytes */
+	return max(highbit - PCPU_SLOT_BASE_SHIFT + 2, 1);
+}
+
+static int pcpu_size_to_slot(int size)
+{
+	if (size == pcpu_unit_size)
+		return pcpu_nr_slots - 1;
+	return __pcpu_size_to_slot(size);
+}
+
+static int pcpu_chunk_slot(const struct pcpu_chunk *chunk)
+{
+	if (chunk->free_size < sizeof(int) || chunk->contig_hint < sizeof(int))
+		return 0;
+
+	return pcpu_size_to_slot(chunk->free_size);
+}
+
+static void *pcpu_chunk_addr(struct pcpu_chunk *chunk, unsigned int cpu,
+			     int off)
+{
+	return chunk->base_addr + cpu * pcpu_unit_size + off;
+}
+
+static struct page **pcpu_chunk_pagep(struct pcpu_chunk *chunk,
+				      unsigned int cpu, int page_idx)
+{
+	return &chunk->page[cpu * pcpu_unit_pages + page_idx];
+}
+
+/*
+ * A dynamic percpu pointer is the address of the area in the unit of
+ * cpu 0, shifted as a static percpu variable's address is.
+ */
+static void *__addr_to_pcpu_ptr(void *addr)
+{
+	return (void *)((unsigned long)addr - (unsigned long)pcpu_base_addr +
+			(unsigned long)__per_cpu_start);
+}
+
+static void *__pcpu_ptr_to_addr(void *ptr)
+{
+	return (void *)((unsigned long)ptr + (unsigned long)pcpu_base_addr -
+			(unsigned long)__per_cpu_start);
+}
+
+/**
+ * pcpu_chunk_relocate - put chunk in the appropriate chunk slot
+ * @chunk: chunk of interest
+ * @oslot: the previous slot it was on, -1 if not on any
+ *
+ * This function is called after an allocation or free changed @chunk.
+ * New slot according to the changed state is determined and @chunk is
+ * moved to the slot.  Chunks whose free space shrank go to the head of
+ * their new slot, so that allocations keep filling the same chunk.
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ */
+static void pcpu_chunk_relocate(struct pcpu_chunk *chunk, int oslot)
+{
+	int nslot = pcpu_chunk_slot(chunk);
+
+	if (oslot != nslot) {
+		if (oslot < nslot)
+			list_move(&chunk->list, &pcpu_slot[nslot]);
+		else
+			list_move_tail(&chunk->list, &pcpu_slot[nslot]);
+	}
+}
+
+/**
+ * pcpu_chunk_addr_search - search for the chunk containing a percpu area
+ * @addr: address of the area in the unit of cpu 0
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ */
+static struct pcpu_chunk *pcpu_chunk_addr_search(void *addr)
+{
+	void *first_start = pcpu_first_chunk->base_addr;
+
+	/* is it in the first chunk? */
+	if (addr >= first_start && addr < first_start + pcpu_unit_size)
+		return pcpu_first_chunk;
+
+	/* the rest are mapped in vmalloc space, with page->index set */
+	return (struct pcpu_chunk *)vmalloc_to_page(addr)->index;
+}
+
+/**
+ * pcpu_need_to_extend - determine whether a chunk's area map needs to grow
+ * @chunk: chunk of interest
+ *
+ * An allocation splits at most one free area into three, so two free
+ * map entries are always enough.  Returns the new number of entries to
+ * allocate for the map, or 0 if it is large enough.
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ */
+static int pcpu_need_to_extend(struct pcpu_chunk *chunk)
+{
+	int new_alloc;
+
+	if (chunk->map_alloc >= chunk->map_used + 2)
+		return 0;
+
+	new_alloc = PCPU_DFL_MAP_ALLOC;
+	while (new_alloc < chunk->map_used + 2)
+		new_alloc *= 2;
+
+	return new_alloc;
+}
+
+/**
+ * pcpu_extend_area_map - extend area map of a chunk
+ * @chunk: chunk of interest
+ * @new_alloc: new target allocation length of the area map
+ *
+ * Returns 0 on success, -ENOMEM on failure.
+ *
+ * CONTEXT:
+ * pcpu_alloc_mutex held, pcpu_lock not held.
+ */
+static int pcpu_extend_area_map(struct pcpu_chunk *chunk, int new_alloc)
+{
+	int *old = NULL, *new;
+	unsigned long flags;
+
+	new = kzalloc(new_alloc * sizeof(new[0]), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&pcpu_lock, flags);
+
+	/* frees may have shrunk map_used meanwhile, never grown it */
+	memcpy(new, chunk->map, chunk->map_used * sizeof(chunk->map[0]));
+	if (chunk->map != pcpu_first_map)
+		old = chunk->map;
+	chunk->map = new;
+	chunk->map_alloc = new_alloc;
+
+	spin_unlock_irqrestore(&pcpu_lock, flags);
+
+	kfree(old);
+	return 0;
+}
+
+/**
+ * pcpu_split_block - split a map block
+ * @chunk: chunk of interest
+ * @i: index of map block to split
+ * @head: head size in bytes (can be 0)
+ * @tail: tail size in bytes (can be 0)
+ *
+ * Split the @i'th map block into two or three blocks.  If @head is
+ * non-zero, @head bytes block is inserted before block @i moving it
+ * to @i+1 and reducing its size by @head bytes.
+ *
+ * If @tail is non-zero, the target block, which can be @i or @i+1
+ * depending on @head, is reduced by @tail bytes and @tail byte block
+ * is inserted after the target block.
+ *
+ * The map must have room for the new entries (see pcpu_need_to_extend()).
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ */
+static void pcpu_split_block(struct pcpu_chunk *chunk, int i,
+			     int head, int tail)
+{
+	int nr_extra = !!head + !!tail;
+
+	BUG_ON(chunk->map_alloc < chunk->map_used + nr_extra);
+
+	/* insert new subblocks */
+	memmove(&chunk->map[i + nr_extra], &chunk->map[i],
+		sizeof(chunk->map[0]) * (chunk->map_used - i));
+	chunk->map_used += nr_extra;
+
+	if (head) {
+		chunk->map[i + 1] = chunk->map[i] - head;
+		chunk->map[i++] = head;
+	}
+	if (tail) {
+		chunk->map[i++] -= tail;
+		chunk->map[i] = tail;
+	}
+}
+
+/**
+ * pcpu_alloc_area - allocate area from a pcpu_chunk
+ * @chunk: chunk of interest
+ * @size: wanted size in bytes
+ * @align: wanted align
+ *
+ * Try to allocate @size bytes area aligned at @align from @chunk.
+ * Note that this function only allocates the offset.  It doesn't
+ * populate or map the area.
+ *
+ * Returns the offset of the area in the chunk's units on success, -1
+ * if no matching area is found.
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ */
+static int pcpu_alloc_area(struct pcpu_chunk *chunk, int size, int align)
+{
+	int oslot = pcpu_chunk_slot(chunk);
+	int max_contig = 0;
+	int i, off;
+
+	for (i = 0, off = 0; i < chunk->map_used; off += abs(chunk->map[i++])) {
+		bool is_last = i + 1 == chunk->map_used;
+		int head, tail;
+
+		/* extra for alignment requirement */
+		head = ALIGN(off, align) - off;
+		BUG_ON(i == 0 && head != 0);
+
+		if (chunk->map[i] < 0)
+			continue;
+		if (chunk->map[i] < head + size) {
+			max_contig = max(chunk->map[i], max_contig);
+			continue;
+		}
+
+		/*
+		 * A head too small to ever be allocated is given to the
+		 * previous block, which is in use: free blocks are never
+		 * adjacent.
+		 */
+		if (head && head < sizeof(int)) {
+			chunk->map[i - 1] -= head;
+			chunk->free_size -= head;
+			chunk->map[i] -= head;
+			off += head;
+			head = 0;
+		}
+
+		/* if tail is small, just keep it around */
+		tail = chunk->map[i] - head - size;
+		if (tail < sizeof(int))
+			tail = 0;
+
+		/* split if warranted */
+		if (head || tail) {
+			pcpu_split_block(chunk, i, head, tail);
+			if (head) {
+				i++;
+				off += head;
+				max_contig = max(chunk->map[i - 1], max_contig);
+			}
+			if (tail)
+				max_contig = max(chunk->map[i + 1], max_contig);
+		}
+
+		/* update hint and mark allocated */
+		if (is_last)
+			chunk->contig_hint = max_contig; /* fully scanned */
+		else
+			chunk->contig_hint = max(chunk->contig_hint,
+						 max_contig);
+
+		chunk->free_size -= chunk->map[i];
+		chunk->map[i] = -chunk->map[i];
+
+		pcpu_chunk_relocate(chunk, oslot);
+		return off;
+	}
+
+	chunk->contig_hint = max_contig;	/* fully scanned */
+	pcpu_chunk_relocate(chunk, oslot);
+
+	/* tell the upper layer that this chunk has no matching area */
+	return -1;
+}
+
+/**
+ * pcpu_free_area - free area to a pcpu_chunk
+ * @chunk: chunk of interest
+ * @freeme: offset of area to free
+ *
+ * Free area starting from @freeme to @chunk, merging it with the free
+ * neighbours.  Note that this function only modifies the allocation map.
+ * It doesn't depopulate or unmap the area.
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ */
+static void pcpu_free_area(struct pcpu_chunk *chunk, int freeme)
+{
+	int oslot = pcpu_chunk_slot(chunk);
+	int i, off;
+
+	for (i = 0, off = 0; i < chunk->map_used; off += abs(chunk->map[i++]))
+		if (off == freeme)
+			break;
+	BUG_ON(off != freeme || i >= chunk->map_used);
+	BUG_ON(chunk->map[i] > 0);
+
+	chunk->map[i] = -chunk->map[i];
+	chunk->free_size += chunk->map[i];
+
+	/* merge with previous? */
+	if (i > 0 && chunk->map[i - 1] >= 0) {
+		chunk->map[i - 1] += chunk->map[i];
+		chunk->map_used--;
+		memmove(&chunk->map[i], &chunk->map[i + 1],
+			(chunk->map_used - i) * sizeof(chunk->map[0]));
+		i--;
+	}
+	/* merge with next? */
+	if (i + 1 < chunk->map_used && chunk->map[i + 1] >= 0) {
+		chunk->map[i] += chunk->map[i + 1];
+		chunk->map_used--;
+		memmove(&chunk->map[i + 1], &chunk->map[i + 2],
+			(chunk->map_used - (i + 1)) * sizeof(chunk->map[0]));
+	}
+
+	chunk->contig_hint = max(chunk->map[i], chunk->contig_hint);
+	pcpu_chunk_relocate(chunk, oslot);
+}
+
+static void pcpu_free_chunk_pages(struct pcpu_chunk *chunk)
+{
+	unsigned int cpu;
+	int i;
+
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < pcpu_unit_pages; i++) {
+			struct page **pagep = pcpu_chunk_pagep(chunk, cpu, i);
+
+			if (*pagep) {
+				__free_page(*pagep);
+				*pagep = NULL;
+			}
+		}
+	}
+}
+
+static void pcpu_destroy_chunk(struct pcpu_chunk *chunk)
+{
+	if (chunk->vm) {
+		/* flush the TLB before the pages can be reused */
+		unmap_kernel_range((unsigned long)chunk->base_addr,
+				   pcpu_chunk_size);
+		pcpu_free_chunk_pages(chunk);
+		free_vm_area(chunk->vm);
+	}
+	kfree(chunk->map);
+	kfree(chunk);
+}
+
+/**
+ * pcpu_create_chunk - create a new chunk
+ *
+ * Allocate and map the pages of a new chunk, each unit on the node of
+ * the cpu it belongs to.  The whole chunk is populated up front: units
+ * are small, and a percpu area which is not backed in every unit would
+ * have to be checked for on every per_cpu_ptr().
+ *
+ * CONTEXT:
+ * pcpu_alloc_mutex, does GFP_KERNEL allocation.
+ */
+static struct pcpu_chunk *pcpu_create_chunk(void)
+{
+	struct pcpu_chunk *chunk;
+	unsigned int cpu;
+	int i;
+
+	chunk = kzalloc(pcpu_chunk_struct_size, GFP_KERNEL);
+	if (!chunk)
+		return NULL;
+
+	INIT_LIST_HEAD(&chunk->list);
+	chunk->map = kzalloc(PCPU_DFL_MAP_ALLOC * sizeof(chunk->map[0]),
+			     GFP_KERNEL);
+	if (!chunk->map)
+		goto fail;
+	chunk->map_alloc = PCPU_DFL_MAP_ALLOC;
+	chunk->map[chunk->map_used++] = pcpu_unit_size;
+	chunk->free_size = pcpu_unit_size;
+	chunk->contig_hint = pcpu_unit_size;
+
+	chunk->vm = get_vm_area(pcpu_chunk_size, VM_ALLOC);
+	if (!chunk->vm)
+		goto fail;
+	chunk->base_addr = chunk->vm->addr;
+
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < pcpu_unit_pages; i++) {
+			struct page *page;
+
+			page = alloc_pages_node(cpu_to_node(cpu),
+						GFP_KERNEL | __GFP_HIGHMEM, 0);
+			if (!page)
+				goto fail;
+			/* for pcpu_chunk_addr_search() */
+			page->index = (unsigned long)chunk;
+			*pcpu_chunk_pagep(chunk, cpu, i) = page;
+		}
+
+		if (map_kernel_range((unsigned long)pcpu_chunk_addr(chunk,
+								    cpu, 0),
+				     pcpu_unit_size, PAGE_KERNEL,
+				     pcpu_chunk_pagep(chunk, cpu, 0)))
+			goto fail;
+	}
+
+	return chunk;
+
+fail:
+	pcpu_destroy_chunk(chunk);
+	return NULL;
+}
+
+/**
+ * __alloc_percpu - allocate percpu area
+ * @size: size of area to allocate in bytes
+ * @align: alignment of area (max PAGE_SIZE)
+ *
+ * Allocate percpu area of @size bytes aligned at @align.  Might sleep.
+ *
+ * RETURNS:
+ * Percpu pointer to the allocated area, zeroed on every cpu, on
+ * success, NULL on failure.
+ */
+void *__alloc_percpu(size_t size, size_t align)
+{
+	struct pcpu_chunk *chunk;
+	unsigned long flags;
+	unsigned int cpu;
+	int slot, off, new_alloc;
+
+	if (unlikely(!size || size > pcpu_unit_size || align > PAGE_SIZE)) {
+		WARN(true, "illegal size (%zu) or align (%zu) for "
+		     "percpu allocation\n", size, align);
+		return NULL;
+	}
+
+	mutex_lock(&pcpu_alloc_mutex);
+	spin_lock_irqsave(&pcpu_lock, flags);
+restart:
+	for (slot = pcpu_size_to_slot(size); slot < pcpu_nr_slots; slot++) {
+		list_for_each_entry(chunk, &pcpu_slot[slot], list) {
+			if (size > chunk->contig_hint)
+				continue;
+
+			new_alloc = pcpu_need_to_extend(chunk);
+			if (new_alloc) {
+				spin_unlock_irqrestore(&pcpu_lock, flags);
+				if (pcpu_extend_area_map(chunk, new_alloc) < 0)
+					goto fail_unlock_mutex;
+				spin_lock_irqsave(&pcpu_lock, flags);
+				/* pcpu_lock was dropped, restart scan */
+				goto restart;
+			}
+
+			off = pcpu_alloc_area(chunk, size, align);
+			if (off >= 0)
+				goto area_found;
+		}
+	}
+
+	/* hmmm... no space left, create a new chunk */
+	spin_unlock_irqrestore(&pcpu_lock, flags);
+
+	chunk = pcpu_create_chunk();
+	if (!chunk)
+		goto fail_unlock_mutex;
+
+	spin_lock_irqsave(&pcpu_lock, flags);
+	pcpu_chunk_relocate(chunk, -1);
+	goto restart;
+
+area_found:
+	spin_unlock_irqrestore(&pcpu_lock, flags);
+	mutex_unlock(&pcpu_alloc_mutex);
+
+	/* clear the area for every cpu, as alloc_percpu() always did */
+	for_each_possible_cpu(cpu)
+		memset(pcpu_chunk_addr(chunk, cpu, off), 0, size);
+
+	return __addr_to_pcpu_ptr(pcpu_chunk_addr(chunk, 0, off));
+
+fail_unlock_mutex:
+	mutex_unlock(&pcpu_alloc_mutex);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(__alloc_percpu);
+
+/**
+ * pcpu_reclaim - reclaim fully free chunks, workqueue function
+ * @work: unused
+ *
+ * Release all but one fully free chunks: one is kept around so that an
+ * alloc/free cycle does not create and destroy a chunk each time.
+ */
+static void pcpu_reclaim(struct work_struct *work)
+{
+	LIST_HEAD(todo);
+	struct list_head *head = &pcpu_slot[pcpu_nr_slots - 1];
+	struct pcpu_chunk *chunk, *next;
+
+	mutex_lock(&pcpu_alloc_mutex);
+	spin_lock_irq(&pcpu_lock);
+
+	list_for_each_entry_safe(chunk, next, head, list) {
+		WARN_ON(chunk == pcpu_first_chunk);
+
+		/* spare the first one */
+		if (chunk == list_first_entry(head, struct pcpu_chunk, list))
+			continue;
+
+		list_move(&chunk->list, &todo);
+	}
+
+	spin_unlock_irq(&pcpu_lock);
+	mutex_unlock(&pcpu_alloc_mutex);
+
+	/* off the slot lists and entirely free: nobody can reach them */
+	list_for_each_entry_safe(chunk, next, &todo, list)
+		pcpu_destroy_chunk(chunk);
+}
+
+/**
+ * free_percpu - free percpu area
+ * @ptr: pointer to area to free
+ *
+ * Free percpu area @ptr.  Can be called from any context.
+ */
+void free_percpu(void *ptr)
+{
+	void *addr = __pcpu_ptr_to_addr(ptr);
+	struct pcpu_chunk *chunk;
+	unsigned long flags;
+	int off;
+
+	if (!ptr)
+		return;
+
+	spin_lock_irqsave(&pcpu_lock, flags);
+
+	chunk = pcpu_chunk_addr_search(addr);
+	off = addr - chunk->base_addr;
+
+	pcpu_free_area(chunk, off);
+
+	/* if there are more than one fully free chunks, wake up grim reaper */
+	if (chunk->free_size == pcpu_unit_size) {
+		struct pcpu_chunk *pos;
+
+		list_for_each_entry(pos, &pcpu_slot[pcpu_nr_slots - 1], list)
+			if (pos != chunk) {
+				schedule_work(&pcpu_reclaim_work);
+				break;
+			}
+	}
+
+	spin_unlock_irqrestore(&pcpu_lock, flags);
+}
+EXPORT_SYMBOL_GPL(free_percpu);
+
+/**
+ * per_cpu_ptr_to_phys - convert a percpu address to a physical address
+ * @addr: address of a cpu's copy of a static or dynamic percpu variable
+ *
+ * Percpu units may be mapped in vmalloc space, where __pa() doesn't
+ * work.  The units of the first chunk are physically contiguous, those
+ * of later chunks only page by page.
+ */
+phys_addr_t per_cpu_ptr_to_phys(void *addr)
+{
+	if (is_vmalloc_addr(addr))
+		return page_to_phys(vmalloc_to_page(addr)) +
+		       offset_in_page(addr);
+	return __pa(addr);
+}
+EXPORT_SYMBOL_GPL(per_cpu_ptr_to_phys);
+
+/**
+ * pcpu_setup_first_chunk - initialize the first percpu chunk
+ * @base_addr: mapped address of the first chunk
+ * @static_size: the size of the kernel static percpu area
+ * @reserved_size: bytes after the static area not to allocate from
+ * @unit_size: unit size in bytes, must be a multiple of PAGE_SIZE
+ *
+ * Called by the arch code from setup_per_cpu_areas(), once it has set
+ * up nr_cpu_ids units of @unit_size bytes at @base_addr, unit N being
+ * cpu N's, copied the static percpu section to the start of each unit
+ * and set per_cpu_offset(N) to the start of unit N minus
+ * __per_cpu_start.
+ *
+ * The first @static_size + @reserved_size bytes of every unit are taken
+ * (@reserved_size is what kernel/module.c hands out to module percpu
+ * variables); the rest of the unit serves dynamic allocations until
+ * more chunks are needed.
+ */
+void __init pcpu_setup_first_chunk(void *base_addr, size_t static_size,
+				   size_t reserved_size, size_t unit_size)
+{
+	size_t used_size = static_size + reserved_size;
+	struct pcpu_chunk *chunk;
+	int i;
+
+	BUG_ON(!base_addr || !static_size);
+	BUG_ON(unit_size & ~PAGE_MASK);
+	BUG_ON(used_size >= unit_size);
+
+	pcpu_base_addr = base_addr;
+	pcpu_unit_pages = unit_size >> PAGE_SHIFT;
+	pcpu_unit_size = unit_size;
+	pcpu_chunk_size = nr_cpu_ids * pcpu_unit_size;
+	pcpu_nr_slots = __pcpu_size_to_slot(pcpu_unit_size) + 2;
+	pcpu_chunk_struct_size = sizeof(struct pcpu_chunk) +
+		nr_cpu_ids * pcpu_unit_pages * sizeof(struct page *);
+
+	/* allocate chunk slots */
+	pcpu_slot = alloc_bootmem(pcpu_nr_slots * sizeof(pcpu_slot[0]));
+	for (i = 0; i < pcpu_nr_slots; i++)
+		INIT_LIST_HEAD(&pcpu_slot[i]);
+
+	/* the first chunk is bootmem backed and has no pages to track */
+	chunk = alloc_bootmem(sizeof(struct pcpu_chunk));
+	INIT_LIST_HEAD(&chunk->list);
+	chunk->base_addr = base_addr;
+	chunk->map = pcpu_first_map;
+	chunk->map_alloc = ARRAY_SIZE(pcpu_first_map);
+	chunk->map[chunk->map_used++] = -used_size;
+	chunk->map[chunk->map_used++] = unit_size - used_size;
+	chunk->free_size = unit_size - used_size;
+	chunk->contig_hint = chunk->free_size;
+
+	pcpu_first_chunk = chunk;
+	pcpu_chunk_relocate(chunk, -1);
+
+	pr_info("PERCPU: %d pages/cpu, static %zu, reserved %zu, "
+		"dynamic %zu bytes\n", pcpu_unit_pages, static_size,
+		reserved_size, unit_size - used_size);
+}
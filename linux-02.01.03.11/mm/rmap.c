@@ -45,6 +45,7 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/rmap.h>
+#include <linux/ksm.h>
 #include <linux/rcupdate.h>
 #include <linux/module.h>
 #include <linux/memcontrol.h>
@@ -191,7 +192,7 @@ void __init anon_vma_init(void)
  * Getting a lock on a stable anon_vma from a page off the LRU is
  * tricky: page_lock_anon_vma rely on RCU to guard against the races.
  */
-static struct anon_vma *page_lock_anon_vma(struct page *page)
+struct anon_vma *page_lock_anon_vma(struct page *page)
 {
 	struct anon_vma *anon_vma;
 	unsigned long anon_mapping;
@@ -211,7 +212,7 @@ out:
 	return NULL;
 }
 
-static void page_unlock_anon_vma(struct anon_vma *anon_vma)
+void page_unlock_anon_vma(struct anon_vma *anon_vma)
 {
 	spin_unlock(&anon_vma->lock);
 	rcu_read_unlock();
@@ -282,7 +283,8 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 		return NULL;
 
 	pmd = pmd_offset(pud, address);
-	if (!pmd_present(*pmd))
+	/* A huge pmd may map this address in an mm forked from ours */
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		return NULL;
 
 	pte = pte_offset_map(pmd, address);
@@ -707,7 +709,7 @@ void page_add_file_rmap(struct page *page)
  */
 void page_dup_rmap(struct page *page, struct vm_area_struct *vma, unsigned long address)
 {
-	if (PageAnon(page))
+	if (PageAnon(page) && !PageKsm(page))
 		__page_check_anon_rmap(page, vma, address);
 	atomic_inc(&page->_mapcount);
 }
@@ -750,14 +752,109 @@ void page_remove_rmap(struct page *page)
 	}
 }
 
+#ifdef CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH
+/*
+ * Reclaim unmaps pages one at a time, and flushing the TLB for each of
+ * them would cost an IPI to every CPU each mm has run on.  Instead the
+ * ptes are cleared and the CPUs to flush are collected in the task's
+ * tlb_ubc, then flushed in one go: before any of the pages is freed,
+ * and before one is written out if a dirty pte was among them, as a
+ * stale writable TLB entry could otherwise modify it under the I/O.
+ */
+void try_to_unmap_flush(void)
+{
+	struct tlbflush_unmap_batch *tlb_ubc = &current->tlb_ubc;
+
+	if (!tlb_ubc->flush_required)
+		return;
+
+	flush_tlb_cpumask(&tlb_ubc->cpumask);
+	cpus_clear(tlb_ubc->cpumask);
+	tlb_ubc->flush_required = 0;
+	tlb_ubc->writable = 0;
+}
+
+/* Flush only if a stale TLB entry could still write to the pages */
+void try_to_unmap_flush_dirty(void)
+{
+	if (current->tlb_ubc.writable)
+		try_to_unmap_flush();
+}
+
+static void set_tlb_ubc_flush_pending(struct mm_struct *mm, int writable)
+{
+	struct tlbflush_unmap_batch *tlb_ubc = &current->tlb_ubc;
+
+	cpus_or(tlb_ubc->cpumask, tlb_ubc->cpumask, mm->cpu_vm_mask);
+	tlb_ubc->flush_required = 1;
+
+	/*
+	 * The pte is cleared before the flag is set, both under the pte
+	 * lock: whoever takes that lock next and finds the pte none also
+	 * finds the flag set.
+	 */
+	barrier();
+	mm->tlb_flush_batched = 1;
+
+	if (writable)
+		tlb_ubc->writable = 1;
+}
+
+/*
+ * Reclaim may have cleared ptes of this mm and still be holding back
+ * their TLB flush.  munmap(), MADV_DONTNEED, mprotect() or mremap()
+ * would find those ptes none, skip them, and return to a caller which
+ * believes the old translations are gone.  So they call this under the
+ * pte lock, before looking at the ptes, to do the flush themselves.
+ */
+void flush_tlb_batched_pending(struct mm_struct *mm)
+{
+	if (mm->tlb_flush_batched) {
+		flush_tlb_mm(mm);
+
+		/* Not before the flush, or a racing reclaim could be missed */
+		barrier();
+		mm->tlb_flush_batched = 0;
+	}
+}
+
+/*
+ * Batch the flush only when asked to, and when it saves IPIs: if this
+ * CPU is the only one the mm has run on, flush at once, locally.
+ */
+static int should_defer_flush(struct mm_struct *mm, enum ttu_flags flags)
+{
+	int should_defer = 0;
+
+	if (!(flags & TTU_BATCH_FLUSH))
+		return 0;
+
+	if (cpumask_any_but(&mm->cpu_vm_mask, get_cpu()) < nr_cpu_ids)
+		should_defer = 1;
+	put_cpu();
+
+	return should_defer;
+}
+#else
+static void set_tlb_ubc_flush_pending(struct mm_struct *mm, int writable)
+{
+}
+
+static int should_defer_flush(struct mm_struct *mm, enum ttu_flags flags)
+{
+	return 0;
+}
+#endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
+
 /*
  * Subfunctions of try_to_unmap: try_to_unmap_one called
  * repeatedly from either try_to_unmap_anon or try_to_unmap_file.
  */
 static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
-				int migration)
+				enum ttu_flags flags)
 {
 	struct mm_struct *mm = vma->vm_mm;
+	int migration = TTU_ACTION(flags) == TTU_MIGRATION;
 	unsigned long address;
 	pte_t *pte;
 	pte_t pteval;
@@ -790,7 +887,18 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 
 	/* Nuke the page table entry. */
 	flush_cache_page(vma, address, page_to_pfn(page));
-	pteval = ptep_clear_flush_notify(vma, address, pte);
+	if (should_defer_flush(mm, flags)) {
+		/*
+		 * Clear the pte but leave the TLB flush to the end of the
+		 * batch: another CPU may still read the page through a
+		 * stale entry until then, but write to it only if the pte
+		 * was dirty, which the batch records.
+		 */
+		pteval = ptep_get_and_clear(mm, address, pte);
+		set_tlb_ubc_flush_pending(mm, pte_dirty(pteval));
+		mmu_notifier_invalidate_page(mm, address);
+	} else
+		pteval = ptep_clear_flush_notify(vma, address, pte);
 
 	/* Move the dirty bit to the physical page now the pte is gone. */
 	if (pte_dirty(pteval))
@@ -983,7 +1091,7 @@ static int try_to_mlock_page(struct page *page, struct vm_area_struct *vma)
  * rmap method
  * @page: the page to unmap/unlock
  * @unlock:  request for unlock rather than unmap [unlikely]
- * @migration:  unmapping for migration - ignored if @unlock
+ * @flags:  action and flags, see enum ttu_flags - ignored if @unlock
  *
  * Find all the mappings of a page using the mapping pointer and the vma chains
  * contained in the anon_vma struct it points to.
@@ -995,7 +1103,8 @@ static int try_to_mlock_page(struct page *page, struct vm_area_struct *vma)
  * vm_flags for that VMA.  That should be OK, because that vma shouldn't be
  * 'LOCKED.
  */
-static int try_to_unmap_anon(struct page *page, int unlock, int migration)
+static int try_to_unmap_anon(struct page *page, int unlock,
+			     enum ttu_flags flags)
 {
 	struct anon_vma *anon_vma;
 	struct vm_area_struct *vma;
@@ -1016,7 +1125,7 @@ static int try_to_unmap_anon(struct page *page, int unlock, int migration)
 				continue;  /* must visit all unlocked vmas */
 			ret = SWAP_MLOCK;  /* saw at least one mlocked vma */
 		} else {
-			ret = try_to_unmap_one(page, vma, migration);
+			ret = try_to_unmap_one(page, vma, flags);
 			if (ret == SWAP_FAIL || !page_mapped(page))
 				break;
 		}
@@ -1041,7 +1150,7 @@ static int try_to_unmap_anon(struct page *page, int unlock, int migration)
  * try_to_unmap_file - unmap/unlock file page using the object-based rmap method
  * @page: the page to unmap/unlock
  * @unlock:  request for unlock rather than unmap [unlikely]
- * @migration:  unmapping for migration - ignored if @unlock
+ * @flags:  action and flags, see enum ttu_flags - ignored if @unlock
  *
  * Find all the mappings of a page using the mapping pointer and the vma chains
  * contained in the address_space struct it points to.
@@ -1053,9 +1162,11 @@ static int try_to_unmap_anon(struct page *page, int unlock, int migration)
  * vm_flags for that VMA.  That should be OK, because that vma shouldn't be
  * 'LOCKED.
  */
-static int try_to_unmap_file(struct page *page, int unlock, int migration)
+static int try_to_unmap_file(struct page *page, int unlock,
+			     enum ttu_flags flags)
 {
 	struct address_space *mapping = page->mapping;
+	int migration = TTU_ACTION(flags) == TTU_MIGRATION;
 	pgoff_t pgoff = page->index << (PAGE_CACHE_SHIFT - PAGE_SHIFT);
 	struct vm_area_struct *vma;
 	struct prio_tree_iter iter;
@@ -1076,7 +1187,7 @@ static int try_to_unmap_file(struct page *page, int unlock, int migration)
 				continue;	/* must visit all vmas */
 			ret = SWAP_MLOCK;
 		} else {
-			ret = try_to_unmap_one(page, vma, migration);
+			ret = try_to_unmap_one(page, vma, flags);
 			if (ret == SWAP_FAIL || !page_mapped(page))
 				goto out;
 		}
@@ -1175,7 +1286,7 @@ out:
 /**
  * try_to_unmap - try to remove all page table mappings to a page
  * @page: the page to get unmapped
- * @migration: migration flag
+ * @flags: action and flags, see enum ttu_flags
  *
  * Tries to remove all the page table entries which are mapping this
  * page, used in the pageout path.  Caller must hold the page lock.
@@ -1186,16 +1297,16 @@ out:
  * SWAP_FAIL	- the page is unswappable
  * SWAP_MLOCK	- page is mlocked.
  */
-int try_to_unmap(struct page *page, int migration)
+int try_to_unmap(struct page *page, enum ttu_flags flags)
 {
 	int ret;
 
 	BUG_ON(!PageLocked(page));
 
 	if (PageAnon(page))
-		ret = try_to_unmap_anon(page, 0, migration);
+		ret = try_to_unmap_anon(page, 0, flags);
 	else
-		ret = try_to_unmap_file(page, 0, migration);
+		ret = try_to_unmap_file(page, 0, flags);
 	if (ret != SWAP_MLOCK && !page_mapped(page))
 		ret = SWAP_SUCCESS;
 	return ret;
@@ -1221,8 +1332,8 @@ int try_to_munlock(struct page *page)
 	VM_BUG_ON(!PageLocked(page) || PageLRU(page));
 
 	if (PageAnon(page))
-		return try_to_unmap_anon(page, 1, 0);
+		return try_to_unmap_anon(page, 1, TTU_UNMAP);
 	else
-		return try_to_unmap_file(page, 1, 0);
+		return try_to_unmap_file(page, 1, TTU_UNMAP);
 }
 #endif
@@ -0,0 +1,1226 @@
+/*
+ * SLQB: A slab allocator with per cpu queues of free objects.
+ *
+ * Every cpu owns a kmem_cache_list for each cache: a LIFO queue of free
+ * objects and the slabs those objects belong to.  Allocations pop from
+ * and frees push to the queue of the local cpu with interrupts disabled
+ * and without taking any lock.  When the queue runs empty it is refilled
+ * with a batch of objects from the partial slabs of the list, and when
+ * it grows past its high watermark a batch is returned to the slabs.
+ *
+ * An object freed on another cpu than the one owning its slab is not
+ * put on the local queue.  It is gathered in a small per cpu buffer and
+ * handed back to the owner in a batch, under the spinlock of the remote
+ * free queue of the owning list, which the owner empties the next time
+ * its own queue runs out.  So a cpu only ever touches the slab pages it
+ * owns, and the lock is taken once per batch, not once per object.
+ *
+ * Node specific allocations are not supported, SLQB depends on !NUMA.
+ */
+
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/interrupt.h>
+#include <linux/slab.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/cpu.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
+#include <linux/timer.h>
+#include <linux/debugobjects.h>
+#include <linux/fault-inject.h>
+
+/*
+ * Slabs are allocated with the smallest order that holds at least
+ * SLQB_MIN_OBJECTS objects, unless that takes more than SLQB_MAX_ORDER.
+ */
+#define SLQB_MIN_OBJECTS	16
+#define SLQB_MAX_ORDER		PAGE_ALLOC_COSTLY_ORDER
+
+/* How often each cpu trims its queues */
+#define SLQB_TRIM_INTERVAL	(2 * HZ)
+
+#ifndef ARCH_KMALLOC_MINALIGN
+#define ARCH_KMALLOC_MINALIGN __alignof__(unsigned long long)
+#endif
+
+#ifndef ARCH_SLAB_MINALIGN
+#define ARCH_SLAB_MINALIGN __alignof__(unsigned long long)
+#endif
+
+static enum {
+	DOWN,		/* No slab functionality available */
+	UP,		/* Everything works */
+} slab_state = DOWN;
+
+/*
+ * slqb_lock protects the list of caches, and the kmem_cache_lists of
+ * offline cpus, which are drained by whoever holds it for writing.
+ */
+static DECLARE_RWSEM(slqb_lock);
+static LIST_HEAD(slab_caches);
+
+int slab_is_available(void)
+{
+	return slab_state >= UP;
+}
+
+static inline struct kmem_cache_cpu *get_cpu_slab(struct kmem_cache *s,
+						  int cpu)
+{
+#ifdef CONFIG_SMP
+	return s->cpu_slab[cpu];
+#else
+	return &s->cpu_slab;
+#endif
+}
+
+/* The list owning a slab */
+static inline struct kmem_cache_list *slab_list(struct page *page)
+{
+	return (struct kmem_cache_list *)page_private(page);
+}
+
+static inline void *get_freepointer(struct kmem_cache *s, void *object)
+{
+	return *(void **)(object + s->offset);
+}
+
+static inline void set_freepointer(struct kmem_cache *s, void *object,
+				   void *fp)
+{
+	*(void **)(object + s->offset) = fp;
+}
+
+/********************************************************************
+ *		Slab allocation and freeing
+ *******************************************************************/
+
+static struct page *allocate_slab(struct kmem_cache *s, gfp_t flags)
+{
+	struct page *page;
+	int order = s->order;
+
+	flags |= s->allocflags;
+
+	if (order > s->min_order) {
+		page = alloc_pages(flags | __GFP_NOWARN | __GFP_NORETRY, order);
+		if (page)
+			goto out;
+		/*
+		 * Allocation may have failed due to fragmentation.
+		 * Try a lower order alloc if possible
+		 */
+		order = s->min_order;
+	}
+	page = alloc_pages(flags, order);
+	if (!page)
+		return NULL;
+out:
+	page->objects = (PAGE_SIZE << order) / s->size;
+	mod_zone_page_state(page_zone(page),
+		(s->flags & SLAB_RECLAIM_ACCOUNT) ?
+		NR_SLAB_RECLAIMABLE : NR_SLAB_UNRECLAIMABLE,
+		1 << order);
+
+	return page;
+}
+
+static struct page *new_slab(struct kmem_cache *s, gfp_t flags)
+{
+	struct page *page;
+	void *start;
+	void *last;
+	void *p;
+
+	BUG_ON(flags & GFP_SLAB_BUG_MASK);
+
+	page = allocate_slab(s,
+		flags & (GFP_RECLAIM_MASK | GFP_CONSTRAINT_MASK));
+	if (!page)
+		return NULL;
+
+	__SetPageSlab(page);
+
+	start = page_address(page);
+	last = start;
+	for (p = start + s->size; p < start + page->objects * s->size;
+	     p += s->size) {
+		if (unlikely(s->ctor))
+			s->ctor(last);
+		set_freepointer(s, last, p);
+		last = p;
+	}
+	if (unlikely(s->ctor))
+		s->ctor(last);
+	set_freepointer(s, last, NULL);
+
+	page->freelist = start;
+	page->inuse = 0;
+
+	return page;
+}
+
+static void __free_slab(struct kmem_cache *s, struct page *page)
+{
+	int order = compound_order(page);
+	int pages = 1 << order;
+
+	mod_zone_page_state(page_zone(page),
+		(s->flags & SLAB_RECLAIM_ACCOUNT) ?
+		NR_SLAB_RECLAIMABLE : NR_SLAB_UNRECLAIMABLE,
+		-pages);
+
+	__ClearPageSlab(page);
+	reset_page_mapcount(page);
+	set_page_private(page, 0);
+	__free_pages(page, order);
+}
+
+static void rcu_free_slab(struct rcu_head *h)
+{
+	struct page *page;
+
+	page = container_of((struct list_head *)h, struct page, lru);
+	__free_slab(slab_list(page)->cache, page);
+}
+
+static void free_slab(struct kmem_cache *s, struct page *page)
+{
+	if (unlikely(s->flags & SLAB_DESTROY_BY_RCU)) {
+		/*
+		 * RCU free overloads the RCU head over the LRU
+		 */
+		struct rcu_head *head = (void *)&page->lru;
+
+		call_rcu(head, rcu_free_slab);
+	} else
+		__free_slab(s, page);
+}
+
+/*
+ * Hang a new slab on the list of the local cpu.
+ */
+static void add_slab(struct kmem_cache_list *l, struct page *page)
+{
+	set_page_private(page, (unsigned long)l);
+	list_add(&page->lru, &l->partial);
+	l->nr_partial++;
+	l->nr_slabs++;
+	l->nr_objects += page->objects;
+	l->nr_free += page->objects;
+}
+
+/*
+ * Return an object from the queue of @l to its slab, which @l owns.
+ * Slabs with free objects are on the partial list, empty ones go back to
+ * the page allocator.
+ */
+static void free_object_to_slab(struct kmem_cache *s,
+				struct kmem_cache_list *l, void *object)
+{
+	struct page *page = virt_to_head_page(object);
+	void *prior = page->freelist;
+
+	set_freepointer(s, object, prior);
+	page->freelist = object;
+	page->inuse--;
+	l->nr_free++;
+
+	if (unlikely(!page->inuse)) {
+		if (prior) {
+			list_del(&page->lru);
+			l->nr_partial--;
+		}
+		l->nr_slabs--;
+		l->nr_objects -= page->objects;
+		l->nr_free -= page->objects;
+		free_slab(s, page);
+	} else if (!prior) {
+		list_add(&page->lru, &l->partial);
+		l->nr_partial++;
+	}
+}
+
+/*
+ * Move up to @nr objects from the queue of @l back to their slabs.
+ */
+static void flush_list(struct kmem_cache *s, struct kmem_cache_list *l,
+		       unsigned long nr)
+{
+	while (nr-- && l->freelist) {
+		void *object = l->freelist;
+
+		l->freelist = get_freepointer(s, object);
+		l->freelist_nr--;
+		free_object_to_slab(s, l, object);
+	}
+}
+
+/*
+ * Move a batch of objects from the partial slabs of @l to its queue.
+ */
+static void refill_freelist(struct kmem_cache *s, struct kmem_cache_list *l)
+{
+	int n = 0;
+
+	while (n < s->batch && !list_empty(&l->partial)) {
+		struct page *page;
+
+		page = list_first_entry(&l->partial, struct page, lru);
+		while (n < s->batch && page->freelist) {
+			void *object = page->freelist;
+
+			page->freelist = get_freepointer(s, object);
+			set_freepointer(s, object, l->freelist);
+			l->freelist = object;
+			page->inuse++;
+			n++;
+		}
+		if (!page->freelist) {
+			list_del(&page->lru);
+			l->nr_partial--;
+		}
+	}
+	l->freelist_nr += n;
+	l->nr_free -= n;
+}
+
+/********************************************************************
+ *		Remote frees
+ *******************************************************************/
+
+/*
+ * Hand the objects gathered by @c for another list back to that list.
+ */
+static void flush_remote_free_cache(struct kmem_cache *s,
+				    struct kmem_cache_cpu *c)
+{
+	struct kmem_cache_list *dst = c->rlist_target;
+	struct kmlist_remote_free *r;
+
+	if (!c->rnr)
+		return;
+
+	r = &dst->remote_free;
+	spin_lock(&r->lock);
+	if (r->head)
+		set_freepointer(s, r->tail, c->rhead);
+	else
+		r->head = c->rhead;
+	r->tail = c->rtail;
+	r->nr += c->rnr;
+	dst->remote_free_check = 1;
+	spin_unlock(&r->lock);
+
+	c->rlist_target = NULL;
+	c->rhead = NULL;
+	c->rtail = NULL;
+	c->rnr = 0;
+}
+
+static void slab_free_remote(struct kmem_cache *s, struct kmem_cache_cpu *c,
+			     struct kmem_cache_list *dst, void *object)
+{
+	if (c->rlist_target != dst) {
+		flush_remote_free_cache(s, c);
+		c->rlist_target = dst;
+	}
+
+	set_freepointer(s, object, c->rhead);
+	if (!c->rhead)
+		c->rtail = object;
+	c->rhead = object;
+
+	if (++c->rnr >= s->freebatch)
+		flush_remote_free_cache(s, c);
+}
+
+/*
+ * Take the objects other cpus handed back to @l onto its queue.
+ */
+static void claim_remote_free_list(struct kmem_cache *s,
+				   struct kmem_cache_list *l)
+{
+	struct kmlist_remote_free *r = &l->remote_free;
+	void **head, **tail;
+	unsigned long nr;
+
+	spin_lock(&r->lock);
+	l->remote_free_check = 0;
+	head = r->head;
+	tail = r->tail;
+	nr = r->nr;
+	r->head = NULL;
+	r->tail = NULL;
+	r->nr = 0;
+	spin_unlock(&r->lock);
+
+	if (!head)
+		return;
+
+	set_freepointer(s, tail, l->freelist);
+	l->freelist = head;
+	l->freelist_nr += nr;
+}
+
+/*
+ * Return everything queued on a cpu to the slabs.  Runs on that cpu with
+ * interrupts disabled, or for an offline cpu with slqb_lock held.
+ */
+static void drain_cpu_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct kmem_cache_list *l = &c->list;
+
+	flush_remote_free_cache(s, c);
+	claim_remote_free_list(s, l);
+	flush_list(s, l, l->freelist_nr);
+}
+
+/********************************************************************
+ *		Allocation and freeing of objects
+ *******************************************************************/
+
+/*
+ * The queue of the local cpu is empty.  Called with interrupts disabled,
+ * which are enabled while a new slab is allocated for __GFP_WAIT.
+ */
+static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags)
+{
+	struct kmem_cache_list *l;
+	struct page *page;
+	void *object;
+
+	l = &get_cpu_slab(s, smp_processor_id())->list;
+
+	if (l->remote_free_check) {
+		claim_remote_free_list(s, l);
+		if (l->freelist)
+			goto alloc;
+	}
+
+	if (list_empty(&l->partial)) {
+		if (gfpflags & __GFP_WAIT)
+			local_irq_enable();
+
+		page = new_slab(s, gfpflags);
+
+		if (gfpflags & __GFP_WAIT)
+			local_irq_disable();
+
+		if (unlikely(!page))
+			return NULL;
+
+		/* We may be running on another cpu now */
+		l = &get_cpu_slab(s, smp_processor_id())->list;
+		add_slab(l, page);
+	}
+	refill_freelist(s, l);
+alloc:
+	object = l->freelist;
+	l->freelist = get_freepointer(s, object);
+	l->freelist_nr--;
+
+	if (unlikely(l->freelist_nr > s->hiwater))
+		flush_list(s, l, l->freelist_nr - s->batch);
+
+	return object;
+}
+
+static __always_inline void *slab_alloc(struct kmem_cache *s,
+		gfp_t gfpflags)
+{
+	struct kmem_cache_list *l;
+	unsigned long flags;
+	void *object;
+
+	might_sleep_if(gfpflags & __GFP_WAIT);
+
+	if (should_failslab(s->objsize, gfpflags))
+		return NULL;
+
+	local_irq_save(flags);
+	l = &get_cpu_slab(s, smp_processor_id())->list;
+	object = l->freelist;
+	if (likely(object)) {
+		l->freelist = get_freepointer(s, object);
+		l->freelist_nr--;
+	} else
+		object = __slab_alloc(s, gfpflags);
+	local_irq_restore(flags);
+
+	if (unlikely((gfpflags & __GFP_ZERO) && object))
+		memset(object, 0, s->objsize);
+
+	return object;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *s, gfp_t gfpflags)
+{
+	return slab_alloc(s, gfpflags);
+}
+EXPORT_SYMBOL(kmem_cache_alloc);
+
+static __always_inline void slab_free(struct kmem_cache *s,
+			struct page *page, void *object)
+{
+	struct kmem_cache_cpu *c;
+	struct kmem_cache_list *l;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	debug_check_no_locks_freed(object, s->objsize);
+	if (!(s->flags & SLAB_DEBUG_OBJECTS))
+		debug_check_no_obj_freed(object, s->objsize);
+
+	c = get_cpu_slab(s, smp_processor_id());
+	l = &c->list;
+	if (likely(slab_list(page) == l)) {
+		set_freepointer(s, object, l->freelist);
+		l->freelist = object;
+		if (unlikely(++l->freelist_nr > s->hiwater))
+			flush_list(s, l, s->batch);
+	} else
+		slab_free_remote(s, c, slab_list(page), object);
+	local_irq_restore(flags);
+}
+
+void kmem_cache_free(struct kmem_cache *s, void *x)
+{
+	slab_free(s, virt_to_head_page(x), x);
+}
+EXPORT_SYMBOL(kmem_cache_free);
+
+/********************************************************************
+ *		Cache setup
+ *******************************************************************/
+
+/*
+ * Figure out what the alignment of the objects will be.
+ */
+static unsigned long calculate_alignment(unsigned long flags,
+		unsigned long align, unsigned long size)
+{
+	/*
+	 * If the user wants hardware cache aligned objects then follow that
+	 * suggestion if the object is sufficiently large.
+	 *
+	 * The hardware cache alignment cannot override the specified
+	 * alignment though. If that is greater then use it.
+	 */
+	if (flags & SLAB_HWCACHE_ALIGN) {
+		unsigned long ralign = cache_line_size();
+		while (size <= ralign / 2)
+			ralign /= 2;
+		align = max(align, ralign);
+	}
+
+	if (align < ARCH_SLAB_MINALIGN)
+		align = ARCH_SLAB_MINALIGN;
+
+	return ALIGN(align, sizeof(void *));
+}
+
+/*
+ * The queue sizes follow the limits SLAB uses for its per cpu arrays:
+ * large objects are expensive to keep around unused, small ones are
+ * cheap and are allocated at a much higher rate.
+ */
+static int calculate_hiwater(unsigned long size)
+{
+	if (size > PAGE_SIZE)
+		return 8;
+	if (size > 1024)
+		return 24;
+	if (size > 256)
+		return 54;
+	return 120;
+}
+
+static int calculate_sizes(struct kmem_cache *s)
+{
+	unsigned long size = ALIGN(s->objsize, sizeof(void *));
+	int order;
+
+	if ((s->flags & SLAB_DESTROY_BY_RCU) || s->ctor) {
+		/*
+		 * The object must stay intact while it is free, so the free
+		 * pointer goes behind it.
+		 */
+		s->offset = size;
+		size += sizeof(void *);
+	} else
+		s->offset = 0;
+
+	s->align = calculate_alignment(s->flags, s->align, s->objsize);
+	size = ALIGN(size, s->align);
+	s->size = size;
+
+	s->min_order = get_order(size);
+	if (s->min_order >= MAX_ORDER)
+		return 0;
+	for (order = s->min_order; order < SLQB_MAX_ORDER; order++)
+		if ((PAGE_SIZE << order) / size >= SLQB_MIN_OBJECTS)
+			break;
+	s->order = order;
+
+	s->allocflags = 0;
+	if (s->order)
+		s->allocflags |= __GFP_COMP;
+	if (s->flags & SLAB_CACHE_DMA)
+		s->allocflags |= SLQB_DMA;
+	if (s->flags & SLAB_RECLAIM_ACCOUNT)
+		s->allocflags |= __GFP_RECLAIMABLE;
+
+	s->hiwater = calculate_hiwater(size);
+	s->batch = (s->hiwater + 1) / 2;
+	s->freebatch = s->batch;
+
+	return 1;
+}
+
+static int kmem_cache_open(struct kmem_cache *s, const char *name,
+		size_t size, size_t align, unsigned long flags,
+		void (*ctor)(void *))
+{
+	s->name = name;
+	s->ctor = ctor;
+	s->objsize = size;
+	s->align = align;
+	s->flags = flags;
+
+	return calculate_sizes(s);
+}
+
+static void init_kmem_cache_cpu(struct kmem_cache *s,
+				struct kmem_cache_cpu *c)
+{
+	struct kmem_cache_list *l = &c->list;
+
+	l->freelist = NULL;
+	l->freelist_nr = 0;
+	INIT_LIST_HEAD(&l->partial);
+	l->nr_partial = 0;
+	l->nr_slabs = 0;
+	l->nr_objects = 0;
+	l->nr_free = 0;
+	l->cache = s;
+	l->remote_free_check = 0;
+	spin_lock_init(&l->remote_free.lock);
+	l->remote_free.head = NULL;
+	l->remote_free.tail = NULL;
+	l->remote_free.nr = 0;
+
+	c->rlist_target = NULL;
+	c->rhead = NULL;
+	c->rtail = NULL;
+	c->rnr = 0;
+}
+
+#ifdef CONFIG_SMP
+static void free_kmem_cache_cpus(struct kmem_cache *s)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		kfree(s->cpu_slab[cpu]);
+		s->cpu_slab[cpu] = NULL;
+	}
+}
+
+static int alloc_kmem_cache_cpus(struct kmem_cache *s)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct kmem_cache_cpu *c;
+
+		c = kmalloc(sizeof(struct kmem_cache_cpu), GFP_KERNEL);
+		if (!c) {
+			free_kmem_cache_cpus(s);
+			return 0;
+		}
+		init_kmem_cache_cpu(s, c);
+		s->cpu_slab[cpu] = c;
+	}
+	return 1;
+}
+#else
+static inline void free_kmem_cache_cpus(struct kmem_cache *s)
+{
+}
+
+static inline int alloc_kmem_cache_cpus(struct kmem_cache *s)
+{
+	init_kmem_cache_cpu(s, &s->cpu_slab);
+	return 1;
+}
+#endif
+
+unsigned int kmem_cache_size(struct kmem_cache *s)
+{
+	return s->objsize;
+}
+EXPORT_SYMBOL(kmem_cache_size);
+
+const char *kmem_cache_name(struct kmem_cache *s)
+{
+	return s->name;
+}
+EXPORT_SYMBOL(kmem_cache_name);
+
+static void drain_cpu(void *info)
+{
+	struct kmem_cache *s = info;
+
+	drain_cpu_slab(s, get_cpu_slab(s, smp_processor_id()));
+}
+
+static void flush_remote_cpu(void *info)
+{
+	struct kmem_cache *s = info;
+
+	flush_remote_free_cache(s, get_cpu_slab(s, smp_processor_id()));
+}
+
+/*
+ * Return all queued objects of a cache to the slabs, and the empty slabs
+ * to the page allocator.  The remote free buffers of all cpus are
+ * flushed before any cpu claims its remote frees, so nothing is left
+ * behind.  Called with the cpu hotplug lock held.
+ */
+static void drain_cache(struct kmem_cache *s)
+{
+	int cpu;
+
+	on_each_cpu(flush_remote_cpu, s, 1);
+	on_each_cpu(drain_cpu, s, 1);
+
+	down_write(&slqb_lock);
+	for_each_possible_cpu(cpu) {
+		if (cpu_online(cpu))
+			continue;
+		local_irq_disable();
+		drain_cpu_slab(s, get_cpu_slab(s, cpu));
+		local_irq_enable();
+	}
+	up_write(&slqb_lock);
+}
+
+int kmem_cache_shrink(struct kmem_cache *s)
+{
+	get_online_cpus();
+	drain_cache(s);
+	put_online_cpus();
+
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_shrink);
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+		size_t align, unsigned long flags, void (*ctor)(void *))
+{
+	struct kmem_cache *s;
+
+	BUG_ON(!name || in_interrupt());
+
+	s = kzalloc(sizeof(struct kmem_cache), GFP_KERNEL);
+	if (!s)
+		goto err;
+
+	if (kmem_cache_open(s, name, size, align, flags, ctor) &&
+	    alloc_kmem_cache_cpus(s)) {
+		down_write(&slqb_lock);
+		list_add(&s->list, &slab_caches);
+		up_write(&slqb_lock);
+		return s;
+	}
+	kfree(s);
+err:
+	if (flags & SLAB_PANIC)
+		panic("Cannot create slabcache %s\n", name);
+	return NULL;
+}
+EXPORT_SYMBOL(kmem_cache_create);
+
+void kmem_cache_destroy(struct kmem_cache *s)
+{
+	int cpu;
+
+	down_write(&slqb_lock);
+	list_del(&s->list);
+	up_write(&slqb_lock);
+
+	get_online_cpus();
+	drain_cache(s);
+	put_online_cpus();
+
+	/* The slabs being freed by RCU still point to the lists */
+	if (s->flags & SLAB_DESTROY_BY_RCU)
+		rcu_barrier();
+
+	for_each_possible_cpu(cpu) {
+		if (get_cpu_slab(s, cpu)->list.nr_slabs) {
+			printk(KERN_ERR "SLQB %s: %s called for cache that "
+				"still has objects.\n", s->name, __func__);
+			dump_stack();
+			return;
+		}
+	}
+
+	free_kmem_cache_cpus(s);
+	kfree(s);
+}
+EXPORT_SYMBOL(kmem_cache_destroy);
+
+/********************************************************************
+ *		Kmalloc subsystem
+ *******************************************************************/
+
+struct kmem_cache kmalloc_caches[PAGE_SHIFT + 1] __cacheline_aligned;
+EXPORT_SYMBOL(kmalloc_caches);
+
+#ifdef CONFIG_ZONE_DMA
+static struct kmem_cache kmalloc_caches_dma[PAGE_SHIFT + 1];
+#endif
+
+#ifdef CONFIG_SMP
+/* kmalloc cannot allocate its own per cpu structures at boot */
+static DEFINE_PER_CPU(struct kmem_cache_cpu, kmalloc_cpu_slab[PAGE_SHIFT + 1]);
+#ifdef CONFIG_ZONE_DMA
+static DEFINE_PER_CPU(struct kmem_cache_cpu,
+		      kmalloc_dma_cpu_slab[PAGE_SHIFT + 1]);
+#endif
+#endif
+
+/*
+ * Conversion table for small slabs sizes / 8 to the index in the
+ * kmalloc array. This is necessary for slabs < 192 since we have non power
+ * of two cache sizes there. The size of larger slabs can be determined using
+ * fls.
+ */
+static s8 size_index[24] = {
+	3,	/* 8 */
+	4,	/* 16 */
+	5,	/* 24 */
+	5,	/* 32 */
+	6,	/* 40 */
+	6,	/* 48 */
+	6,	/* 56 */
+	6,	/* 64 */
+	1,	/* 72 */
+	1,	/* 80 */
+	1,	/* 88 */
+	1,	/* 96 */
+	7,	/* 104 */
+	7,	/* 112 */
+	7,	/* 120 */
+	7,	/* 128 */
+	2,	/* 136 */
+	2,	/* 144 */
+	2,	/* 152 */
+	2,	/* 160 */
+	2,	/* 168 */
+	2,	/* 176 */
+	2,	/* 184 */
+	2	/* 192 */
+};
+
+static struct kmem_cache *get_slab(size_t size, gfp_t flags)
+{
+	int index;
+
+	if (size <= 192) {
+		if (!size)
+			return ZERO_SIZE_PTR;
+
+		index = size_index[(size - 1) / 8];
+	} else
+		index = fls(size - 1);
+
+#ifdef CONFIG_ZONE_DMA
+	if (unlikely(flags & SLQB_DMA))
+		return &kmalloc_caches_dma[index];
+#endif
+	return &kmalloc_caches[index];
+}
+
+void *__kmalloc(size_t size, gfp_t flags)
+{
+	struct kmem_cache *s;
+
+	if (unlikely(size > PAGE_SIZE))
+		return kmalloc_large(size, flags);
+
+	s = get_slab(size, flags);
+
+	if (unlikely(ZERO_OR_NULL_PTR(s)))
+		return s;
+
+	return slab_alloc(s, flags);
+}
+EXPORT_SYMBOL(__kmalloc);
+
+size_t ksize(const void *object)
+{
+	struct page *page;
+	struct kmem_cache *s;
+
+	if (unlikely(object == ZERO_SIZE_PTR))
+		return 0;
+
+	page = virt_to_head_page(object);
+
+	if (unlikely(!PageSlab(page))) {
+		WARN_ON(!PageCompound(page));
+		return PAGE_SIZE << compound_order(page);
+	}
+	s = slab_list(page)->cache;
+
+	/* Everything up to the free pointer is usable */
+	return s->offset ? s->offset : s->size;
+}
+EXPORT_SYMBOL(ksize);
+
+void kfree(const void *x)
+{
+	struct page *page;
+
+	if (unlikely(ZERO_OR_NULL_PTR(x)))
+		return;
+
+	page = virt_to_head_page(x);
+	if (unlikely(!PageSlab(page))) {
+		BUG_ON(!PageCompound(page));
+		put_page(page);
+		return;
+	}
+	slab_free(slab_list(page)->cache, page, (void *)x);
+}
+EXPORT_SYMBOL(kfree);
+
+int kmem_ptr_validate(struct kmem_cache *s, const void *object)
+{
+	struct page *page = virt_to_head_page(object);
+	void *base;
+
+	if (!PageSlab(page) || slab_list(page)->cache != s)
+		/* No slab or wrong slab */
+		return 0;
+
+	base = page_address(page);
+	if (object < base || object >= base + page->objects * s->size ||
+	    (object - base) % s->size)
+		return 0;
+
+	return 1;
+}
+EXPORT_SYMBOL(kmem_ptr_validate);
+
+static void __init create_kmalloc_cache(struct kmem_cache *s, int index,
+		int dma, int size)
+{
+	unsigned long flags = dma ? SLAB_CACHE_DMA : 0;
+	int cpu;
+
+	if (!kmem_cache_open(s, "kmalloc", size, ARCH_KMALLOC_MINALIGN,
+			     flags, NULL))
+		panic("Creation of kmalloc slab size=%d failed.\n", size);
+
+	for_each_possible_cpu(cpu) {
+		struct kmem_cache_cpu *c;
+
+#ifdef CONFIG_SMP
+#ifdef CONFIG_ZONE_DMA
+		if (dma)
+			c = &per_cpu(kmalloc_dma_cpu_slab, cpu)[index];
+		else
+#endif
+			c = &per_cpu(kmalloc_cpu_slab, cpu)[index];
+		s->cpu_slab[cpu] = c;
+#else
+		c = &s->cpu_slab;
+#endif
+		init_kmem_cache_cpu(s, c);
+	}
+
+	list_add(&s->list, &slab_caches);
+}
+
+static void __init create_kmalloc_caches(struct kmem_cache *caches, int dma)
+{
+	int i;
+
+	/* Caches that are not of the two-to-the-power-of size */
+	if (KMALLOC_MIN_SIZE <= 64) {
+		create_kmalloc_cache(&caches[1], 1, dma, 96);
+		create_kmalloc_cache(&caches[2], 2, dma, 192);
+	}
+
+	for (i = KMALLOC_SHIFT_LOW; i <= PAGE_SHIFT; i++)
+		create_kmalloc_cache(&caches[i], i, dma, 1 << i);
+}
+
+static void __init name_kmalloc_caches(struct kmem_cache *caches,
+				       const char *prefix)
+{
+	int i;
+
+	for (i = 1; i <= PAGE_SHIFT; i++)
+		if (caches[i].objsize)
+			caches[i].name = kasprintf(GFP_KERNEL, "%s-%d",
+						   prefix, caches[i].objsize);
+}
+
+/********************************************************************
+ *		Queue trimming and cpu hotplug
+ *******************************************************************/
+
+static DEFINE_PER_CPU(struct delayed_work, slqb_trim_work);
+
+/*
+ * Every SLQB_TRIM_INTERVAL each cpu hands back what it gathered for other
+ * cpus, takes in what they handed back to it, and returns half of its
+ * queues to the slabs, so idle caches don't keep memory around forever.
+ */
+static void cache_trim(struct work_struct *w)
+{
+	struct delayed_work *work =
+		container_of(w, struct delayed_work, work);
+	struct kmem_cache *s;
+
+	if (!down_read_trylock(&slqb_lock))
+		goto out;
+
+	list_for_each_entry(s, &slab_caches, list) {
+		struct kmem_cache_cpu *c;
+		struct kmem_cache_list *l;
+
+		local_irq_disable();
+		c = get_cpu_slab(s, smp_processor_id());
+		l = &c->list;
+		flush_remote_free_cache(s, c);
+		if (l->remote_free_check)
+			claim_remote_free_list(s, l);
+		flush_list(s, l, (l->freelist_nr + 1) / 2);
+		local_irq_enable();
+
+		cond_resched();
+	}
+	up_read(&slqb_lock);
+out:
+	schedule_delayed_work(work, round_jiffies_relative(SLQB_TRIM_INTERVAL));
+}
+
+static void __cpuinit start_cpu_timer(int cpu)
+{
+	struct delayed_work *trim_work = &per_cpu(slqb_trim_work, cpu);
+
+	if (keventd_up() && trim_work->work.func == NULL) {
+		INIT_DELAYED_WORK(trim_work, cache_trim);
+		schedule_delayed_work_on(cpu, trim_work,
+			__round_jiffies_relative(SLQB_TRIM_INTERVAL, cpu));
+	}
+}
+
+static int __cpuinit slab_cpuup_callback(struct notifier_block *nfb,
+		unsigned long action, void *hcpu)
+{
+	long cpu = (long)hcpu;
+	struct kmem_cache *s;
+
+	switch (action) {
+	case CPU_ONLINE:
+	case CPU_ONLINE_FROZEN:
+	case CPU_DOWN_FAILED:
+	case CPU_DOWN_FAILED_FROZEN:
+		start_cpu_timer(cpu);
+		break;
+	case CPU_DOWN_PREPARE:
+	case CPU_DOWN_PREPARE_FROZEN:
+		cancel_rearming_delayed_work(&per_cpu(slqb_trim_work, cpu));
+		per_cpu(slqb_trim_work, cpu).work.func = NULL;
+		break;
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+		/*
+		 * The slabs stay with the lists of the dead cpu, objects
+		 * freed later on pile up on their remote free queues until
+		 * the cpu comes back or the cache is shrunk.
+		 */
+		down_write(&slqb_lock);
+		list_for_each_entry(s, &slab_caches, list) {
+			local_irq_disable();
+			drain_cpu_slab(s, get_cpu_slab(s, cpu));
+			local_irq_enable();
+		}
+		up_write(&slqb_lock);
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata slab_notifier = {
+	.notifier_call = slab_cpuup_callback
+};
+
+static int __init slqb_init_trim(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		start_cpu_timer(cpu);
+	return 0;
+}
+__initcall(slqb_init_trim);
+
+/********************************************************************
+ *			Basic setup of slabs
+ *******************************************************************/
+
+void __init kmem_cache_init(void)
+{
+	int i;
+
+	create_kmalloc_caches(kmalloc_caches, 0);
+#ifdef CONFIG_ZONE_DMA
+	create_kmalloc_caches(kmalloc_caches_dma, 1);
+#endif
+
+	/*
+	 * Patch up the size_index table if we have strange large alignment
+	 * requirements for the kmalloc array. This is only the case for
+	 * MIPS it seems. The standard arches will not generate any code here.
+	 *
+	 * Largest permitted alignment is 256 bytes due to the way we
+	 * handle the index determination for the smaller caches.
+	 *
+	 * Make sure that nothing crazy happens if someone starts tinkering
+	 * around with ARCH_KMALLOC_MINALIGN
+	 */
+	BUILD_BUG_ON(KMALLOC_MIN_SIZE > 256 ||
+		(KMALLOC_MIN_SIZE & (KMALLOC_MIN_SIZE - 1)));
+
+	for (i = 8; i < KMALLOC_MIN_SIZE; i += 8)
+		size_index[(i - 1) / 8] = KMALLOC_SHIFT_LOW;
+
+	if (KMALLOC_MIN_SIZE == 128) {
+		/*
+		 * The 192 byte sized cache is not used if the alignment
+		 * is 128 byte. Redirect kmalloc to use the 256 byte cache
+		 * instead.
+		 */
+		for (i = 128 + 8; i <= 192; i += 8)
+			size_index[(i - 1) / 8] = 8;
+	}
+
+	slab_state = UP;
+
+	/* Provide the correct kmalloc names now that the caches are up */
+	name_kmalloc_caches(kmalloc_caches, "kmalloc");
+#ifdef CONFIG_ZONE_DMA
+	name_kmalloc_caches(kmalloc_caches_dma, "kmalloc_dma");
+#endif
+
+	register_cpu_notifier(&slab_notifier);
+
+	printk(KERN_INFO "SLQB: HWalign=%d, MinObjects=%d, CPUs=%d\n",
+		cache_line_size(), SLQB_MIN_OBJECTS, nr_cpu_ids);
+}
+
+#ifdef CONFIG_SLABINFO
+static void print_slabinfo_header(struct seq_file *m)
+{
+	seq_puts(m, "slabinfo - version: 2.1\n");
+	seq_puts(m, "# name            <active_objs> <num_objs> <objsize> "
+		 "<objperslab> <pagesperslab>");
+	seq_puts(m, " : tunables <limit> <batchcount> <sharedfactor>");
+	seq_puts(m, " : slabdata <active_slabs> <num_slabs> <sharedavail>");
+	seq_putc(m, '\n');
+}
+
+static void *s_start(struct seq_file *m, loff_t *pos)
+{
+	loff_t n = *pos;
+
+	down_read(&slqb_lock);
+	if (!n)
+		print_slabinfo_header(m);
+
+	return seq_list_start(&slab_caches, *pos);
+}
+
+static void *s_next(struct seq_file *m, void *p, loff_t *pos)
+{
+	return seq_list_next(p, &slab_caches, pos);
+}
+
+static void s_stop(struct seq_file *m, void *p)
+{
+	up_read(&slqb_lock);
+}
+
+/*
+ * The counters of other cpus are read without synchronization, the
+ * numbers are only a snapshot.
+ */
+static int s_show(struct seq_file *m, void *p)
+{
+	unsigned long nr_slabs = 0;
+	unsigned long nr_objs = 0;
+	unsigned long nr_free = 0;
+	struct kmem_cache *s;
+	int cpu;
+
+	s = list_entry(p, struct kmem_cache, list);
+
+	for_each_possible_cpu(cpu) {
+		struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
+		struct kmem_cache_list *l = &c->list;
+
+		nr_slabs += l->nr_slabs;
+		nr_objs += l->nr_objects;
+		nr_free += l->nr_free + l->freelist_nr + l->remote_free.nr +
+			   c->rnr;
+	}
+
+	seq_printf(m, "%-17s %6lu %6lu %6u %4u %4d", s->name,
+		   nr_objs - min(nr_free, nr_objs), nr_objs, s->size,
+		   (unsigned int)((PAGE_SIZE << s->order) / s->size),
+		   1 << s->order);
+	seq_printf(m, " : tunables %4u %4u %4u", s->hiwater, s->batch, 0);
+	seq_printf(m, " : slabdata %6lu %6lu %6lu", nr_slabs, nr_slabs,
+		   0UL);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static const struct seq_operations slabinfo_op = {
+	.start = s_start,
+	.next = s_next,
+	.stop = s_stop,
+	.show = s_show,
+};
+
+static int slabinfo_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &slabinfo_op);
+}
+
+static const struct file_operations proc_slabinfo_operations = {
+	.open		= slabinfo_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+static int __init slab_proc_init(void)
+{
+	proc_create("slabinfo", S_IRUGO, NULL, &proc_slabinfo_operations);
+	return 0;
+}
+module_init(slab_proc_init);
+#endif /* CONFIG_SLABINFO */
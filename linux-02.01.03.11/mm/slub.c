@@ -134,6 +134,12 @@
  */
 #define MAX_PARTIAL 10
 
+/*
+ * Maximum number of objects a cpu gathers for a slab that is not its
+ * cpu slab before putting them back on the slab's freelist.
+ */
+#define SLUB_REMOTE_FREE_BATCH 32
+
 #define DEBUG_DEFAULT_FLAGS (SLAB_DEBUG_FREE | SLAB_RED_ZONE | \
 				SLAB_POISON | SLAB_STORE_USER)
 
@@ -1408,6 +1414,77 @@ static void unfreeze_slab(struct kmem_cache *s, struct page *page, int tail)
 	}
 }
 
+/*
+ * Put a chain of @nr objects, from @head to @tail, back on the freelist of
+ * their slab.  Called with interrupts disabled and the slab locked, drops
+ * the slab lock.
+ */
+static void free_to_slab(struct kmem_cache *s, struct kmem_cache_cpu *c,
+		struct page *page, void **head, void **tail, int nr)
+{
+	void *prior;
+
+	prior = tail[c->offset] = page->freelist;
+	page->freelist = head;
+	page->inuse -= nr;
+
+	if (unlikely(PageSlubFrozen(page))) {
+		stat(c, FREE_FROZEN);
+		goto out_unlock;
+	}
+
+	if (unlikely(!page->inuse))
+		goto slab_empty;
+
+	/*
+	 * Objects left in the slab. If it was not on the partial list before
+	 * then add it.
+	 */
+	if (unlikely(!prior)) {
+		add_partial(get_node(s, page_to_nid(page)), page, 1);
+		stat(c, FREE_ADD_PARTIAL);
+	}
+
+out_unlock:
+	slab_unlock(page);
+	return;
+
+slab_empty:
+	if (prior) {
+		/*
+		 * Slab still on the partial list.
+		 */
+		remove_partial(s, page);
+		stat(c, FREE_REMOVE_PARTIAL);
+	}
+	slab_unlock(page);
+	stat(c, FREE_SLAB);
+	discard_slab(s, page);
+}
+
+/*
+ * Flush the remote free buffer: hand the objects gathered for one slab
+ * back to it, taking the slab lock once for all of them.
+ *
+ * Interrupts are disabled.
+ */
+static void flush_remote_frees(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page = c->rfree_page;
+
+	if (!page)
+		return;
+
+	stat(c, FREE_REMOTE_FLUSH);
+	slab_lock(page);
+	free_to_slab(s, c, page, c->rfree_head, c->rfree_tail, c->rfree_nr);
+
+	c->rfree_page = NULL;
+	c->rfree_head = NULL;
+	c->rfree_tail = NULL;
+	c->rfree_nr = 0;
+}
+
 /*
  * Remove the cpu slab
  */
@@ -1457,7 +1534,11 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
 
-	if (likely(c && c->page))
+	if (unlikely(!c))
+		return;
+
+	flush_remote_frees(s, c);
+	if (likely(c->page))
 		flush_slab(s, c);
 }
 
@@ -1473,6 +1554,33 @@ static void flush_all(struct kmem_cache *s)
 	on_each_cpu(flush_cpu_slab, s, 1);
 }
 
+/*
+ * Hand back the objects sitting in this cpu's remote free buffers.  A
+ * buffer is otherwise only flushed when it fills up or the next remote
+ * free is for another slab, which could keep a slab from being freed
+ * for as long as the cpu stays quiet.  Called periodically from the
+ * vmstat timer on each cpu.
+ */
+void slub_flush_remote_frees(void)
+{
+	struct kmem_cache *s;
+	unsigned long flags;
+
+	if (!down_read_trylock(&slub_lock))
+		return;
+
+	list_for_each_entry(s, &slab_caches, list) {
+		struct kmem_cache_cpu *c;
+
+		local_irq_save(flags);
+		c = get_cpu_slab(s, smp_processor_id());
+		if (c)
+			flush_remote_frees(s, c);
+		local_irq_restore(flags);
+	}
+	up_read(&slub_lock);
+}
+
 /*
  * Check if the objects in a per cpu structure fit numa
  * locality expectations.
@@ -1639,67 +1747,40 @@ EXPORT_SYMBOL(kmem_cache_alloc_node);
  * Slow patch handling. This may still be called frequently since objects
  * have a longer lifetime than the cpu slabs in most processing loads.
  *
- * So we still attempt to reduce cache line usage. Just take the slab
- * lock and free the item. If there is no additional partial page
- * handling required then we can return immediately.
+ * The object is not put back on its slab right away, but starts a new
+ * remote free buffer for that slab, after handing the objects in the old
+ * one back to their slab.  A consumer freeing what a producer on another
+ * cpu allocated frees many objects in a row to the same slab, which then
+ * only gets locked, and its struct page touched, once per batch.  Slabs
+ * under debugging check every object and are still freed one by one.
  */
 static void __slab_free(struct kmem_cache *s, struct page *page,
 			void *x, unsigned long addr, unsigned int offset)
 {
-	void *prior;
 	void **object = (void *)x;
 	struct kmem_cache_cpu *c;
 
 	c = get_cpu_slab(s, raw_smp_processor_id());
 	stat(c, FREE_SLOWPATH);
-	slab_lock(page);
 
 	if (unlikely(SLABDEBUG && PageSlubDebug(page)))
 		goto debug;
 
-checks_ok:
-	prior = object[offset] = page->freelist;
-	page->freelist = object;
-	page->inuse--;
-
-	if (unlikely(PageSlubFrozen(page))) {
-		stat(c, FREE_FROZEN);
-		goto out_unlock;
-	}
-
-	if (unlikely(!page->inuse))
-		goto slab_empty;
-
-	/*
-	 * Objects left in the slab. If it was not on the partial list before
-	 * then add it.
-	 */
-	if (unlikely(!prior)) {
-		add_partial(get_node(s, page_to_nid(page)), page, 1);
-		stat(c, FREE_ADD_PARTIAL);
-	}
-
-out_unlock:
-	slab_unlock(page);
-	return;
-
-slab_empty:
-	if (prior) {
-		/*
-		 * Slab still on the partial list.
-		 */
-		remove_partial(s, page);
-		stat(c, FREE_REMOVE_PARTIAL);
-	}
-	slab_unlock(page);
-	stat(c, FREE_SLAB);
-	discard_slab(s, page);
+	flush_remote_frees(s, c);
+	object[offset] = NULL;
+	c->rfree_page = page;
+	c->rfree_head = object;
+	c->rfree_tail = object;
+	c->rfree_nr = 1;
 	return;
 
 debug:
-	if (!free_debug_processing(s, page, x, addr))
-		goto out_unlock;
-	goto checks_ok;
+	slab_lock(page);
+	if (!free_debug_processing(s, page, x, addr)) {
+		slab_unlock(page);
+		return;
+	}
+	free_to_slab(s, c, page, object, object, 1);
 }
 
 /*
@@ -1729,6 +1810,12 @@ static __always_inline void slab_free(struct kmem_cache *s,
 		object[c->offset] = c->freelist;
 		c->freelist = object;
 		stat(c, FREE_FASTPATH);
+	} else if (likely(page == c->rfree_page)) {
+		object[c->offset] = c->rfree_head;
+		c->rfree_head = object;
+		stat(c, FREE_REMOTE_BUFFER);
+		if (unlikely(++c->rfree_nr >= SLUB_REMOTE_FREE_BATCH))
+			flush_remote_frees(s, c);
 	} else
 		__slab_free(s, page, x, addr, c->offset);
 
@@ -1919,6 +2006,10 @@ static void init_kmem_cache_cpu(struct kmem_cache *s,
 	c->node = 0;
 	c->offset = s->offset / sizeof(void *);
 	c->objsize = s->objsize;
+	c->rfree_page = NULL;
+	c->rfree_head = NULL;
+	c->rfree_tail = NULL;
+	c->rfree_nr = 0;
 #ifdef CONFIG_SLUB_STATS
 	memset(c->stat, 0, NR_SLUB_STAT_ITEMS * sizeof(unsigned));
 #endif
@@ -2777,10 +2868,11 @@ int kmem_cache_shrink(struct kmem_cache *s)
 		kmalloc(sizeof(struct list_head) * objects, GFP_KERNEL);
 	unsigned long flags;
 
+	/* Even if we can't sort the partial lists, drain the cpus */
+	flush_all(s);
 	if (!slabs_by_inuse)
 		return -ENOMEM;
 
-	flush_all(s);
 	for_each_node_state(node, N_NORMAL_MEMORY) {
 		n = get_node(s, node);
 
@@ -4143,6 +4235,8 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(FREE_REMOTE_BUFFER, free_remote_buffer);
+STAT_ATTR(FREE_REMOTE_FLUSH, free_remote_flush);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4196,6 +4290,8 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&free_remote_buffer_attr.attr,
+	&free_remote_flush_attr.attr,
 #endif
 	NULL
 };
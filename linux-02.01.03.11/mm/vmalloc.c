@@ -24,6 +24,7 @@
 #include <linux/radix-tree.h>
 #include <linux/rcupdate.h>
 #include <linux/bootmem.h>
+#include <linux/pfn.h>
 
 #include <asm/atomic.h>
 #include <asm/uaccess.h>
@@ -982,6 +983,28 @@ void *vm_map_ram(struct page **pages, unsigned int count, int node, pgprot_t pro
 }
 EXPORT_SYMBOL(vm_map_ram);
 
+/**
+ * vm_area_register_early - register vmap area early during boot
+ * @vm: vm_struct to register
+ * @align: requested alignment
+ *
+ * Give @vm a range of vmalloc space before vmalloc_init(), which picks
+ * it up then.  @vm->size and @vm->flags must be set; the caller maps
+ * the area itself, allocating page tables from bootmem.
+ */
+void __init vm_area_register_early(struct vm_struct *vm, size_t align)
+{
+	static size_t vm_init_off __initdata;
+	unsigned long addr;
+
+	addr = ALIGN(VMALLOC_START + vm_init_off, align);
+	vm_init_off = PFN_ALIGN(addr + vm->size) - VMALLOC_START;
+
+	vm->addr = (void *)addr;
+	vm->next = vmlist;
+	vmlist = vm;
+}
+
 void __init vmalloc_init(void)
 {
 	struct vmap_area *va;
@@ -1009,6 +1032,26 @@ void __init vmalloc_init(void)
 	vmap_initialized = true;
 }
 
+/**
+ * map_kernel_range - map kernel VM area with the specified pages
+ * @addr: start of the VM area to map
+ * @size: size of the VM area to map
+ * @prot: page protection flags to use
+ * @pages: pages to map, one per PAGE_SIZE of @size
+ *
+ * Like map_vm_area(), for a part of an area only: used by the percpu
+ * allocator, which maps the units of a chunk one CPU at a time.
+ * Returns 0 on success, -errno on failure.
+ */
+int map_kernel_range(unsigned long addr, unsigned long size, pgprot_t prot,
+		     struct page **pages)
+{
+	int ret;
+
+	ret = vmap_page_range(addr, addr + size, prot, pages);
+	return ret < 0 ? ret : 0;
+}
+
 void unmap_kernel_range(unsigned long addr, unsigned long size)
 {
 	unsigned long end = addr + size;